@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "World/Broadphase.h"
+#include "World/EntityRegistry.h"
+#include "World/Heightmap.h"
+#include "World/MovementValidator.h"
+#include "utility/SimdKernels.h"
+#include "utility/utility.h"
+#include "Log/Logger.h"
+
+/// Every measurement is repeated this often, the fastest run counts
+static const uint32_t const_repetitions = 20;
+/// Entities for the kernels
+static const uint32_t const_kernelCounts[] = {1000, 10000, 100000, 1000000};
+/// Collision boxes for the Broadphase
+static const uint32_t const_boxCounts[] = {10000, 100000};
+/// Movement packets validated per measurement
+static const uint32_t const_movementCount = 100000;
+/// Samples along x and z of the generated heightmap
+static const uint32_t const_heightmapSize = 1024;
+/// Seconds of a Zone tick
+static const float const_tickSeconds = 0.05f;
+
+/**
+ * Runs a function const_repetitions times
+ * @return nanoseconds of the fastest run
+ */
+template<typename Function>
+static uint64_t measure(Function function)
+{
+    uint64_t fastest = UINT64_MAX;
+    for (uint32_t repetition = 0; repetition < const_repetitions; repetition++)
+    {
+        uint64_t start = getTimeNanoseconds();
+        function();
+        fastest = std::min(fastest, getTimeNanoseconds() - start);
+    }
+    return fastest;
+}
+
+static void report(const char* name, uint32_t count, const char* variant, uint64_t nanoseconds)
+{
+    printf("%-20s %8u %-8s %12.1f us %8.2f ns/entity\n", name, count, variant,
+           nanoseconds / 1000.0, (double)nanoseconds / std::max(count, 1u));
+}
+
+static void benchmarkKernels(std::mt19937& random)
+{
+    std::uniform_real_distribution<float> position(-1000.f, 1000.f);
+    std::uniform_real_distribution<float> velocity(-10.f, 10.f);
+
+    for (uint32_t count : const_kernelCounts)
+    {
+        std::vector<float> x(count), y(count), z(count);
+        std::vector<float> velocityX(count), velocityY(count, 0.f), velocityZ(count);
+        std::vector<uint32_t> flags(count, 0);
+        std::vector<uint32_t> result(count);
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            x[i] = position(random);
+            y[i] = 0.f;
+            z[i] = position(random);
+
+            // a third stands still, like idle players and NPCs
+            bool moving = random() % 3 != 0;
+            velocityX[i] = moving ? velocity(random) : 0.f;
+            velocityZ[i] = moving ? velocity(random) : 0.f;
+        }
+
+        for (int level = (int)SimdKernels::Level::SCALAR; level <= (int)SimdKernels::getSupportedLevel(); level++)
+        {
+            SimdKernels::setLevel((SimdKernels::Level)level);
+            const char* levelName = SimdKernels::getLevelName((SimdKernels::Level)level);
+
+            report("integrate", count, levelName, measure([&]() {
+                SimdKernels::integrate(count, const_tickSeconds, x.data(), y.data(), z.data(),
+                                       velocityX.data(), velocityY.data(), velocityZ.data(), flags.data(), 1);
+            }));
+
+            // an area of interest
+            report("filterWithinRadius", count, levelName, measure([&]() {
+                SimdKernels::filterWithinRadius(count, x.data(), z.data(), 0.f, 0.f, 100.f * 100.f, result.data());
+            }));
+
+            // a replication cell
+            report("filterInBounds", count, levelName, measure([&]() {
+                SimdKernels::filterInBounds(count, x.data(), z.data(), -32.f, -32.f, 32.f, 32.f, result.data());
+            }));
+        }
+    }
+
+    SimdKernels::setLevel(SimdKernels::getSupportedLevel());
+}
+
+static void benchmarkBroadphase(std::mt19937& random)
+{
+    for (uint32_t count : const_boxCounts)
+    {
+        // the density of a crowded Zone, about 10 entities per 100 square units
+        float size = std::sqrt(count * 10.f);
+        std::uniform_real_distribution<float> position(-size / 2.f, size / 2.f);
+        std::uniform_real_distribution<float> velocity(-5.f, 5.f);
+
+        EntityRegistry entities;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t index = entities.getIndex(entities.create(EntityRegistry::Type::NPC, nullptr));
+            entities.setPosition(index, position(random), 0.f, position(random));
+            entities.setVelocity(index, velocity(random), 0.f, velocity(random));
+            entities.setExtent(index, 0.5f);
+        }
+
+        Broadphase broadphase;
+
+        // the first update sorts everything, the others find the order of the last tick
+        report("Broadphase full", count, "", measure([&]() {
+            broadphase.clear();
+            broadphase.update(entities);
+        }));
+
+        report("Broadphase tick", count, "", measure([&]() {
+            entities.integrateMovement(const_tickSeconds);
+            broadphase.update(entities);
+            entities.clearDirty();
+        }));
+
+        printf("%-20s %8u pairs %zu\n", "Broadphase", count, broadphase.getPairs().size());
+    }
+}
+
+/**
+ * Writes a heightmap file of gentle hills, see Heightmap::load()
+ */
+static bool writeHeightmap(const std::string& fileName, float cellSize)
+{
+    std::ofstream file(fileName, std::ios::binary);
+
+    uint32_t size = const_heightmapSize;
+    float origin = -(float)(size - 1) * cellSize / 2.f;
+    file.write((const char*)&size, sizeof(size));
+    file.write((const char*)&size, sizeof(size));
+    file.write((const char*)&cellSize, sizeof(cellSize));
+    file.write((const char*)&origin, sizeof(origin));
+    file.write((const char*)&origin, sizeof(origin));
+
+    for (uint32_t row = 0; row < size; row++)
+    {
+        for (uint32_t column = 0; column < size; column++)
+        {
+            float height = 10.f * std::sin(column * 0.05f) * std::cos(row * 0.05f);
+            file.write((const char*)&height, sizeof(height));
+        }
+    }
+
+    // written completely before it's mapped
+    file.close();
+    return (bool)file;
+}
+
+static void benchmarkMovementValidator(std::mt19937& random)
+{
+    const float cellSize = 2.f;
+    const std::string heightmapFile = "benchmark.height";
+
+    std::shared_ptr<Heightmap> heightmap;
+    if (writeHeightmap(heightmapFile, cellSize))
+        heightmap = Heightmap::load(heightmapFile);
+
+    float extent = (const_heightmapSize - 1) * cellSize / 2.f;
+    std::uniform_real_distribution<float> position(-extent, extent);
+    std::uniform_real_distribution<float> step(-0.6f, 0.6f);
+
+    // the packets of players walking on the terrain, a few are too fast
+    struct Movement
+    {
+        float fromX, fromZ;
+        float toX, toY, toZ;
+    };
+    std::vector<Movement> movements(const_movementCount);
+    for (auto& movement : movements)
+    {
+        movement.fromX = position(random);
+        movement.fromZ = position(random);
+        float scale = random() % 50 == 0 ? 10.f : 1.f;
+        movement.toX = movement.fromX + step(random) * scale;
+        movement.toZ = movement.fromZ + step(random) * scale;
+        movement.toY = heightmap ? heightmap->getHeight(movement.toX, movement.toZ) : 0.f;
+    }
+
+    MovementValidator validator;
+    validator.setBounds(-extent, -extent, extent, extent);
+
+    for (uint32_t withHeightmap = 0; withHeightmap < 2; withHeightmap++)
+    {
+        if (withHeightmap)
+        {
+            if (!heightmap)
+                break;
+            validator.setHeightmap(heightmap);
+        }
+
+        uint32_t valid = 0;
+        report("MovementValidator", const_movementCount, withHeightmap ? "terrain" : "bounds", measure([&]() {
+            valid = 0;
+            for (auto& movement : movements)
+            {
+                float allowance = 1.f;
+                valid += validator.validate(movement.fromX, movement.fromZ,
+                                            movement.toX, movement.toY, movement.toZ, allowance) ==
+                         MovementValidator::Result::VALID;
+            }
+        }));
+
+        printf("%-20s %8u valid %u\n", "MovementValidator", const_movementCount, valid);
+    }
+
+    // the mapping stays valid until the heightmap is destroyed
+    std::remove(heightmapFile.c_str());
+}
+
+/**
+ * Measures the hot loops of a Zone tick: the SimdKernels at every Level the
+ * CPU supports, the Broadphase and the MovementValidator. Not a test, the
+ * timings depend on the machine.
+ */
+int main()
+{
+    Logger* logger = new Logger();
+
+    std::mt19937 random(1);
+
+    printf("supported %s\n", SimdKernels::getLevelName(SimdKernels::getSupportedLevel()));
+
+    benchmarkKernels(random);
+    benchmarkBroadphase(random);
+    benchmarkMovementValidator(random);
+
+    delete logger;
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+#include "Metrics.h"
+
+#include "Log/Logger.h"
+
+Metrics* Metrics::instance = nullptr;
+
+std::atomic<int64_t>& Metrics::get(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+
+    std::unique_ptr<std::atomic<int64_t>>& metric = mMetrics[name];
+
+    if (!metric)
+        metric.reset(new std::atomic<int64_t>(0));
+
+    return *metric;
+}
+
+void Metrics::logMetrics()
+{
+    std::lock_guard<std::mutex> lock(mMetricsMutex);
+
+    for (auto& metric : mMetrics)
+    {
+        log->info("Metric {} = {}", metric.first, metric.second->load());
+    }
+}
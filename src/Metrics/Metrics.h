@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#define sMetrics Metrics::getInstance()
+
+/**
+ * @brief Registry of named runtime values (counters and gauges)
+ *
+ * A metric is registered once by its name, the returned reference
+ * should be kept by the caller. Updating a metric is then only a single
+ * atomic operation and can be done from any thread.
+ *
+ * All metrics can be written to the log with logMetrics().
+ *
+ * @remark Singleton
+ */
+class Metrics
+{
+    /// The Singleton instance
+    static Metrics* instance;
+
+    /// For protecting the map of metrics
+    std::mutex mMetricsMutex;
+
+    /// All registered metrics by name, unique_ptr so references stay valid
+    std::map<std::string, std::unique_ptr<std::atomic<int64_t>>> mMetrics;
+
+public:
+    Metrics()
+    {
+        if (Metrics::instance != nullptr)
+            assert(false);
+
+        Metrics::instance = this;
+    }
+
+    ~Metrics()
+    {
+        Metrics::instance = nullptr;
+    }
+
+    /**
+     * Returns the Metrics registry
+     */
+    static Metrics* getInstance() { return instance; }
+
+    /**
+     * Gets a metric, registers it with the value 0 if it doesn't exist yet
+     * @param name unique name of the metric, e.g. "zonepool.1.load_us_per_s"
+     * @return reference to the value, valid as long as the registry exists
+     * @remark Thread-Safe
+     */
+    std::atomic<int64_t>& get(const std::string& name);
+
+    /**
+     * Writes all metrics with their current value to the log
+     * @remark Thread-Safe
+     */
+    void logMetrics();
+};
@@ -8,6 +8,13 @@
 #include "Log/Logger.h"
 #include "Network.h"
 #include "OpcodeHandler.h"
+#include "utility/utility.h"
+
+/// Bytes of the body before the data: opcode, sequence and tick
+static const uint16_t const_bodyHeaderSize = 2+2+4;
+
+/// Answers to pings older than this many microseconds are ignored
+static const uint64_t const_maxRoundTripTime = 60000000;
 
 Connection::Connection(uv_loop_t* uv_loop, Network* network) : mNetwork(network)
 {
@@ -28,8 +35,6 @@ Connection::Connection(uv_loop_t* uv_loop, Network* network) : mNetwork(network)
     uv_async_write_notification->data = this;
 
     mPlayerSession = new PlayerSession(this);
-    // TODO after login
-    mPlayerSession->enterGame();
 }
 
 Connection::~Connection()
@@ -173,8 +178,8 @@ void Connection::readPacketBody(const char* buffer, ssize_t size)
 
 void Connection::processPacket()
 {
-    // opcode 2 bytes big, body must be a minimum of one byte
-    if (mPacketBuffer.size() <= 2+1)
+    // opcode, sequence and tick 8 bytes big, body must be a minimum of one byte
+    if (mPacketBuffer.size() <= const_bodyHeaderSize)
     {
         // TODO: Add IP
         log->error("Connection: Malformed packet size {}", mPacketBuffer.size());
@@ -194,16 +199,46 @@ void Connection::processPacket()
 
     //log->info("Packet received!");
 
+    uint16_t sequence;
+    uint32_t tick;
+    memcpy(&sequence, mPacketBuffer.data()+2, 2);
+    memcpy(&tick, mPacketBuffer.data()+2+2, 4);
+
     // Fill packet structure
-    std::shared_ptr<Packet> packet = std::make_shared<Packet>(opcode, mPacketBuffer.begin()+2, mPacketBuffer.end());
+    std::shared_ptr<Packet> packet = std::make_shared<Packet>(opcode, mPacketBuffer.begin()+const_bodyHeaderSize, mPacketBuffer.end());
+    packet->setSequence(sequence);
+    packet->setTick(tick);
+
+    // answered here, without waiting for the tick of the Zone
+    if (opcode == (int)OpcodeHandler::Opcodes::CS_PONG)
+    {
+        handlePong(*packet);
+        return;
+    }
+    else if (opcode == (int)OpcodeHandler::Opcodes::CS_TIME_SYNC)
+    {
+        handleTimeSync(*packet);
+        return;
+    }
+    else if (opcode == (int)OpcodeHandler::Opcodes::CS_OBSERVE)
+    {
+        mPlayerSession->handleObservePacket(packet);
+        return;
+    }
+
+    // TODO after login, until then the first packet for the Zone enters the game
+    if (mPlayerSession->getZone() == nullptr)
+        mPlayerSession->enterGame();
 
     opcodeHandler.processPacket(mPlayerSession, packet);
 }
 
 void Connection::sendPacket(std::shared_ptr<Packet> packet)
 {
-    uint16_t bodylength = (uint16_t)packet->getSize()+2; // length = content + opcode 2 bytes
+    uint16_t bodylength = (uint16_t)packet->getSize()+const_bodyHeaderSize; // length = content + opcode, sequence and tick
     uint16_t opcode = packet->getOpcode();
+    uint16_t sequence = mSendSequence++;
+    uint32_t tick = packet->getTick();
 
     assert(bodylength < 102400); // smaller than 100 kilobytes, because allocating on stack
 
@@ -212,7 +247,9 @@ void Connection::sendPacket(std::shared_ptr<Packet> packet)
 
     memcpy(buffer, &bodylength, 2); // copy in the length of the packet
     memcpy(buffer+2, &opcode, 2); // copy the opcode number in
-    memcpy(buffer+2+2, packet->getRawData(), packet->getSize()); // copy the whole packet body
+    memcpy(buffer+2+2, &sequence, 2);
+    memcpy(buffer+2+2+2, &tick, 4);
+    memcpy(buffer+2+const_bodyHeaderSize, packet->getRawData(), packet->getSize()); // copy the whole packet body
 
     uv_write_t* write_request = (uv_write_t*)malloc(sizeof(uv_write_t));
 
@@ -235,4 +272,72 @@ void Connection::sendQueuedPackets()
     {
         sendPacket(packet);
     }
+
+    mSendQueueSize = (uint32_t)uv_client->write_queue_size;
+}
+
+void Connection::sendPing(uint64_t time)
+{
+    std::shared_ptr<Packet> packet = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_PING);
+    *packet << time;
+    sendPacket(packet);
+}
+
+void Connection::handlePong(Packet& packet)
+{
+    if (packet.getSize() < 2*sizeof(uint64_t))
+    {
+        log->error("Connection: Malformed pong size {}", packet.getSize());
+        return;
+    }
+
+    uint64_t pingTime, clientTime;
+    packet >> pingTime;
+    packet >> clientTime;
+
+    uint64_t currentTime = getTimeNanoseconds() / 1000;
+    if (pingTime > currentTime || currentTime - pingTime > const_maxRoundTripTime)
+        return;
+
+    uint32_t roundTripTime = (uint32_t)(currentTime - pingTime);
+
+    // the client answered halfway through the round trip
+    int64_t clockOffset = (int64_t)(clientTime - (pingTime + roundTripTime / 2));
+
+    // smoothed like the retransmission timer of TCP
+    if (mPongCount == 0)
+    {
+        mRoundTripTime = roundTripTime;
+        mRoundTripJitter = roundTripTime / 2;
+        mClockOffset = clockOffset;
+    }
+    else
+    {
+        uint32_t smoothed = mRoundTripTime;
+        uint32_t deviation = smoothed > roundTripTime ? smoothed - roundTripTime : roundTripTime - smoothed;
+
+        mRoundTripJitter = (3 * (uint64_t)mRoundTripJitter + deviation) / 4;
+        mRoundTripTime = (7 * (uint64_t)smoothed + roundTripTime) / 8;
+        int64_t smoothedOffset = mClockOffset;
+        mClockOffset = smoothedOffset + (clockOffset - smoothedOffset) / 8;
+    }
+
+    mPongCount++;
+}
+
+void Connection::handleTimeSync(Packet& packet)
+{
+    if (packet.getSize() < sizeof(uint64_t))
+    {
+        log->error("Connection: Malformed time sync size {}", packet.getSize());
+        return;
+    }
+
+    uint64_t clientTime;
+    packet >> clientTime;
+
+    std::shared_ptr<Packet> answer = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_TIME_SYNC);
+    *answer << clientTime;
+    *answer << getTimeNanoseconds() / 1000;
+    sendPacket(answer);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <uv.h>
 #include <vector>
 
@@ -40,11 +41,27 @@ class PlayerSession;
  * Field          | length
  * -------------- | -------------
  * Opcode (type-number of Packet) | 2 Bytes
+ * Sequence number | 2 Bytes
+ * Tick number    | 4 Bytes
  * Data           | variable length
  *
+ * The sequence number counts the packets sent in each direction and wraps
+ * around. The tick number is the Zone tick the packet belongs to, see Packet.
+ *
  * So a packet has a minimum length (specified in the header)
- * of 3 bytes (opcode + one byte of data). And a real
- * tcp body size of minimum 5 bytes.
+ * of 9 bytes (opcode + sequence + tick + one byte of data). And a real
+ * tcp body size of minimum 11 bytes.
+ *
+ * Pings and clock synchronization are answered directly by the network
+ * thread, so the delay of the Zone tick doesn't distort them:
+ * the Network sends SC_PING with the server time every second, the client
+ * answers CS_PONG with that time and it's own. A client synchronizing it's
+ * clock sends CS_TIME_SYNC with it's time and gets SC_TIME_SYNC with it's
+ * time and the server time back. All times are in microseconds.
+ *
+ * CS_OBSERVE is handled by the network thread as well, it doesn't need a
+ * Zone. The player only enters the game with it's first packet for a Zone,
+ * so a connection which only observes stays a spectator without an entity.
  *
  */
 class Connection
@@ -73,12 +90,30 @@ class Connection
     /// assigned by ZoneManager
     PlayerSession* mPlayerSession = nullptr;
 
+    /// sequence number of the next packet sent to the client
+    uint16_t mSendSequence = 0;
+
     /// Queue for packets which should be send to the client
     moodycamel::ConcurrentQueue<std::shared_ptr<Packet>> mPacketWriteQueue;
 
     /// For notifying the Connection (Network Thread) when a packet should be written
     uv_async_t* uv_async_write_notification;
 
+    /// smoothed round trip time in microseconds, 0 until measured
+    std::atomic<uint32_t> mRoundTripTime{0};
+
+    /// smoothed deviation of the round trip time in microseconds
+    std::atomic<uint32_t> mRoundTripJitter{0};
+
+    /// smoothed difference of the client clock to the server clock in microseconds
+    std::atomic<int64_t> mClockOffset{0};
+
+    /// number of answered pings, only used by the network thread
+    uint32_t mPongCount = 0;
+
+    /// bytes waiting in the write queue of uv after the last sendQueuedPackets()
+    std::atomic<uint32_t> mSendQueueSize{0};
+
     /**
      * Constructs a Connection object
      * @param uv_loop uv_loop of the Network object
@@ -142,6 +177,30 @@ class Connection
      */
     void sendQueuedPackets();
 
+    /**
+     * Sends a ping, answered by the client with CS_PONG
+     * @param time server time in microseconds
+     * @remark not thread-safe
+     */
+    void sendPing(uint64_t time);
+
+    /**
+     * Updates the round trip time and clock offset with the answer to a ping
+     * @param packet CS_PONG packet
+     */
+    void handlePong(Packet& packet);
+
+    /**
+     * Answers a clock synchronization request of the client
+     * @param packet CS_TIME_SYNC packet
+     */
+    void handleTimeSync(Packet& packet);
+
+    /**
+     * @return true if a ping was answered yet
+     */
+    bool hasRoundTripTime() { return mPongCount > 0; }
+
     /**
      * Gets the tcp handle
      * @return uv tcp handle
@@ -161,4 +220,28 @@ public:
      * @remark thread-safe
      */
     void queueSendPacket(std::shared_ptr<Packet> packet) { mPacketWriteQueue.enqueue(packet); uv_async_send(uv_async_write_notification); }
+
+    /**
+     * @return smoothed round trip time in microseconds, 0 until the first ping is answered
+     * @remark thread-safe
+     */
+    uint32_t getRoundTripTime() { return mRoundTripTime; }
+
+    /**
+     * @return smoothed deviation of the round trip time in microseconds
+     * @remark thread-safe
+     */
+    uint32_t getRoundTripJitter() { return mRoundTripJitter; }
+
+    /**
+     * @return microseconds the clock of the client is ahead of the server clock
+     * @remark thread-safe
+     */
+    int64_t getClockOffset() { return mClockOffset; }
+
+    /**
+     * @return bytes not sent to the client yet, grows while the client can't keep up
+     * @remark thread-safe
+     */
+    uint32_t getSendQueueSize() { return mSendQueueSize; }
 };
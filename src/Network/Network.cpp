@@ -1,8 +1,17 @@
 #include "Network.h"
 
+#include "Metrics/Metrics.h"
+#include "utility/Histogram.h"
+#include "utility/utility.h"
 #include "Log/Logger.h"
 
-Network::Network()
+/// Milliseconds between two pings of every connection
+static const uint64_t const_pingInterval = 1000;
+
+Network::Network() :
+        mRoundTripTimeMedianMetric(sMetrics->get("network.rtt_p50_us")),
+        mRoundTripTimeP99Metric(sMetrics->get("network.rtt_p99_us")),
+        mRoundTripJitterP99Metric(sMetrics->get("network.rtt_jitter_p99_us"))
 {
     uv_loop_init(&uv_loop);
 }
@@ -89,6 +98,16 @@ void Network::listen(int port)
 
     uv_server.data = this; // to call the member instead of the static function later
 
+    uv_timer_init(&uv_loop, &uv_ping_timer);
+    uv_ping_timer.data = this;
+    uv_timer_start(&uv_ping_timer,
+                   [](uv_timer_t* handle)
+                   {
+                       reinterpret_cast<Network*>(handle->data)->ping();
+                   },
+                   const_pingInterval, const_pingInterval
+    );
+
     int r = uv_listen((uv_stream_t*)&uv_server, 128,
                   [](uv_stream_t* server, int status)
                   {
@@ -109,4 +128,30 @@ void Network::listen(int port)
 
     if (uv_is_closing((uv_handle_t*)&uv_server) == 0)
         uv_close((uv_handle_t*)&uv_server, NULL);
+
+    if (uv_is_closing((uv_handle_t*)&uv_ping_timer) == 0)
+        uv_close((uv_handle_t*)&uv_ping_timer, NULL);
+}
+
+void Network::ping()
+{
+    Histogram roundTripTimes;
+    Histogram roundTripJitters;
+
+    uint64_t currentTime = getTimeNanoseconds() / 1000;
+
+    for (auto&& connection : mConnections)
+    {
+        if (connection->hasRoundTripTime())
+        {
+            roundTripTimes.record(connection->getRoundTripTime());
+            roundTripJitters.record(connection->getRoundTripJitter());
+        }
+
+        connection->sendPing(currentTime);
+    }
+
+    mRoundTripTimeMedianMetric = (int64_t)roundTripTimes.getPercentile(50);
+    mRoundTripTimeP99Metric = (int64_t)roundTripTimes.getPercentile(99);
+    mRoundTripJitterP99Metric = (int64_t)roundTripJitters.getPercentile(99);
 }
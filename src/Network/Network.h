@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <forward_list>
 #include <uv.h>
 
@@ -32,6 +34,14 @@ class Network
     /// used for sending stop notification
     uv_async_t uv_async;
 
+    /// pings all connections periodically
+    uv_timer_t uv_ping_timer;
+
+    /// Metrics of the round trip times of all connections in microseconds
+    std::atomic<int64_t>& mRoundTripTimeMedianMetric;
+    std::atomic<int64_t>& mRoundTripTimeP99Metric;
+    std::atomic<int64_t>& mRoundTripJitterP99Metric;
+
 
     /**
      * Creates a new Connection object, and keeps track of it
@@ -75,6 +85,12 @@ class Network
      */
     void onNewConnection(uv_stream_t* server, int status);
 
+    /**
+     * Sends a ping to every connection and exports the round trip times
+     * measured with the previous pings
+     */
+    void ping();
+
 public:
     Network();
     ~Network();
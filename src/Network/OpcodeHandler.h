@@ -27,6 +27,17 @@ public:
         RESERVED_2 = 10,
         CS_MOVEPACKET = 11,
         SC_MOVEPACKET = 12,
+        SC_INPUT_ACK = 13,
+        SC_PING = 14,
+        CS_PONG = 15,
+        CS_TIME_SYNC = 16,
+        SC_TIME_SYNC = 17,
+        SC_SPAWN = 18,
+        SC_DESPAWN = 19,
+        SC_CELL_FRAME = 20,
+        SC_OBSERVER_FRAME = 21,
+        SC_PROPERTIES = 22,
+        CS_OBSERVE = 23,
         NUM,
     };
 
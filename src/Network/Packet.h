@@ -5,12 +5,23 @@
 /**
  * @brief A packet containg data via ByteBuffer
  *        and an opcode, it's type.
+ *
+ * The sequence number counts the packets of a connection in each direction,
+ * the tick number is the tick of the Zone the packet belongs to: for incoming
+ * packets the tick the client wants the input applied on, for outgoing packets
+ * the tick which created it. Clients use both for prediction.
  */
 class Packet : public ByteBuffer
 {
     /// Opcode of the packet, basically the packet type
     uint16_t mOpcode;
 
+    /// Number of the packet in it's connection, set for received packets
+    uint16_t mSequence = 0;
+
+    /// Tick of the Zone, 0 if none
+    uint32_t mTick = 0;
+
 public:
     /**
      * Constructs a packet
@@ -50,4 +61,30 @@ public:
     {
         return mOpcode;
     }
+
+    /**
+     * @returns the sequence number the client gave the packet
+     */
+    inline uint16_t getSequence()
+    {
+        return mSequence;
+    }
+
+    inline void setSequence(uint16_t sequence)
+    {
+        mSequence = sequence;
+    }
+
+    /**
+     * @returns the tick of the Zone the packet belongs to, 0 if none
+     */
+    inline uint32_t getTick()
+    {
+        return mTick;
+    }
+
+    inline void setTick(uint32_t tick)
+    {
+        mTick = tick;
+    }
 };
@@ -1,9 +1,22 @@
 #include "PlayerSession.h"
 
+#include <algorithm>
+
 #include "Connection.h"
+#include "OpcodeHandler.h"
 #include "Server/Server.h"
 #include "World/Zone.h"
 #include "World/ZoneManager.h"
+#include "Log/Logger.h"
+
+/// Ticks a packet may wait for the tick it targets, packets for later ticks wait only this long
+static const uint32_t const_inputJitterWindow = 4;
+
+/// Packets waiting at most, further packets are processed immediately
+static const size_t const_inputBufferSize = 32;
+
+/// Milliseconds an observer may see a Zone late at most
+static const uint32_t const_maxObserverDelay = 5 * 60 * 1000;
 
 PlayerSession::PlayerSession(Connection* connection) : mConnection(connection)
 {
@@ -12,28 +25,169 @@ PlayerSession::PlayerSession(Connection* connection) : mConnection(connection)
 
 PlayerSession::~PlayerSession()
 {
-    if (mZone && !Server::isStopping())
-        mZone->removeSession(this);
+    if (Server::isStopping())
+        return;
+
+    {
+        // afterwards no Zone hands the session off anymore, so mZone stays the same
+        std::unique_lock<std::mutex> lock(mHandoffMutex);
+        mHandoffCondition.wait(lock, [this]() { return !mHandingOff; });
+        mRemoving = true;
+    }
+
+    if (mZone)
+        mZone.load()->removeSession(this);
+
+    // after leaving the Zone, nothing can start observing again
+    stopObserving();
+}
+
+bool PlayerSession::beginHandoff()
+{
+    std::lock_guard<std::mutex> lock(mHandoffMutex);
+
+    if (mRemoving)
+        return false;
+
+    mHandingOff = true;
+    return true;
+}
+
+void PlayerSession::finishHandoff(Zone* zone)
+{
+    {
+        std::lock_guard<std::mutex> lock(mHandoffMutex);
+        mZone = zone;
+        mHandingOff = false;
+    }
+
+    mHandoffCondition.notify_all();
+}
+
+void PlayerSession::observe(Zone* zone, EntityId target, uint64_t delay)
+{
+    stopObserving();
+
+    mObservedZone = zone;
+    zone->addObserver(this, target, delay);
+}
+
+void PlayerSession::stopObserving()
+{
+    Zone* zone = mObservedZone.exchange(nullptr);
+
+    if (zone != nullptr)
+        zone->removeObserver(this);
 }
 
 void PlayerSession::enterGame()
 {
-    mZone = sZoneManager->assignZone(this);
+    if (sZoneManager->assignZone(this) == nullptr)
+        log->error("PlayerSession: no Zone available");
+}
+
+void PlayerSession::writeZoneState(ByteBuffer& buffer)
+{
+    buffer << mPositionX;
+    buffer << mPositionY;
+    buffer << mPositionZ;
+    buffer << (uint8_t)mHasPosition;
+    buffer << mMovementAllowance;
+
+    // the buffered inputs are kept, their ticks are moved to the destination Zone
+    buffer << mZone.load()->getTickNumber();
+}
+
+void PlayerSession::readZoneState(ByteBuffer& buffer, uint32_t tick)
+{
+    buffer >> mPositionX;
+    buffer >> mPositionY;
+    buffer >> mPositionZ;
+    uint8_t hasPosition;
+    buffer >> hasPosition;
+    mHasPosition = hasPosition != 0;
+    buffer >> mMovementAllowance;
+
+    uint32_t previousTick;
+    buffer >> previousTick;
+
+    // the EntityIds of the previous Zone mean nothing here, the client has to forget them before the new ones appear
+    std::vector<EntityId> knownEntities;
+    mReplicationScheduler.collectReceivedIds(knownEntities);
+    mReplicationScheduler.clear();
+
+    for (EntityId id : knownEntities)
+    {
+        std::shared_ptr<Packet> packet = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_DESPAWN);
+        packet->setTick(tick);
+        *packet << id;
+        queueOutgoingPacket(packet);
+    }
+
+    for (auto& input : mInputBuffer)
+        input.tick = input.tick - previousTick + tick;
 }
 
 void PlayerSession::update(TimePoint difference)
 {
+    Zone* zone = mZone;
+    uint32_t tick = zone->getTickNumber();
+
     PacketContainer container;
 
     while (mPacketReceiveQueue.try_dequeue(container))
     {
-        (this->*container.callback)(container.packet);
+        uint32_t target = container.packet->getTick();
+
+        // tick 0 and past ticks are processed immediately
+        if ((int32_t)(target - tick) <= 0 || mInputBuffer.size() >= const_inputBufferSize)
+        {
+            processInput(container);
+            continue;
+        }
+
+        BufferedInput input = {tick + std::min(target - tick, const_inputJitterWindow), container};
+        mInputBuffer.push_back(input);
+    }
+
+    // the buffered packets targeting this tick, in order of arrival
+    auto remaining = mInputBuffer.begin();
+    for (auto input = mInputBuffer.begin(); input != mInputBuffer.end(); ++input)
+    {
+        if ((int32_t)(input->tick - tick) <= 0)
+            processInput(input->container);
+        else
+            *remaining++ = *input;
+    }
+    mInputBuffer.erase(remaining, mInputBuffer.end());
+
+    if (mAcknowledgePending)
+    {
+        std::shared_ptr<Packet> acknowledgement = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_INPUT_ACK);
+        *acknowledgement << mLastProcessedSequence;
+        acknowledgement->setTick(tick);
+        queueOutgoingPacket(acknowledgement);
+
+        mAcknowledgePending = false;
     }
+
+    // for the packets of the next tick
+    mMovementAllowance = zone->getMovementValidator().addAllowance(mMovementAllowance, difference);
+}
+
+void PlayerSession::processInput(const PacketContainer& container)
+{
+    (this->*container.callback)(container.packet);
+
+    mLastProcessedSequence = container.packet->getSequence();
+    mAcknowledgePending = true;
 }
 
 void PlayerSession::sendPacket(std::shared_ptr<Packet> packet)
 {
-    mConnection->queueSendPacket(packet);
+    // sessions without a connection, e.g. in tests, drop their packets
+    if (mConnection != nullptr)
+        mConnection->queueSendPacket(packet);
 }
 
 void PlayerSession::handleMovementPacket(std::shared_ptr<Packet> packet)
@@ -45,5 +199,75 @@ void PlayerSession::handleMovementPacket(std::shared_ptr<Packet> packet)
     p >> z;
     //log->info("New Movement packet! {} {} {}", x, y, z);
 
-    mZone->sendPositionUpdate(this, x, y, z);
+    Zone* zone = mZone;
+
+    const MovementValidator& validator = zone->getMovementValidator();
+
+    // the first position only has to be inside the Zone, which is never further away
+    float firstAllowance = validator.getMaxDistance();
+    float& allowance = mHasPosition ? mMovementAllowance : firstAllowance;
+
+    MovementValidator::Result result = validator.validate(mPositionX, mPositionZ, x, y, z, allowance);
+
+    if (result != MovementValidator::Result::VALID)
+    {
+        zone->countRejectedMovement();
+
+        // puts the player back to the last valid position
+        std::shared_ptr<Packet> correction = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_MOVEPACKET);
+        correction->setTick(zone->getTickNumber());
+        *correction << mEntityId;
+        *correction << mPositionX;
+        *correction << mPositionY;
+        *correction << mPositionZ;
+        *correction << 0.f;
+        *correction << 0.f;
+        *correction << 0.f;
+        queueOutgoingPacket(correction);
+        return;
+    }
+
+    mPositionX = x;
+    mPositionY = y;
+    mPositionZ = z;
+    mHasPosition = true;
+
+    // the Zone moves the entity of the player in it's simulation phase
+    mMoved = true;
+}
+
+void PlayerSession::handleObservePacket(std::shared_ptr<Packet> packet)
+{
+    uint32_t zoneId;
+    EntityId target;
+    uint32_t delay;
+    Packet p = *packet.get();
+    p >> zoneId;
+    p >> target;
+    p >> delay;
+
+    if (zoneId == 0)
+    {
+        stopObserving();
+        return;
+    }
+
+    Zone* zone = sZoneManager->findZone(zoneId);
+    if (zone == nullptr)
+    {
+        log->info("PlayerSession: can't observe unknown Zone {}", zoneId);
+        return;
+    }
+
+    // the frames are held back in memory for the whole delay
+    observe(zone, target, std::min(delay, const_maxObserverDelay));
+}
+
+void PlayerSession::flushOutgoingPackets()
+{
+    for (auto& packet : mOutgoingPackets)
+        sendPacket(packet);
+
+    mOutgoingPackets.clear();
+    mMoved = false;
 }
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "concurrentqueue/concurrentqueue.h"
 
 #include "Packet.h"
+#include "World/EntityRegistry.h"
+#include "World/ReplicationScheduler.h"
 #include "utility/utility.h"
 
 
@@ -23,14 +29,78 @@ class Zone;
  * Also the Session forwards write requests asynchrounsly
  * to the corresponding connection.
  *
+ * A Session can be handed off to another Zone with requestHandoff().
+ *
+ * The packets of all sessions of a Zone are processed in parallel, so packet
+ * handlers only change their own session. The Zone applies the results
+ * afterwards, e.g. the movement, in the order of it's sessions.
+ *
+ * Packets for the player are collected during the replication phase of the
+ * Zone tick and passed to the connection together in the flush phase.
+ *
+ * Clients stamp their packets with the Zone tick they target. Packets for a
+ * later tick wait in a small input buffer until that tick, at most a few ticks
+ * to absorb the jitter of the network. The sequence number of the last
+ * processed packet is acknowledged to the client every tick it changes, so the
+ * client can reconcile it's prediction.
+ *
+ * A session can also observe a Zone or an entity in it, independent of it's
+ * own Zone, e.g. for spectators (see ObserverStream). The client asks for it
+ * with CS_OBSERVE, handled by the network thread. A session which never sends
+ * a packet for a Zone doesn't enter the game, it only observes.
+ *
  */
 class PlayerSession
 {
     /// the associated network connection
     Connection* mConnection;
 
-    /// the current associated zone
-    Zone* mZone = nullptr;
+    /// the current associated zone, changed by the Zones during a handoff
+    std::atomic<Zone*> mZone{nullptr};
+
+    /// the zone this session should be handed off to, nullptr if none
+    std::atomic<Zone*> mHandoffTarget{nullptr};
+
+    /// protects mHandingOff and mRemoving
+    std::mutex mHandoffMutex;
+
+    /// notifies the destructor when a running handoff is finished
+    std::condition_variable mHandoffCondition;
+
+    /// true while a Zone hands this session off, from beginHandoff() to finishHandoff()
+    bool mHandingOff = false;
+
+    /// true when the session is being deleted, it isn't handed off anymore
+    bool mRemoving = false;
+
+    /// the Zone this session observes, nullptr if none
+    std::atomic<Zone*> mObservedZone{nullptr};
+
+    /// id of the party of the player, 0 if none
+    std::atomic<uint32_t> mPartyId{0};
+
+    /// last valid position sent by the player
+    float mPositionX = 0.f;
+    float mPositionY = 0.f;
+    float mPositionZ = 0.f;
+
+    /// false until the player sent it's first position, which is accepted anywhere in the Zone
+    bool mHasPosition = false;
+
+    /// distance the player may still move, see MovementValidator
+    float mMovementAllowance = 0.f;
+
+    /// the entity of the player in the current zone, changed only by the Zone
+    EntityId mEntityId = INVALID_ENTITY;
+
+    /// true if the player moved in the current tick
+    bool mMoved = false;
+
+    /// decides which updates the player receives, only used by the Zone
+    ReplicationScheduler mReplicationScheduler;
+
+    /// packets collected during the replication phase, sent in the flush phase
+    std::vector<std::shared_ptr<Packet>> mOutgoingPackets;
 
     /**
      * A container holding a packet with it's information
@@ -47,6 +117,29 @@ class PlayerSession
     /// A concurrent queue for the packets
     moodycamel::ConcurrentQueue<PacketContainer> mPacketReceiveQueue;
 
+    /**
+     * A packet waiting for the tick it targets
+     */
+    struct BufferedInput
+    {
+        uint32_t tick;
+        PacketContainer container;
+    };
+
+    /// packets for later ticks, in order of arrival
+    std::vector<BufferedInput> mInputBuffer;
+
+    /// sequence number of the last processed packet
+    uint16_t mLastProcessedSequence = 0;
+
+    /// true if mLastProcessedSequence changed since the last acknowledgement
+    bool mAcknowledgePending = false;
+
+    /**
+     * Processes a packet and remembers it for the acknowledgement
+     */
+    void processInput(const PacketContainer& container);
+
 public:
     /**
      * Initializes a new PlayerSession with the specified network connection
@@ -56,7 +149,7 @@ public:
 
     /**
      * Deletes the session. Also removes the Session from the associated
-     * zone (if any).
+     * zone (if any), after waiting for a running handoff.
      */
     ~PlayerSession();
 
@@ -66,6 +159,97 @@ public:
      */
     void enterGame();
 
+    /**
+     * @return id of the party of the player, 0 if none
+     * @remark Thread-Safe
+     */
+    uint32_t getPartyId() { return mPartyId; }
+
+    /**
+     * Sets the party of the player, used for assigning party members to the same Zone
+     * @param partyId id of the party, 0 for none
+     * @remark Thread-Safe
+     */
+    void setPartyId(uint32_t partyId) { mPartyId = partyId; }
+
+    /**
+     * Starts observing a Zone or an entity in it, stops observing the previous target.
+     * The session is sent what the target sees, without an entity of it's own.
+     * @param zone the observed Zone
+     * @param target the observed entity, INVALID_ENTITY for the whole Zone
+     * @param delay milliseconds the session sees the Zone late, e.g. for tournaments
+     * @remark Thread-Safe
+     */
+    void observe(Zone* zone, EntityId target, uint64_t delay);
+
+    /**
+     * Stops observing, see observe()
+     * @remark Thread-Safe
+     */
+    void stopObserving();
+
+    /**
+     * Forgets the observed Zone without removing the session from it, when the Zone drops it's observers itself
+     * @param zone the Zone dropping it's observers, nothing happens if the session observes another one
+     * @remark Thread-Safe
+     */
+    void forgetObservedZone(Zone* zone) { mObservedZone.compare_exchange_strong(zone, nullptr); }
+
+    /**
+     * Requests moving this session to another Zone. The current Zone
+     * hands it off at the end of it's tick, the destination adopts it
+     * on it's next tick. Packets received in between are kept.
+     * @param zone destination Zone
+     * @remark Thread-Safe
+     */
+    void requestHandoff(Zone* zone) { mHandoffTarget = zone; }
+
+    /**
+     * Returns and clears the requested handoff destination
+     * @return destination Zone or nullptr if no handoff is requested
+     * @remark Thread-Safe
+     */
+    Zone* takeHandoffTarget() { return mHandoffTarget.exchange(nullptr); }
+
+    /**
+     * Marks the start of a handoff, only to be called by the source Zone
+     * @return false if the session is being deleted and must not be handed off
+     * @remark Thread-Safe
+     */
+    bool beginHandoff();
+
+    /**
+     * Points the session to the destination Zone and wakes up a waiting destructor,
+     * only to be called by the source Zone after beginHandoff()
+     * @param zone destination Zone, the session is already queued there
+     * @remark Thread-Safe
+     */
+    void finishHandoff(Zone* zone);
+
+    /**
+     * @return the current Zone, or the destination Zone if a handoff is in progress
+     * @remark Thread-Safe
+     */
+    Zone* getZone() { return mZone; }
+
+    /**
+     * Sets the current Zone, only to be called by Zones
+     */
+    void setZone(Zone* zone) { mZone = zone; }
+
+    /**
+     * Writes the state belonging to the Zone, for a handoff to another Zone
+     * @param buffer to write into
+     */
+    void writeZoneState(ByteBuffer& buffer);
+
+    /**
+     * Reads the state written by writeZoneState(), the entities of the previous Zone disappear
+     * @param buffer to read from
+     * @param tick current tick number of the new Zone
+     */
+    void readZoneState(ByteBuffer& buffer, uint32_t tick);
+
     /**
      * Queues a incoming packet, to be fetched from the Zone thread
      * @param callback to the function responsible for processing the packet
@@ -77,6 +261,12 @@ public:
         mPacketReceiveQueue.enqueue(container);
     }
 
+    /**
+     * @return the network connection, for reading it's round trip time and clock offset
+     * @remark Thread-Safe
+     */
+    Connection* getConnection() { return mConnection; }
+
     /**
      * Sends a packet to the player.
      * @param packet data
@@ -89,5 +279,54 @@ public:
      */
     void update(TimePoint difference);
 
+    /**
+     * @return last valid position sent by the player
+     * @remark only to be used from the Zone thread
+     */
+    float getPositionX() { return mPositionX; }
+    float getPositionY() { return mPositionY; }
+    float getPositionZ() { return mPositionZ; }
+
+    /**
+     * @return the entity of the player in the current Zone
+     * @remark only to be used from the Zone thread
+     */
+    EntityId getEntityId() { return mEntityId; }
+
+    /**
+     * Sets the entity of the player, only to be called by Zones
+     */
+    void setEntityId(EntityId entityId) { mEntityId = entityId; }
+
+    /**
+     * @return true if the player moved in the current tick
+     * @remark only to be used from the Zone thread
+     */
+    bool hasMoved() { return mMoved; }
+
+    /**
+     * @return the updates waiting for the player
+     * @remark only to be used by the Zone thread replicating to this player
+     */
+    ReplicationScheduler& getReplicationScheduler() { return mReplicationScheduler; }
+
+    /**
+     * Collects a packet, sent with flushOutgoingPackets()
+     * @remark only to be used by the Zone thread replicating to this player
+     */
+    void queueOutgoingPacket(const std::shared_ptr<Packet>& packet) { mOutgoingPackets.push_back(packet); }
+
+    /**
+     * Sends all collected packets and clears the state of the current tick
+     * @remark only to be used from the Zone thread
+     */
+    void flushOutgoingPackets();
+
     void handleMovementPacket(std::shared_ptr<Packet> packet);
+
+    /**
+     * Starts observing the Zone, entity and delay of the packet, stops observing for Zone 0
+     * @remark only to be used from the network thread, which also deletes the session
+     */
+    void handleObservePacket(std::shared_ptr<Packet> packet);
 };
@@ -1,15 +1,27 @@
 #include "Server.h"
 
+#include <algorithm>
 #include <thread>
+#include <vector>
 
-#include "Log/Logger.h"
+#include "Metrics/Metrics.h"
 #include "Network/Network.h"
+#include "utility/SimdKernels.h"
+#include "utility/WorkerPool.h"
 #include "World/Zone.h"
 #include "World/ZonePool.h"
 #include "World/ZoneManager.h"
+#include "Log/Logger.h"
 
 std::atomic<bool> Server::mStopping{false};
 
+/// Number of Zones created on startup
+static const uint32_t const_zoneCount = 4;
+/// Milliseconds between two rebalance checks of the ZoneManager
+static const TimePoint const_rebalanceInterval = 1000;
+/// Milliseconds between writing all metrics to the log
+static const TimePoint const_metricsLogInterval = 60000;
+
 Server::Server()
 {
     mNetwork = new Network();
@@ -22,29 +34,68 @@ Server::~Server()
 
 void Server::run()
 {
-    // Start Network Thread
+    // one core is left for the network thread, the others are shared by the ZonePools and the WorkerPool
+    uint32_t coreCount = std::max<uint32_t>(std::thread::hardware_concurrency(), 1);
+    uint32_t freeCoreCount = coreCount > 1 ? coreCount - 1 : 1;
+    uint32_t zonePoolCount = std::max<uint32_t>(freeCoreCount / 2, 1);
+
+    // for splitting the work of crowded zones, the ZonePool threads help while waiting for it,
+    // so only the remaining cores get a worker and the machine isn't oversubscribed under load
+    WorkerPool* workerPool = new WorkerPool(freeCoreCount - std::min(zonePoolCount, freeCoreCount));
+
+    log->info("Using {} kernels", SimdKernels::getLevelName(SimdKernels::getLevel()));
+
+    ZoneManager* zoneManager = new ZoneManager();
+
+    std::vector<ZonePool*> zonePools;
+    for (uint32_t i = 0; i < zonePoolCount; i++)
+        zonePools.push_back(zoneManager->createZonePool());
+
+    // Create zones, each one is placed on the least loaded pool
+    for (uint32_t i = 0; i < const_zoneCount; i++)
+        zoneManager->createZone();
+
+    std::vector<std::thread> zonePoolThreads;
+    for (auto& zonePool : zonePools)
+    {
+        zonePoolThreads.emplace_back([zonePool]() {
+            zonePool->run();
+        });
+    }
+
+    // Start Network Thread, after the zones exist, so connections can be assigned
     std::thread networkThread([this](){
         mNetwork->listen(40000);
     });
 
-    // Create zones (only one for now)
-    Zone* zone = new Zone();
+    // Maintenance of the running server
+    TimePoint lastMetricsLogTime = getTimeMilliseconds();
 
-    ZoneManager* zoneManager = new ZoneManager();
-    ZonePool* zonePool = zoneManager->createZonePool();
-    zonePool->addZone(zone);
+    while (!Server::isStopping())
+    {
+        sleepMilliseconds(const_rebalanceInterval);
 
-    std::thread zonePoolThread([this, zonePool]() {
-        zonePool->run();
-    });
+        zoneManager->rebalance();
 
-    // Shutting down
-    zonePoolThread.join();
-    zoneManager->deleteZonePool(zonePool);
-    delete zoneManager;
+        if (getTimeMilliseconds() - lastMetricsLogTime >= const_metricsLogInterval)
+        {
+            lastMetricsLogTime = getTimeMilliseconds();
+            sMetrics->logMetrics();
+        }
+    }
+
+    // Shutting down, pools with only hibernating zones are blocked
+    for (auto& zonePool : zonePools)
+        zonePool->wake();
+
+    for (auto& zonePoolThread : zonePoolThreads)
+        zonePoolThread.join();
 
     networkThread.join();
-    delete zone;
+
+    // deletes all zones and pools
+    delete zoneManager;
+    delete workerPool;
 
 
     log->info("Server stopping");
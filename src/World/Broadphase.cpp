@@ -0,0 +1,245 @@
+#include "Broadphase.h"
+
+#include <algorithm>
+#include <cmath>
+
+/// Width of the strips along the z axis
+static const float const_stripSize = 16.f;
+
+/// Average number of moves per box up to which insertion sort is kept up
+static const uint32_t const_maxShiftsPerBox = 8;
+
+/// Boxes beyond the strips up to this number are put into the outermost ones, far outside of any Zone
+static const float const_maxStrip = (float)(1 << 24);
+
+void Broadphase::update(EntityRegistry& entities)
+{
+    updateBoxes(entities);
+
+    for (auto& strip : mStrips)
+        sortBoxes(strip.second);
+
+    insertMovedBoxes();
+    sweep();
+}
+
+void Broadphase::clear()
+{
+    mStrips.clear();
+    mPairs.clear();
+}
+
+int32_t Broadphase::getStrip(const Box& box)
+{
+    float strip = std::floor(box.minZ / const_stripSize);
+
+    // the cast is undefined for values out of the range of int32_t, NaN ends up in the first strip
+    if (!(strip >= -const_maxStrip))
+        strip = -const_maxStrip;
+    else if (strip > const_maxStrip)
+        strip = const_maxStrip;
+
+    return (int32_t)strip;
+}
+
+void Broadphase::updateBoxes(EntityRegistry& entities)
+{
+    const EntityId* ids = entities.getIds();
+    const float* positionX = entities.getPositionX();
+    const float* positionY = entities.getPositionY();
+    const float* positionZ = entities.getPositionZ();
+    const float* extents = entities.getExtents();
+
+    auto updateBox = [&](Box& box) {
+        uint32_t index = box.index;
+
+        box.minX = positionX[index] - extents[index];
+        box.maxX = positionX[index] + extents[index];
+        box.minY = positionY[index] - extents[index];
+        box.maxY = positionY[index] + extents[index];
+        box.minZ = positionZ[index] - extents[index];
+        box.maxZ = positionZ[index] + extents[index];
+
+        mMaxSize = std::max(mMaxSize, 2.f * extents[index]);
+    };
+
+    mKnown.assign(entities.size(), 0);
+    mMovedBoxes.clear();
+    mMaxSize = 0.f;
+
+    for (auto strip = mStrips.begin(); strip != mStrips.end();)
+    {
+        std::vector<Box>& boxes = strip->second;
+
+        // keep the order of the last tick, dropping destroyed entities and those leaving the strip
+        size_t count = 0;
+        for (size_t box = 0; box < boxes.size(); box++)
+        {
+            uint32_t index = entities.getIndex(boxes[box].id);
+            if (index == UINT32_MAX)
+                continue;
+
+            mKnown[index] = 1;
+
+            Box updated = boxes[box];
+            updated.index = index;
+            updateBox(updated);
+
+            int32_t newStrip = getStrip(updated);
+            if (newStrip != strip->first)
+                mMovedBoxes.push_back(std::make_pair(newStrip, updated));
+            else
+                boxes[count++] = updated;
+        }
+
+        boxes.resize(count);
+
+        if (boxes.empty())
+            strip = mStrips.erase(strip);
+        else
+            ++strip;
+    }
+
+    for (uint32_t index = 0; index < entities.size(); index++)
+    {
+        if (mKnown[index] != 0)
+            continue;
+
+        Box box;
+        box.id = ids[index];
+        box.index = index;
+        updateBox(box);
+
+        mMovedBoxes.push_back(std::make_pair(getStrip(box), box));
+    }
+}
+
+void Broadphase::sortBoxes(std::vector<Box>& boxes)
+{
+    uint64_t maxShiftCount = (uint64_t)boxes.size() * const_maxShiftsPerBox;
+    uint64_t shiftCount = 0;
+
+    for (size_t box = 1; box < boxes.size(); box++)
+    {
+        if (boxes[box - 1].minX <= boxes[box].minX)
+            continue;
+
+        Box moved = boxes[box];
+        size_t position = box;
+
+        do
+        {
+            boxes[position] = boxes[position - 1];
+            position--;
+        }
+        while (position > 0 && boxes[position - 1].minX > moved.minX);
+
+        boxes[position] = moved;
+        shiftCount += box - position;
+
+        // far from sorted, insertion sort would be quadratic
+        if (shiftCount > maxShiftCount)
+        {
+            std::sort(boxes.begin(), boxes.end(), [](const Box& a, const Box& b) {
+                return a.minX < b.minX;
+            });
+            return;
+        }
+    }
+}
+
+void Broadphase::insertMovedBoxes()
+{
+    std::sort(mMovedBoxes.begin(), mMovedBoxes.end(), [](const std::pair<int32_t, Box>& a, const std::pair<int32_t, Box>& b) {
+        return a.first < b.first || (a.first == b.first && a.second.minX < b.second.minX);
+    });
+
+    size_t begin = 0;
+    while (begin < mMovedBoxes.size())
+    {
+        int32_t stripKey = mMovedBoxes[begin].first;
+
+        size_t end = begin;
+        while (end < mMovedBoxes.size() && mMovedBoxes[end].first == stripKey)
+            end++;
+
+        std::vector<Box>& boxes = mStrips[stripKey];
+
+        // both are sorted, merging them is linear
+        mMergeBuffer.clear();
+        mMergeBuffer.reserve(boxes.size() + end - begin);
+
+        size_t box = 0;
+        for (size_t moved = begin; moved < end; moved++)
+        {
+            while (box < boxes.size() && boxes[box].minX <= mMovedBoxes[moved].second.minX)
+                mMergeBuffer.push_back(boxes[box++]);
+
+            mMergeBuffer.push_back(mMovedBoxes[moved].second);
+        }
+
+        mMergeBuffer.insert(mMergeBuffer.end(), boxes.begin() + box, boxes.end());
+        boxes.swap(mMergeBuffer);
+
+        begin = end;
+    }
+}
+
+void Broadphase::sweep()
+{
+    mPairs.clear();
+
+    auto test = [this](const Box& a, const Box& b) {
+        // without short-circuiting, most tests fail at random and would mispredict
+        bool overlap = (a.minZ <= b.maxZ) & (b.minZ <= a.maxZ) & (a.minY <= b.maxY) & (b.minY <= a.maxY);
+        if (!overlap)
+            return;
+
+        if (a.index < b.index)
+            mPairs.push_back({a.index, b.index});
+        else
+            mPairs.push_back({b.index, a.index});
+    };
+
+    for (auto strip = mStrips.begin(); strip != mStrips.end(); ++strip)
+    {
+        const std::vector<Box>& boxes = strip->second;
+        size_t count = boxes.size();
+
+        for (size_t box = 0; box < count; box++)
+        {
+            const Box& a = boxes[box];
+
+            // every following box starts after a.minX, only those starting before a ends can overlap
+            for (size_t other = box + 1; other < count && boxes[other].minX <= a.maxX; other++)
+                test(a, boxes[other]);
+        }
+
+        // the boxes reaching into the next strips, each pair across strips is found by the lower strip
+        float stripEnd = (strip->first + 1) * const_stripSize;
+
+        for (const Box& a : boxes)
+        {
+            if (a.maxZ < stripEnd)
+                continue;
+
+            auto nextStrip = strip;
+            for (++nextStrip; nextStrip != mStrips.end() && nextStrip->first * const_stripSize <= a.maxZ; ++nextStrip)
+            {
+                const std::vector<Box>& nextBoxes = nextStrip->second;
+
+                // boxes starting before this end before a starts
+                float minX = a.minX - mMaxSize;
+                auto other = std::lower_bound(nextBoxes.begin(), nextBoxes.end(), minX, [](const Box& b, float x) {
+                    return b.minX < x;
+                });
+
+                for (; other != nextBoxes.end() && other->minX <= a.maxX; ++other)
+                {
+                    if (other->maxX >= a.minX)
+                        test(a, *other);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "EntityRegistry.h"
+
+/**
+ * @brief Finds the entities of a Zone whose collision boxes overlap
+ *
+ * Sweep and prune: the ground is split into strips along the z axis, the boxes
+ * of every strip are kept sorted by their lower x bound. Sweeping over a strip,
+ * every box is only tested against the following boxes starting before it ends
+ * on the x axis, and against the boxes of the next strips it reaches into.
+ * The pairs overlapping on all axes are the candidates for the exact collision
+ * tests of the game logic.
+ *
+ * Entities move only a bit per tick, so the order of the last tick is
+ * almost sorted and is sorted again with insertion sort in nearly linear time.
+ * Boxes changing their strip are merged into the new strip in one pass. When
+ * too much changed (e.g. teleports), a strip falls back to a full sort.
+ *
+ * @remark not thread-safe, used by the Zone thread
+ */
+class Broadphase
+{
+public:
+    /**
+     * Two entities with overlapping boxes, by dense index, first < second
+     */
+    struct Pair
+    {
+        uint32_t first;
+        uint32_t second;
+    };
+
+private:
+    /**
+     * The collision box of an entity
+     */
+    struct Box
+    {
+        float minX;
+        float maxX;
+        float minY;
+        float maxY;
+        float minZ;
+        float maxZ;
+        EntityId id;
+        uint32_t index;
+    };
+
+    /// The boxes by strip, every strip sorted by minX after update()
+    std::map<int32_t, std::vector<Box>> mStrips;
+
+    /// Boxes leaving their strip and new boxes, during update()
+    std::vector<std::pair<int32_t, Box>> mMovedBoxes;
+
+    /// For merging the moved boxes into a strip
+    std::vector<Box> mMergeBuffer;
+
+    /// Marks the dense indices already in a strip during update()
+    std::vector<uint8_t> mKnown;
+
+    /// The longest side of all boxes
+    float mMaxSize = 0.f;
+
+    /// The overlapping pairs of the last update()
+    std::vector<Pair> mPairs;
+
+    /**
+     * @return the strip of a box
+     */
+    static int32_t getStrip(const Box& box);
+
+    /**
+     * Updates the boxes of the entities, removes destroyed and adds new entities
+     */
+    void updateBoxes(EntityRegistry& entities);
+
+    /**
+     * Sorts a strip by minX, taking advantage of the order of the last tick
+     */
+    static void sortBoxes(std::vector<Box>& boxes);
+
+    /**
+     * Merges the moved boxes into their strips
+     */
+    void insertMovedBoxes();
+
+    /**
+     * Collects the overlapping pairs of the sorted strips
+     */
+    void sweep();
+
+public:
+    /**
+     * Finds the overlapping entities, after they moved
+     */
+    void update(EntityRegistry& entities);
+
+    /**
+     * Forgets all entities
+     */
+    void clear();
+
+    /**
+     * @return the pairs found by the last update(), valid until entities are created or destroyed
+     */
+    const std::vector<Pair>& getPairs() { return mPairs; }
+};
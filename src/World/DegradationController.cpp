@@ -0,0 +1,58 @@
+#include "DegradationController.h"
+
+/// What a Zone does at every level, from the full to the lowest quality
+static const DegradationController::Quality const_qualities[] = {
+    {1, 1.f, false},
+    {2, 1.f, false},
+    {4, 0.75f, false},
+    {4, 0.5f, true},
+};
+
+static const uint32_t const_levelCount = sizeof(const_qualities) / sizeof(const_qualities[0]);
+
+bool DegradationController::update(float load)
+{
+    if (load > mSettings.degradeLoad)
+    {
+        mRelaxedTicks = 0;
+
+        if (++mOverloadedTicks < mSettings.degradeTicks || mLevel + 1 >= const_levelCount)
+            return false;
+
+        mOverloadedTicks = 0;
+        mLevel++;
+        return true;
+    }
+
+    mOverloadedTicks = 0;
+
+    if (load >= mSettings.restoreLoad)
+    {
+        mRelaxedTicks = 0;
+        return false;
+    }
+
+    if (++mRelaxedTicks < mSettings.restoreTicks || mLevel == 0)
+        return false;
+
+    mRelaxedTicks = 0;
+    mLevel--;
+    return true;
+}
+
+void DegradationController::reset()
+{
+    mLevel = 0;
+    mOverloadedTicks = 0;
+    mRelaxedTicks = 0;
+}
+
+const DegradationController::Quality& DegradationController::getQuality()
+{
+    return const_qualities[mLevel];
+}
+
+uint32_t DegradationController::getMaxLevel()
+{
+    return const_levelCount - 1;
+}
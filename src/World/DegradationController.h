@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Lowers the quality of a Zone step by step while it can't keep up with it's tick rate
+ *
+ * The controller is fed with the load of every tick, the fraction of the
+ * tick budget that was used. When the load stays above the degrade threshold,
+ * the quality is lowered by one level. When it stays below the restore
+ * threshold for longer, the quality is raised by one level again.
+ * The gap between both thresholds and the different durations keep the
+ * level from flapping.
+ *
+ * Every level lowers the quality a bit more:
+ *  - players far away receive only every n-th position update
+ *  - the area of interest shrinks
+ *  - non-critical work (e.g. rebalancing the regions, deferrable timers) is postponed
+ *
+ * @remark not thread-safe, to be used by the ZonePool thread of the Zone
+ */
+class DegradationController
+{
+public:
+    /**
+     * What a Zone does at a level of the controller
+     */
+    struct Quality
+    {
+        /// Factor for the update intervals of all but the nearest LOD band, see ReplicationScheduler
+        uint32_t distantUpdateInterval;
+
+        /// Factor for the radius of the area of interest
+        float aoiScale;
+
+        /// true if non-critical work is postponed
+        bool deferNonCritical;
+    };
+
+    /**
+     * When the controller changes the level
+     */
+    struct Settings
+    {
+        /// Load above which the quality is lowered, 1 is the whole tick budget
+        float degradeLoad = 0.8f;
+
+        /// Load below which the quality is restored
+        float restoreLoad = 0.5f;
+
+        /// Consecutive ticks above degradeLoad for lowering the quality by one level
+        uint32_t degradeTicks = 5;
+
+        /// Consecutive ticks below restoreLoad for raising the quality by one level
+        uint32_t restoreTicks = 40;
+    };
+
+private:
+    Settings mSettings;
+
+    /// Current level, 0 is the full quality
+    uint32_t mLevel = 0;
+
+    /// Consecutive ticks above the degrade threshold
+    uint32_t mOverloadedTicks = 0;
+
+    /// Consecutive ticks below the restore threshold
+    uint32_t mRelaxedTicks = 0;
+
+public:
+    /**
+     * Adds the load of a tick
+     * @param load used fraction of the tick budget
+     * @return true if the level changed
+     */
+    bool update(float load);
+
+    /**
+     * Goes back to the full quality
+     */
+    void reset();
+
+    /**
+     * @return current level, 0 is the full quality
+     */
+    uint32_t getLevel() { return mLevel; }
+
+    /**
+     * @return what the Zone does at the current level
+     */
+    const Quality& getQuality();
+
+    void setSettings(const Settings& settings) { mSettings = settings; }
+    const Settings& getSettings() { return mSettings; }
+
+    /**
+     * @return the lowest quality level
+     */
+    static uint32_t getMaxLevel();
+};
@@ -0,0 +1,128 @@
+#include "EntityRegistry.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "utility/SimdKernels.h"
+
+/// Half of the size of the collision box of new entities, by Type
+static const float const_defaultExtents[] = {0.5f, 0.5f, 0.1f};
+
+EntityId EntityRegistry::create(Type type, PlayerSession* owner)
+{
+    uint32_t sparseIndex;
+
+    if (!mFreeIndices.empty())
+    {
+        sparseIndex = mFreeIndices.back();
+        mFreeIndices.pop_back();
+    }
+    else
+    {
+        sparseIndex = (uint32_t)mSparse.size();
+        assert(sparseIndex <= const_indexMask);
+
+        mSparse.push_back(UINT32_MAX);
+        // generation 0 is never used, so no valid EntityId is INVALID_ENTITY
+        mGenerations.push_back(1);
+    }
+
+    EntityId id = (mGenerations[sparseIndex] << const_indexBits) | sparseIndex;
+
+    mSparse[sparseIndex] = size();
+
+    mIds.push_back(id);
+    mTypes.push_back(type);
+    mPositionX.push_back(0.f);
+    mPositionY.push_back(0.f);
+    mPositionZ.push_back(0.f);
+    mVelocityX.push_back(0.f);
+    mVelocityY.push_back(0.f);
+    mVelocityZ.push_back(0.f);
+    mExtents.push_back(const_defaultExtents[(size_t)type]);
+    mOwners.push_back(owner);
+    mDirty.push_back(DIRTY_CREATED);
+    mPropertyDirty.push_back(0);
+
+    for (uint32_t property = 0; property < ReplicatedProperties::COUNT; property++)
+        mProperties[property].resize(mProperties[property].size() + ReplicatedProperties::getSize((ReplicatedProperties::Property)property));
+
+    return id;
+}
+
+void EntityRegistry::clear()
+{
+    for (uint32_t index = size(); index > 0; index--)
+        destroy(mIds[index - 1]);
+}
+
+void EntityRegistry::destroy(EntityId id)
+{
+    uint32_t index = getIndex(id);
+    assert(index != UINT32_MAX);
+
+    uint32_t last = size() - 1;
+
+    if (index != last)
+    {
+        mIds[index] = mIds[last];
+        mTypes[index] = mTypes[last];
+        mPositionX[index] = mPositionX[last];
+        mPositionY[index] = mPositionY[last];
+        mPositionZ[index] = mPositionZ[last];
+        mVelocityX[index] = mVelocityX[last];
+        mVelocityY[index] = mVelocityY[last];
+        mVelocityZ[index] = mVelocityZ[last];
+        mExtents[index] = mExtents[last];
+        mOwners[index] = mOwners[last];
+        mDirty[index] = mDirty[last];
+        mPropertyDirty[index] = mPropertyDirty[last];
+
+        for (uint32_t property = 0; property < ReplicatedProperties::COUNT; property++)
+        {
+            uint32_t size = ReplicatedProperties::getSize((ReplicatedProperties::Property)property);
+            std::memcpy(&mProperties[property][index * size], &mProperties[property][last * size], size);
+        }
+
+        mSparse[mIds[index] & const_indexMask] = index;
+    }
+
+    mIds.pop_back();
+    mTypes.pop_back();
+    mPositionX.pop_back();
+    mPositionY.pop_back();
+    mPositionZ.pop_back();
+    mVelocityX.pop_back();
+    mVelocityY.pop_back();
+    mVelocityZ.pop_back();
+    mExtents.pop_back();
+    mOwners.pop_back();
+    mDirty.pop_back();
+    mPropertyDirty.pop_back();
+
+    for (uint32_t property = 0; property < ReplicatedProperties::COUNT; property++)
+        mProperties[property].resize(last * ReplicatedProperties::getSize((ReplicatedProperties::Property)property));
+
+    uint32_t sparseIndex = id & const_indexMask;
+    mSparse[sparseIndex] = UINT32_MAX;
+
+    // skip generation 0 after an overflow
+    uint32_t generation = (mGenerations[sparseIndex] + 1) & (UINT32_MAX >> const_indexBits);
+    mGenerations[sparseIndex] = generation == 0 ? 1 : generation;
+
+    mFreeIndices.push_back(sparseIndex);
+}
+
+void EntityRegistry::integrateMovement(float seconds)
+{
+    SimdKernels::integrate(size(), seconds,
+                           mPositionX.data(), mPositionY.data(), mPositionZ.data(),
+                           mVelocityX.data(), mVelocityY.data(), mVelocityZ.data(),
+                           mDirty.data(), DIRTY_POSITION);
+}
+
+void EntityRegistry::clearDirty()
+{
+    std::fill(mDirty.begin(), mDirty.end(), 0);
+    std::fill(mPropertyDirty.begin(), mPropertyDirty.end(), 0);
+}
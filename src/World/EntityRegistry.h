@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "ReplicatedProperties.h"
+
+class PlayerSession;
+
+/// Identifies an entity within it's Zone, index and generation of the slot
+typedef uint32_t EntityId;
+
+/// No entity, never returned by EntityRegistry::create()
+static const EntityId INVALID_ENTITY = 0;
+
+/**
+ * @brief Stores all entities of a Zone, e.g. players, NPCs and projectiles
+ *
+ * The components are stored as structure of arrays: one densely packed
+ * array per component, all in the same order. Systems iterate over the
+ * arrays directly, which is cache-friendly and can be vectorized.
+ *
+ * The dense arrays are indexed by a sparse set. When an entity is destroyed,
+ * the last entity is moved into it's slot, so dense indices change. EntityIds
+ * stay the same for the whole lifetime of an entity: the lower bits are the
+ * index into the sparse set, the upper bits a generation which is increased
+ * when the index is reused, so old EntityIds of destroyed entities stay invalid.
+ *
+ * @remark not thread-safe, changed only by the Zone thread. Systems may read
+ * and write distinct entities in parallel.
+ */
+class EntityRegistry
+{
+public:
+    /**
+     * Kinds of entities
+     */
+    enum class Type : uint8_t
+    {
+        PLAYER,
+        NPC,
+        PROJECTILE,
+    };
+
+    /**
+     * What changed about an entity in the current tick
+     */
+    enum DirtyFlag : uint32_t
+    {
+        /// the position changed
+        DIRTY_POSITION = 1 << 0,
+        /// the velocity changed
+        DIRTY_VELOCITY = 1 << 1,
+        /// the entity was created
+        DIRTY_CREATED = 1 << 2,
+        /// what players see when the entity appears changed, e.g. the extent
+        DIRTY_APPEARANCE = 1 << 3,
+        /// a replicated property changed, see getPropertyDirty()
+        DIRTY_PROPERTIES = 1 << 4,
+    };
+
+private:
+    /// Dense index of every sparse index, UINT32_MAX if unused
+    std::vector<uint32_t> mSparse;
+
+    /// Current generation of every sparse index
+    std::vector<uint32_t> mGenerations;
+
+    /// Unused sparse indices
+    std::vector<uint32_t> mFreeIndices;
+
+    /// Dense components, all in the same order
+    std::vector<EntityId> mIds;
+    std::vector<Type> mTypes;
+    std::vector<float> mPositionX;
+    std::vector<float> mPositionY;
+    std::vector<float> mPositionZ;
+    std::vector<float> mVelocityX;
+    std::vector<float> mVelocityY;
+    std::vector<float> mVelocityZ;
+    std::vector<float> mExtents;
+    std::vector<PlayerSession*> mOwners;
+    std::vector<uint32_t> mDirty;
+
+    /// The values of every ReplicatedProperties::Property, getSize() bytes per entity
+    std::vector<uint8_t> mProperties[ReplicatedProperties::COUNT];
+
+    /// The properties changed in the current tick
+    std::vector<ReplicatedProperties::Mask> mPropertyDirty;
+
+public:
+    /**
+     * Creates an entity at the origin without velocity, with the default extent of it's type
+     * @param type kind of the entity
+     * @param owner session controlling the entity, nullptr if none
+     * @return the new EntityId
+     */
+    EntityId create(Type type, PlayerSession* owner);
+
+    /**
+     * Destroys all entities
+     */
+    void clear();
+
+    /**
+     * Destroys an entity, moves the last entity into it's dense slot
+     * @param id EntityId of a living entity
+     */
+    void destroy(EntityId id);
+
+    /**
+     * @return dense index of the entity, UINT32_MAX if it's destroyed
+     */
+    uint32_t getIndex(EntityId id)
+    {
+        uint32_t sparseIndex = id & const_indexMask;
+
+        if (sparseIndex >= mSparse.size() || mGenerations[sparseIndex] != (id >> const_indexBits))
+            return UINT32_MAX;
+
+        return mSparse[sparseIndex];
+    }
+
+    /**
+     * @return true if the entity exists
+     */
+    bool isAlive(EntityId id) { return getIndex(id) != UINT32_MAX; }
+
+    /**
+     * @return number of entities, the size of the dense arrays
+     */
+    uint32_t size() { return (uint32_t)mIds.size(); }
+
+    /**
+     * @return the sparse index of an entity, stable for it's whole lifetime and
+     *         below getSlotCount(), for systems storing data per entity
+     */
+    static uint32_t getSlot(EntityId id) { return id & const_indexMask; }
+
+    /**
+     * @return number of sparse indices in use or free, all slots are below
+     */
+    uint32_t getSlotCount() { return (uint32_t)mSparse.size(); }
+
+    /**
+     * Moves an entity and marks it's position dirty
+     * @param index dense index
+     */
+    void setPosition(uint32_t index, float x, float y, float z)
+    {
+        mPositionX[index] = x;
+        mPositionY[index] = y;
+        mPositionZ[index] = z;
+        mDirty[index] |= DIRTY_POSITION;
+    }
+
+    /**
+     * Sets the velocity of an entity and marks it dirty
+     * @param index dense index
+     * @param x, y, z units per second
+     */
+    void setVelocity(uint32_t index, float x, float y, float z)
+    {
+        mVelocityX[index] = x;
+        mVelocityY[index] = y;
+        mVelocityZ[index] = z;
+        mDirty[index] |= DIRTY_VELOCITY;
+    }
+
+    /**
+     * Sets the size of the collision box of an entity and marks it dirty
+     * @param index dense index
+     * @param extent half of the length of the sides of the box around the position
+     */
+    void setExtent(uint32_t index, float extent)
+    {
+        mExtents[index] = extent;
+        mDirty[index] |= DIRTY_APPEARANCE;
+    }
+
+    /**
+     * @return value of a replicated property, 0 until it's set
+     * @param index dense index
+     */
+    template <ReplicatedProperties::Property P>
+    typename ReplicatedProperties::Traits<P>::Type getProperty(uint32_t index) const
+    {
+        typename ReplicatedProperties::Traits<P>::Type value;
+        std::memcpy(&value, &mProperties[P][index * sizeof(value)], sizeof(value));
+        return value;
+    }
+
+    /**
+     * Sets a replicated property and marks it dirty if it changed
+     * @param index dense index
+     * @param value new value
+     */
+    template <ReplicatedProperties::Property P>
+    void setProperty(uint32_t index, typename ReplicatedProperties::Traits<P>::Type value)
+    {
+        if (getProperty<P>(index) == value)
+            return;
+
+        std::memcpy(&mProperties[P][index * sizeof(value)], &value, sizeof(value));
+        mPropertyDirty[index] |= 1u << P;
+        mDirty[index] |= DIRTY_PROPERTIES;
+    }
+
+    /**
+     * @return the values of a property of all entities, ReplicatedProperties::getSize() bytes each
+     */
+    const uint8_t* getPropertyValues(ReplicatedProperties::Property property) const { return mProperties[property].data(); }
+
+    /**
+     * @return the properties of every entity changed in the current tick
+     */
+    const ReplicatedProperties::Mask* getPropertyDirty() const { return mPropertyDirty.data(); }
+
+    /**
+     * Movement system: moves all entities by their velocity
+     * @param seconds time since the last integration
+     */
+    void integrateMovement(float seconds);
+
+    /**
+     * Clears the dirty flags of all entities, at the end of a tick
+     */
+    void clearDirty();
+
+    /// Dense component arrays, for systems
+    const EntityId* getIds() const { return mIds.data(); }
+    const Type* getTypes() const { return mTypes.data(); }
+    const float* getPositionX() const { return mPositionX.data(); }
+    const float* getPositionY() const { return mPositionY.data(); }
+    const float* getPositionZ() const { return mPositionZ.data(); }
+    const float* getVelocityX() const { return mVelocityX.data(); }
+    const float* getVelocityY() const { return mVelocityY.data(); }
+    const float* getVelocityZ() const { return mVelocityZ.data(); }
+    const float* getExtents() const { return mExtents.data(); }
+    PlayerSession* const* getOwners() const { return mOwners.data(); }
+    const uint32_t* getDirty() const { return mDirty.data(); }
+
+private:
+    /// Bits of an EntityId used for the sparse index, the rest is the generation
+    static const uint32_t const_indexBits = 24;
+    static const uint32_t const_indexMask = (1u << const_indexBits) - 1;
+};
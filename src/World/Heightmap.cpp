@@ -0,0 +1,144 @@
+#include "Heightmap.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Log/Logger.h"
+
+/// Size of the header in front of the samples
+static const size_t const_headerSize = 2 * sizeof(uint32_t) + 3 * sizeof(float);
+
+Heightmap::Heightmap() :
+        mWidth(0),
+        mHeight(0),
+        mCellSize(0.f),
+        mOriginX(0.f),
+        mOriginZ(0.f),
+        mHeights(nullptr),
+        mMapping(nullptr),
+        mMappingSize(0)
+#ifdef _WIN32
+        , mFileHandle(INVALID_HANDLE_VALUE),
+        mMappingHandle(nullptr)
+#endif
+{
+}
+
+Heightmap::~Heightmap()
+{
+#ifdef _WIN32
+    if (mMapping != nullptr)
+        UnmapViewOfFile(mMapping);
+    if (mMappingHandle != nullptr)
+        CloseHandle(mMappingHandle);
+    if (mFileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(mFileHandle);
+#else
+    if (mMapping != nullptr)
+        munmap(mMapping, mMappingSize);
+#endif
+}
+
+std::shared_ptr<Heightmap> Heightmap::load(const std::string& fileName)
+{
+    std::shared_ptr<Heightmap> heightmap(new Heightmap());
+
+#ifdef _WIN32
+    heightmap->mFileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (heightmap->mFileHandle == INVALID_HANDLE_VALUE)
+    {
+        log->error("Heightmap: Can't open {}", fileName);
+        return nullptr;
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(heightmap->mFileHandle, &fileSize);
+    heightmap->mMappingSize = (size_t)fileSize.QuadPart;
+
+    if (heightmap->mMappingSize >= const_headerSize)
+    {
+        heightmap->mMappingHandle = CreateFileMappingA(heightmap->mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (heightmap->mMappingHandle != nullptr)
+            heightmap->mMapping = MapViewOfFile(heightmap->mMappingHandle, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        log->error("Heightmap: Can't open {}", fileName);
+        return nullptr;
+    }
+
+    struct stat fileStatus;
+    if (fstat(file, &fileStatus) == 0 && (size_t)fileStatus.st_size >= const_headerSize)
+    {
+        heightmap->mMappingSize = (size_t)fileStatus.st_size;
+
+        // read-only, the pages are shared with every other mapping of the file
+        void* mapping = mmap(nullptr, heightmap->mMappingSize, PROT_READ, MAP_SHARED, file, 0);
+        if (mapping != MAP_FAILED)
+            heightmap->mMapping = mapping;
+    }
+
+    // the mapping stays valid without the descriptor
+    close(file);
+#endif
+
+    if (heightmap->mMapping == nullptr)
+    {
+        log->error("Heightmap: Can't map {}", fileName);
+        return nullptr;
+    }
+
+    const uint8_t* data = static_cast<const uint8_t*>(heightmap->mMapping);
+
+    std::copy(data, data + sizeof(uint32_t), reinterpret_cast<uint8_t*>(&heightmap->mWidth));
+    std::copy(data + 4, data + 8, reinterpret_cast<uint8_t*>(&heightmap->mHeight));
+    std::copy(data + 8, data + 12, reinterpret_cast<uint8_t*>(&heightmap->mCellSize));
+    std::copy(data + 12, data + 16, reinterpret_cast<uint8_t*>(&heightmap->mOriginX));
+    std::copy(data + 16, data + 20, reinterpret_cast<uint8_t*>(&heightmap->mOriginZ));
+
+    uint64_t sampleCount = (uint64_t)heightmap->mWidth * heightmap->mHeight;
+
+    if (heightmap->mWidth < 2 || heightmap->mHeight < 2 || !(heightmap->mCellSize > 0.f) ||
+        sampleCount > (heightmap->mMappingSize - const_headerSize) / sizeof(float))
+    {
+        log->error("Heightmap: Invalid header in {}", fileName);
+        return nullptr;
+    }
+
+    heightmap->mHeights = reinterpret_cast<const float*>(data + const_headerSize);
+
+    log->info("Heightmap: Mapped {} with {}x{} samples", fileName, heightmap->mWidth, heightmap->mHeight);
+
+    return heightmap;
+}
+
+float Heightmap::getHeight(float x, float z) const
+{
+    float sampleX = std::min(std::max((x - mOriginX) / mCellSize, 0.f), (float)(mWidth - 1));
+    float sampleZ = std::min(std::max((z - mOriginZ) / mCellSize, 0.f), (float)(mHeight - 1));
+
+    // the cell containing the position, the last cell for positions on the far border
+    uint32_t cellX = std::min((uint32_t)sampleX, mWidth - 2);
+    uint32_t cellZ = std::min((uint32_t)sampleZ, mHeight - 2);
+
+    float fractionX = sampleX - cellX;
+    float fractionZ = sampleZ - cellZ;
+
+    const float* row = mHeights + (size_t)cellZ * mWidth + cellX;
+    float height0 = row[0] + (row[1] - row[0]) * fractionX;
+    float height1 = row[mWidth] + (row[mWidth + 1] - row[mWidth]) * fractionX;
+
+    return height0 + (height1 - height0) * fractionZ;
+}
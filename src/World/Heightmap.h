@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * @brief Height of the terrain of a map, memory-mapped from a file
+ *
+ * The heights are samples on a square grid on the ground plane (x/z), between
+ * them the height is interpolated bilinearly.
+ *
+ * The file is mapped read-only instead of read, so the operating system pages
+ * the heights in lazily on first access and shares them between all processes
+ * (and Zones) using the same map.
+ *
+ * @remark Thread-Safe, it never changes after loading
+ */
+class Heightmap
+{
+    /// Number of samples along x and z
+    uint32_t mWidth;
+    uint32_t mHeight;
+
+    /// Distance between two samples in world units
+    float mCellSize;
+
+    /// World position of the first sample
+    float mOriginX;
+    float mOriginZ;
+
+    /// The samples, row by row along x, inside of the mapping
+    const float* mHeights;
+
+    /// The mapped file
+    void* mMapping;
+    size_t mMappingSize;
+
+#ifdef _WIN32
+    /// Handles of the file and of it's mapping
+    void* mFileHandle;
+    void* mMappingHandle;
+#endif
+
+    Heightmap();
+
+public:
+    Heightmap(const Heightmap&) = delete;
+    Heightmap& operator=(const Heightmap&) = delete;
+
+    /**
+     * Unmaps the file
+     */
+    ~Heightmap();
+
+    /**
+     * Maps a heightmap file: width and height as uint32, cell size, origin x and
+     * origin z as float (all little endian), followed by one float per sample,
+     * row by row along x.
+     * @return the heightmap, nullptr if the file can't be mapped
+     */
+    static std::shared_ptr<Heightmap> load(const std::string& fileName);
+
+    /// Area covered by the samples
+    float getMinX() const { return mOriginX; }
+    float getMinZ() const { return mOriginZ; }
+    float getMaxX() const { return mOriginX + (mWidth - 1) * mCellSize; }
+    float getMaxZ() const { return mOriginZ + (mHeight - 1) * mCellSize; }
+
+    /**
+     * @param x, z a finite position, positions outside are clamped to the border
+     * @return the terrain height at the position
+     */
+    float getHeight(float x, float z) const;
+};
@@ -0,0 +1,63 @@
+#include "MovementValidator.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+/// Half of the side length of the default bounds, a square around the origin
+static const float const_defaultExtent = 2048.f;
+
+MovementValidator::MovementValidator() :
+        mMinX(-const_defaultExtent),
+        mMinZ(-const_defaultExtent),
+        mMaxX(const_defaultExtent),
+        mMaxZ(const_defaultExtent)
+{
+}
+
+void MovementValidator::setHeightmap(std::shared_ptr<const Heightmap> heightmap)
+{
+    mHeightmap = std::move(heightmap);
+
+    // outside of the heightmap there is no ground, a larger heightmap doesn't widen the bounds
+    if (mHeightmap)
+    {
+        setBounds(std::max(mMinX, mHeightmap->getMinX()), std::max(mMinZ, mHeightmap->getMinZ()),
+                  std::min(mMaxX, mHeightmap->getMaxX()), std::min(mMaxZ, mHeightmap->getMaxZ()));
+    }
+}
+
+void MovementValidator::setBounds(float minX, float minZ, float maxX, float maxZ)
+{
+    mMinX = minX;
+    mMinZ = minZ;
+    mMaxX = maxX;
+    mMaxZ = maxZ;
+}
+
+MovementValidator::Result MovementValidator::validate(float fromX, float fromZ,
+                                                      float toX, float toY, float toZ, float& allowance) const
+{
+    // written so that NaN fails every comparison
+    if (!(toX >= mMinX && toX <= mMaxX && toZ >= mMinZ && toZ <= mMaxZ && std::fabs(toY) <= FLT_MAX))
+        return Result::OUT_OF_BOUNDS;
+
+    if (mHeightmap)
+    {
+        float terrainHeight = mHeightmap->getHeight(toX, toZ);
+
+        if (!(toY >= terrainHeight - mSettings.maxDepth && toY <= terrainHeight + mSettings.maxAltitude))
+            return Result::INVALID_HEIGHT;
+    }
+
+    float distanceX = toX - fromX;
+    float distanceZ = toZ - fromZ;
+    float distance = std::sqrt(distanceX * distanceX + distanceZ * distanceZ);
+
+    if (!(distance <= allowance))
+        return Result::TOO_FAST;
+
+    allowance -= distance;
+
+    return Result::VALID;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "Heightmap.h"
+#include "utility/utility.h"
+
+/**
+ * @brief Checks the positions sent by players
+ *
+ * A position is rejected if it's outside the bounds of the Zone, too far
+ * below or above the terrain, or too far away from the last position.
+ *
+ * The speed is checked with a movement allowance per player: it grows by the
+ * maximum speed times the elapsed time and every movement uses up the travelled
+ * distance on the ground plane. Packets arriving in bursts because of network
+ * jitter are fine, as long as the player doesn't travel further than possible.
+ * The allowance is limited, so standing still doesn't save up for a teleport.
+ *
+ * @remark validate() is Thread-Safe, the settings must only be changed while no packets are processed
+ */
+class MovementValidator
+{
+public:
+    /**
+     * Outcome of a validation
+     */
+    enum class Result
+    {
+        VALID,
+        /// further away from the last position than possible
+        TOO_FAST,
+        /// outside of the Zone, or not a number
+        OUT_OF_BOUNDS,
+        /// below or too high above the terrain
+        INVALID_HEIGHT,
+    };
+
+    struct Settings
+    {
+        /// Units per second a player can move on the ground plane
+        float maxSpeed = 10.f;
+
+        /// Seconds of movement the allowance can save up
+        float maxAllowanceTime = 1.f;
+
+        /// Units a player may be below the terrain, for rounding on the client
+        float maxDepth = 0.5f;
+
+        /// Units a player may be above the terrain, e.g. jumping
+        float maxAltitude = 5.f;
+    };
+
+private:
+    Settings mSettings;
+
+    /// Terrain of the Zone, nullptr if the height is not checked
+    std::shared_ptr<const Heightmap> mHeightmap;
+
+    /// Area of the Zone on the ground plane
+    float mMinX;
+    float mMinZ;
+    float mMaxX;
+    float mMaxZ;
+
+public:
+    /**
+     * Creates a validator without heightmap, with the default bounds of a Zone around the origin
+     */
+    MovementValidator();
+
+    /**
+     * Sets the terrain, also limits the bounds to the area of the heightmap,
+     * i.e. the bounds become the intersection of both, set the bounds first
+     * @param heightmap the heightmap, nullptr for none
+     */
+    void setHeightmap(std::shared_ptr<const Heightmap> heightmap);
+
+    /**
+     * Sets the area players can move in
+     */
+    void setBounds(float minX, float minZ, float maxX, float maxZ);
+
+    /**
+     * @return the longest distance between two positions inside the bounds,
+     *         the allowance of a player without a position yet
+     */
+    float getMaxDistance() const { return std::hypot(mMaxX - mMinX, mMaxZ - mMinZ); }
+
+    void setSettings(const Settings& settings) { mSettings = settings; }
+    const Settings& getSettings() const { return mSettings; }
+
+    /**
+     * @return the allowance after some time
+     * @param allowance the current allowance of the player
+     * @param elapsed milliseconds since the allowance was updated
+     */
+    float addAllowance(float allowance, TimePoint elapsed) const
+    {
+        float maxAllowance = mSettings.maxSpeed * mSettings.maxAllowanceTime;
+        return std::min(allowance + mSettings.maxSpeed * elapsed / 1000.f, maxAllowance);
+    }
+
+    /**
+     * Checks a movement of a player
+     * @param fromX, fromZ the last valid position on the ground plane
+     * @param toX, toY, toZ the new position
+     * @param allowance the movement allowance of the player, reduced by valid movements
+     * @return VALID if the new position is accepted
+     */
+    Result validate(float fromX, float fromZ, float toX, float toY, float toZ, float& allowance) const;
+};
@@ -0,0 +1,469 @@
+#include "NavigationGrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <queue>
+
+#include "Log/Logger.h"
+
+/// The search gives up after expanding this many jump points
+static const uint32_t const_maxExpandedNodes = 65536;
+
+/// Cost of a diagonal step, a straight step costs 1
+static const float const_diagonalCost = 1.41421356f;
+
+const NavigationGrid::CellIndex NavigationGrid::INVALID_CELL;
+
+/**
+ * Per thread buffers of a search, reused to avoid clearing grid sized arrays
+ */
+struct SearchState
+{
+    /// Cost from the start, valid for cells marked in the current search
+    std::vector<float> costs;
+
+    /// The cell a cell was reached from
+    std::vector<NavigationGrid::CellIndex> parents;
+
+    /// 2 * generation for opened cells, 2 * generation + 1 for closed ones
+    std::vector<uint32_t> marks;
+
+    /// Number of the current search
+    uint32_t generation = 0;
+
+    void begin(NavigationGrid::CellIndex cellCount)
+    {
+        if (marks.size() < cellCount)
+        {
+            costs.resize(cellCount);
+            parents.resize(cellCount);
+            marks.resize(cellCount, 0);
+        }
+
+        generation++;
+
+        // the marks of old searches would be valid again after an overflow
+        if (generation >= UINT32_MAX / 2)
+        {
+            std::fill(marks.begin(), marks.end(), 0);
+            generation = 1;
+        }
+    }
+};
+
+static thread_local SearchState tSearchState;
+
+/**
+ * Octile distance: the length of a path with diagonal steps first, ignoring obstacles
+ */
+static float estimateCost(int32_t x1, int32_t z1, int32_t x2, int32_t z2)
+{
+    int32_t dx = std::abs(x1 - x2);
+    int32_t dz = std::abs(z1 - z2);
+
+    return (float)std::max(dx, dz) + (const_diagonalCost - 1.f) * (float)std::min(dx, dz);
+}
+
+static int32_t sign(int32_t value)
+{
+    return (value > 0) - (value < 0);
+}
+
+/**
+ * Finds the first jump point on a line of cells (a row or a column), 64 cells at once
+ * @param line bits of the line
+ * @param left, right bits of the neighbouring lines, nullptr outside of the grid
+ * @param wordCount number of uint64_t per line
+ * @param from first position to scan
+ * @param step 1 or -1
+ * @param target position of the end on this line, -1 if it's not on it
+ * @return position of the jump point, -1 if the scan hits an obstacle first
+ */
+static int32_t scanLine(const uint64_t* line, const uint64_t* left, const uint64_t* right,
+                        int32_t wordCount, int32_t from, int32_t step, int32_t target)
+{
+    if (from < 0 || (from >> 6) >= wordCount)
+        return -1;
+
+    // walkable cells beside the line whose cell behind is blocked, see jumpStraight()
+    auto forcedBits = [wordCount, step](const uint64_t* side, int32_t word) -> uint64_t {
+        if (side == nullptr)
+            return 0;
+
+        uint64_t behind;
+        if (step > 0)
+            behind = (side[word] << 1) | (word > 0 ? side[word - 1] >> 63 : 0);
+        else
+            behind = (side[word] >> 1) | (word + 1 < wordCount ? side[word + 1] << 63 : 0);
+
+        return side[word] & ~behind;
+    };
+
+    int32_t word = from >> 6;
+    uint64_t mask = step > 0 ? ~0ull << (from & 63) : ~0ull >> (63 - (from & 63));
+
+    for (; word >= 0 && word < wordCount; word += step, mask = ~0ull)
+    {
+        uint64_t walkable = line[word];
+
+        // blocked cells end the scan, walkable ones with a forced neighbour are jump points
+        uint64_t stops = ((forcedBits(left, word) | forcedBits(right, word)) & walkable) | ~walkable;
+
+        if (target >= 0 && (target >> 6) == word)
+            stops |= 1ull << (target & 63);
+
+        stops &= mask;
+
+        if (stops != 0)
+        {
+            int32_t bit = step > 0 ? __builtin_ctzll(stops) : 63 - __builtin_clzll(stops);
+            return (walkable >> bit) & 1 ? (word << 6) + bit : -1;
+        }
+    }
+
+    return -1;
+}
+
+NavigationGrid::NavigationGrid(int32_t width, int32_t height, float cellSize, float originX, float originZ) :
+        mWidth(width),
+        mHeight(height),
+        mCellSize(cellSize),
+        mOriginX(originX),
+        mOriginZ(originZ),
+        mWalkable((CellIndex)width * (CellIndex)height, 1),
+        mRowWords((width + 63) / 64),
+        mColumnWords((height + 63) / 64)
+{
+    buildLines();
+}
+
+std::shared_ptr<NavigationGrid> NavigationGrid::load(const std::string& fileName)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file)
+    {
+        log->error("NavigationGrid: Can't open {}", fileName);
+        return nullptr;
+    }
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    float cellSize = 0.f;
+    float originX = 0.f;
+    float originZ = 0.f;
+
+    file.read(reinterpret_cast<char*>(&width), sizeof(width));
+    file.read(reinterpret_cast<char*>(&height), sizeof(height));
+    file.read(reinterpret_cast<char*>(&cellSize), sizeof(cellSize));
+    file.read(reinterpret_cast<char*>(&originX), sizeof(originX));
+    file.read(reinterpret_cast<char*>(&originZ), sizeof(originZ));
+
+    // coordinates of cells are signed, and a pair of cell indices must fit into the 64 bit keys of the path cache
+    if (!file || width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX ||
+        (CellIndex)width * height >= UINT32_MAX || !(cellSize > 0.f))
+    {
+        log->error("NavigationGrid: Invalid header in {}", fileName);
+        return nullptr;
+    }
+
+    std::shared_ptr<NavigationGrid> grid = std::make_shared<NavigationGrid>((int32_t)width, (int32_t)height, cellSize, originX, originZ);
+
+    file.read(reinterpret_cast<char*>(grid->mWalkable.data()), grid->mWalkable.size());
+
+    if (!file)
+    {
+        log->error("NavigationGrid: {} is truncated", fileName);
+        return nullptr;
+    }
+
+    grid->buildLines();
+
+    log->info("NavigationGrid: Loaded {} with {}x{} cells", fileName, width, height);
+
+    return grid;
+}
+
+void NavigationGrid::buildLines()
+{
+    // the bits behind the last cell of a line stay 0, so scans stop there
+    mRows.assign((CellIndex)mHeight * mRowWords, 0);
+    mColumns.assign((CellIndex)mWidth * mColumnWords, 0);
+
+    for (int32_t z = 0; z < mHeight; z++)
+    {
+        for (int32_t x = 0; x < mWidth; x++)
+        {
+            if (mWalkable[getCellIndex(x, z)] == 0)
+                continue;
+
+            mRows[(CellIndex)z * mRowWords + (x >> 6)] |= 1ull << (x & 63);
+            mColumns[(CellIndex)x * mColumnWords + (z >> 6)] |= 1ull << (z & 63);
+        }
+    }
+}
+
+void NavigationGrid::setWalkable(int32_t x, int32_t z, bool walkable)
+{
+    mWalkable[getCellIndex(x, z)] = walkable ? 1 : 0;
+
+    uint64_t& row = mRows[(CellIndex)z * mRowWords + (x >> 6)];
+    uint64_t& column = mColumns[(CellIndex)x * mColumnWords + (z >> 6)];
+
+    if (walkable)
+    {
+        row |= 1ull << (x & 63);
+        column |= 1ull << (z & 63);
+    }
+    else
+    {
+        row &= ~(1ull << (x & 63));
+        column &= ~(1ull << (z & 63));
+    }
+}
+
+bool NavigationGrid::findCell(float x, float z, CellIndex& cell) const
+{
+    float cellX = std::floor((x - mOriginX) / mCellSize);
+    float cellZ = std::floor((z - mOriginZ) / mCellSize);
+
+    if (!(cellX >= 0.f && cellZ >= 0.f && cellX < (float)mWidth && cellZ < (float)mHeight))
+        return false;
+
+    cell = getCellIndex((int32_t)cellX, (int32_t)cellZ);
+    return true;
+}
+
+NavigationGrid::CellIndex NavigationGrid::jumpStraight(int32_t x, int32_t z, int32_t dx, int32_t dz, CellIndex end) const
+{
+    int32_t endX = getCellX(end);
+    int32_t endZ = getCellZ(end);
+
+    // a forced neighbour is a cell beside the run which can't be reached diagonally from behind
+    if (dx != 0)
+    {
+        const uint64_t* row = getRow(z);
+        if (row == nullptr)
+            return INVALID_CELL;
+
+        int32_t jumpX = scanLine(row, getRow(z - 1), getRow(z + 1), mRowWords, x, dx, endZ == z ? endX : -1);
+        return jumpX < 0 ? INVALID_CELL : getCellIndex(jumpX, z);
+    }
+    else
+    {
+        const uint64_t* column = getColumn(x);
+        if (column == nullptr)
+            return INVALID_CELL;
+
+        int32_t jumpZ = scanLine(column, getColumn(x - 1), getColumn(x + 1), mColumnWords, z, dz, endX == x ? endZ : -1);
+        return jumpZ < 0 ? INVALID_CELL : getCellIndex(x, jumpZ);
+    }
+}
+
+NavigationGrid::CellIndex NavigationGrid::jump(int32_t x, int32_t z, int32_t dx, int32_t dz, CellIndex end) const
+{
+    if (dx == 0 || dz == 0)
+        return jumpStraight(x, z, dx, dz, end);
+
+    while (isWalkable(x, z))
+    {
+        CellIndex cell = getCellIndex(x, z);
+
+        if (cell == end)
+            return cell;
+
+        // a diagonal run stops where one of it's straight runs finds something
+        if (jumpStraight(x + dx, z, dx, 0, end) != INVALID_CELL || jumpStraight(x, z + dz, 0, dz, end) != INVALID_CELL)
+            return cell;
+
+        // no cutting corners
+        if (!isWalkable(x + dx, z) || !isWalkable(x, z + dz))
+            break;
+
+        x += dx;
+        z += dz;
+    }
+
+    return INVALID_CELL;
+}
+
+bool NavigationGrid::findPath(CellIndex start, CellIndex end, Path& path) const
+{
+    path.clear();
+
+    // would search the whole reachable area for nothing
+    if (mWalkable[start] == 0 || mWalkable[end] == 0)
+        return false;
+
+    if (start == end)
+    {
+        float x = mOriginX + ((float)getCellX(start) + 0.5f) * mCellSize;
+        float z = mOriginZ + ((float)getCellZ(start) + 0.5f) * mCellSize;
+        path.push_back({x, z});
+        return true;
+    }
+
+    SearchState& state = tSearchState;
+    state.begin(getCellCount());
+
+    uint32_t openMark = state.generation * 2;
+    uint32_t closedMark = openMark + 1;
+
+    int32_t endX = getCellX(end);
+    int32_t endZ = getCellZ(end);
+
+    // estimated total cost and cell, cheapest first
+    typedef std::pair<float, CellIndex> OpenNode;
+    std::priority_queue<OpenNode, std::vector<OpenNode>, std::greater<OpenNode>> open;
+
+    state.costs[start] = 0.f;
+    state.parents[start] = INVALID_CELL;
+    state.marks[start] = openMark;
+    open.push(OpenNode(estimateCost(getCellX(start), getCellZ(start), endX, endZ), start));
+
+    uint32_t expandedCount = 0;
+    bool found = false;
+
+    // directions to continue in, at most 8
+    int32_t directions[8][2];
+
+    while (!open.empty() && expandedCount < const_maxExpandedNodes)
+    {
+        CellIndex cell = open.top().second;
+        open.pop();
+
+        // an outdated entry of a cell reached cheaper later
+        if (state.marks[cell] == closedMark)
+            continue;
+
+        state.marks[cell] = closedMark;
+        expandedCount++;
+
+        if (cell == end)
+        {
+            found = true;
+            break;
+        }
+
+        int32_t x = getCellX(cell);
+        int32_t z = getCellZ(cell);
+        uint32_t directionCount = 0;
+
+        if (state.parents[cell] == INVALID_CELL)
+        {
+            // the start continues in every direction
+            for (int32_t dz = -1; dz <= 1; dz++)
+            {
+                for (int32_t dx = -1; dx <= 1; dx++)
+                {
+                    if ((dx != 0 || dz != 0) && isWalkable(x + dx, z + dz) && isWalkable(x + dx, z) && isWalkable(x, z + dz))
+                    {
+                        directions[directionCount][0] = dx;
+                        directions[directionCount][1] = dz;
+                        directionCount++;
+                    }
+                }
+            }
+        }
+        else
+        {
+            // pruned neighbours: only the directions not reached better through the parent
+            CellIndex parent = state.parents[cell];
+            int32_t dx = sign(x - getCellX(parent));
+            int32_t dz = sign(z - getCellZ(parent));
+
+            auto add = [&](int32_t directionX, int32_t directionZ) {
+                directions[directionCount][0] = directionX;
+                directions[directionCount][1] = directionZ;
+                directionCount++;
+            };
+
+            if (dx != 0 && dz != 0)
+            {
+                bool walkableX = isWalkable(x + dx, z);
+                bool walkableZ = isWalkable(x, z + dz);
+
+                if (walkableX)
+                    add(dx, 0);
+                if (walkableZ)
+                    add(0, dz);
+                if (walkableX && walkableZ)
+                    add(dx, dz);
+            }
+            else if (dx != 0)
+            {
+                bool walkableAbove = isWalkable(x, z + 1);
+                bool walkableBelow = isWalkable(x, z - 1);
+
+                if (isWalkable(x + dx, z))
+                {
+                    add(dx, 0);
+                    if (walkableAbove)
+                        add(dx, 1);
+                    if (walkableBelow)
+                        add(dx, -1);
+                }
+                if (walkableAbove)
+                    add(0, 1);
+                if (walkableBelow)
+                    add(0, -1);
+            }
+            else
+            {
+                bool walkableRight = isWalkable(x + 1, z);
+                bool walkableLeft = isWalkable(x - 1, z);
+
+                if (isWalkable(x, z + dz))
+                {
+                    add(0, dz);
+                    if (walkableRight)
+                        add(1, dz);
+                    if (walkableLeft)
+                        add(-1, dz);
+                }
+                if (walkableRight)
+                    add(1, 0);
+                if (walkableLeft)
+                    add(-1, 0);
+            }
+        }
+
+        for (uint32_t direction = 0; direction < directionCount; direction++)
+        {
+            CellIndex jumpPoint = jump(x + directions[direction][0], z + directions[direction][1],
+                                      directions[direction][0], directions[direction][1], end);
+
+            if (jumpPoint == INVALID_CELL || state.marks[jumpPoint] == closedMark)
+                continue;
+
+            int32_t jumpX = getCellX(jumpPoint);
+            int32_t jumpZ = getCellZ(jumpPoint);
+
+            // jump points lie on a straight or diagonal line, so the octile distance is exact
+            float cost = state.costs[cell] + estimateCost(x, z, jumpX, jumpZ);
+
+            if (state.marks[jumpPoint] != openMark || cost < state.costs[jumpPoint])
+            {
+                state.costs[jumpPoint] = cost;
+                state.parents[jumpPoint] = cell;
+                state.marks[jumpPoint] = openMark;
+                open.push(OpenNode(cost + estimateCost(jumpX, jumpZ, endX, endZ), jumpPoint));
+            }
+        }
+    }
+
+    if (!found)
+        return false;
+
+    for (CellIndex cell = end; cell != INVALID_CELL; cell = state.parents[cell])
+    {
+        float x = mOriginX + ((float)getCellX(cell) + 0.5f) * mCellSize;
+        float z = mOriginZ + ((float)getCellZ(cell) + 0.5f) * mCellSize;
+        path.push_back({x, z});
+    }
+
+    std::reverse(path.begin(), path.end());
+
+    return true;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Walkability of the ground of a Zone, for finding paths
+ *
+ * The ground plane (x/z) is split into square cells, which are either walkable
+ * or blocked. Paths are found with Jump Point Search (JPS): A* on an 8-connected
+ * grid, which jumps over the cells of straight and diagonal runs instead of
+ * expanding each of them. Diagonal moves are only allowed when both adjacent
+ * cells are walkable, so paths never cut corners.
+ *
+ * The walkability is also kept as bits per row and per column, so the straight
+ * scans of JPS test 64 cells at once.
+ *
+ * A grid doesn't change after loading and can be shared by all Zones of the same map.
+ *
+ * @remark findPath() is Thread-Safe, the grid must not be changed while searching
+ */
+class NavigationGrid
+{
+public:
+    /**
+     * A point of a path on the ground plane
+     */
+    struct Waypoint
+    {
+        float x;
+        float z;
+    };
+
+    /// The turning points of a path, including start and end
+    typedef std::vector<Waypoint> Path;
+
+    /// Index of a cell, z * width + x
+    typedef uint64_t CellIndex;
+
+    /// No cell, e.g. no jump point found
+    static const CellIndex INVALID_CELL = UINT64_MAX;
+
+private:
+    /// Number of cells along x and z
+    int32_t mWidth;
+    int32_t mHeight;
+
+    /// Length of the side of a cell in world units
+    float mCellSize;
+
+    /// World position of the corner of cell 0
+    float mOriginX;
+    float mOriginZ;
+
+    /// 1 for every walkable cell, row by row along x
+    std::vector<uint8_t> mWalkable;
+
+    /// Number of uint64_t per row and per column of the bit sets
+    int32_t mRowWords;
+    int32_t mColumnWords;
+
+    /// Walkability as bits: bit x of row z, and bit z of column x
+    std::vector<uint64_t> mRows;
+    std::vector<uint64_t> mColumns;
+
+    /**
+     * @return the bits of a row, nullptr outside of the grid
+     */
+    const uint64_t* getRow(int32_t z) const { return z >= 0 && z < mHeight ? &mRows[(CellIndex)z * mRowWords] : nullptr; }
+
+    /**
+     * @return the bits of a column, nullptr outside of the grid
+     */
+    const uint64_t* getColumn(int32_t x) const { return x >= 0 && x < mWidth ? &mColumns[(CellIndex)x * mColumnWords] : nullptr; }
+
+    /**
+     * @return the index of the cell at x, z
+     */
+    CellIndex getCellIndex(int32_t x, int32_t z) const { return (CellIndex)z * (CellIndex)mWidth + (CellIndex)x; }
+
+    /**
+     * @return the coordinates of a cell
+     */
+    int32_t getCellX(CellIndex cell) const { return (int32_t)(cell % (CellIndex)mWidth); }
+    int32_t getCellZ(CellIndex cell) const { return (int32_t)(cell / (CellIndex)mWidth); }
+
+    /**
+     * Fills the bit sets from mWalkable
+     */
+    void buildLines();
+
+    /**
+     * Scans straight from a cell until a jump point, the end or an obstacle
+     * @param x, z first cell of the scan
+     * @param dx, dz direction, one of them 0
+     * @return the cell index of the jump point, INVALID_CELL if none
+     */
+    CellIndex jumpStraight(int32_t x, int32_t z, int32_t dx, int32_t dz, CellIndex end) const;
+
+    /**
+     * Scans from a cell in any direction until a jump point, the end or an obstacle
+     * @param x, z first cell of the scan
+     * @param dx, dz direction
+     * @return the cell index of the jump point, INVALID_CELL if none
+     */
+    CellIndex jump(int32_t x, int32_t z, int32_t dx, int32_t dz, CellIndex end) const;
+
+public:
+    /**
+     * Creates a grid with all cells walkable
+     * @param width, height number of cells along x and z
+     * @param cellSize length of a cell in world units
+     * @param originX, originZ world position of the corner of the first cell
+     */
+    NavigationGrid(int32_t width, int32_t height, float cellSize, float originX, float originZ);
+
+    /**
+     * Loads a grid from a file: width and height as uint32, cell size, origin x and
+     * origin z as float (all little endian), followed by one byte per cell, row by row
+     * along x, 0 for blocked cells.
+     * @return the grid, nullptr if the file can't be read
+     */
+    static std::shared_ptr<NavigationGrid> load(const std::string& fileName);
+
+    int32_t getWidth() const { return mWidth; }
+    int32_t getHeight() const { return mHeight; }
+    CellIndex getCellCount() const { return (CellIndex)mWalkable.size(); }
+    float getCellSize() const { return mCellSize; }
+
+    /**
+     * @return true if the cell is inside the grid and walkable
+     */
+    bool isWalkable(int32_t x, int32_t z) const
+    {
+        return x >= 0 && z >= 0 && x < mWidth && z < mHeight && mWalkable[getCellIndex(x, z)] != 0;
+    }
+
+    /**
+     * Blocks or unblocks a cell, only before the grid is used
+     */
+    void setWalkable(int32_t x, int32_t z, bool walkable);
+
+    /**
+     * Finds the cell containing a world position
+     * @param cell receives the cell index
+     * @return false if the position is outside the grid
+     */
+    bool findCell(float x, float z, CellIndex& cell) const;
+
+    /**
+     * Finds the shortest path between the centers of two cells
+     * @param start, end cell indices, see findCell()
+     * @param path receives the waypoints at the centers of the cells
+     * @return false if there's no path, or the search gave up
+     * @remark Thread-Safe
+     */
+    bool findPath(CellIndex start, CellIndex end, Path& path) const;
+};
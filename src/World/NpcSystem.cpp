@@ -0,0 +1,487 @@
+#include "NpcSystem.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "PathfindingService.h"
+#include "utility/SimdKernels.h"
+
+/// A NPC notices players within this radius
+static const float const_aggroRadius = 20.f;
+
+/// A chasing NPC gives up when the player is farther away
+static const float const_loseRadius = 30.f;
+
+/// A chasing NPC gives up when the player is farther away from it's home
+static const float const_leashRadius = 50.f;
+
+/// Maximum distance of patrol points from home
+static const float const_patrolRadius = 15.f;
+
+/// Speeds in units per second
+static const float const_walkSpeed = 2.f;
+static const float const_runSpeed = 6.f;
+
+/// A chasing NPC stops at this distance to the player
+static const float const_attackRange = 2.f;
+
+/// A NPC nearer to it's goal has arrived
+static const float const_arriveDistance = 0.5f;
+
+/// A NPC nearer to the point it steers to stops, instead of creeping towards it
+static const float const_stopTolerance = 0.01f;
+
+/// Range of the idle time between patrols, in milliseconds
+static const TimePoint const_minIdleTime = 2000;
+static const TimePoint const_maxIdleTime = 6000;
+
+/// Default think budget per tick in nanoseconds
+static const uint64_t const_thinkBudget = 2000000;
+
+/// Number of NPCs thinking between two checks of the budget
+static const uint32_t const_thinkBatchSize = 256;
+
+/// Health of a spawned NPC
+static const uint16_t const_npcHealth = 50;
+
+/// Initial state of the random number generator
+static const uint32_t const_randomSeed = 0x9e3779b9;
+
+NpcSystem::NpcSystem() : mThinkBudget(const_thinkBudget), mRandomState(const_randomSeed)
+{
+}
+
+EntityId NpcSystem::spawn(EntityRegistry& entities, float x, float y, float z)
+{
+    EntityId id = entities.create(EntityRegistry::Type::NPC, nullptr);
+    uint32_t index = entities.getIndex(id);
+    entities.setPosition(index, x, y, z);
+    entities.setProperty<ReplicatedProperties::MAX_HEALTH>(index, const_npcHealth);
+    entities.setProperty<ReplicatedProperties::HEALTH>(index, const_npcHealth);
+
+    mEntities.push_back(id);
+    mStates.push_back(State::IDLE);
+    mHomeX.push_back(x);
+    mHomeZ.push_back(z);
+    mGoalX.push_back(x);
+    mGoalZ.push_back(z);
+    mSpeeds.push_back(0.f);
+    mTargets.push_back(INVALID_ENTITY);
+    mIdleEndTimes.push_back(mTime + const_minIdleTime + (TimePoint)((random() + 1.f) * 0.5f * (const_maxIdleTime - const_minIdleTime)));
+    mPaths.push_back(nullptr);
+    mWaypoints.push_back(0);
+
+    return id;
+}
+
+void NpcSystem::remove(uint32_t npc)
+{
+    uint32_t last = size() - 1;
+
+    mEntities[npc] = mEntities[last];
+    mStates[npc] = mStates[last];
+    mHomeX[npc] = mHomeX[last];
+    mHomeZ[npc] = mHomeZ[last];
+    mGoalX[npc] = mGoalX[last];
+    mGoalZ[npc] = mGoalZ[last];
+    mSpeeds[npc] = mSpeeds[last];
+    mTargets[npc] = mTargets[last];
+    mIdleEndTimes[npc] = mIdleEndTimes[last];
+    mPaths[npc] = std::move(mPaths[last]);
+    mWaypoints[npc] = mWaypoints[last];
+
+    mEntities.pop_back();
+    mStates.pop_back();
+    mHomeX.pop_back();
+    mHomeZ.pop_back();
+    mGoalX.pop_back();
+    mGoalZ.pop_back();
+    mSpeeds.pop_back();
+    mTargets.pop_back();
+    mIdleEndTimes.pop_back();
+    mPaths.pop_back();
+    mWaypoints.pop_back();
+}
+
+void NpcSystem::clear(EntityRegistry& entities)
+{
+    for (EntityId id : mEntities)
+    {
+        if (entities.isAlive(id))
+            entities.destroy(id);
+    }
+
+    mEntities.clear();
+    mStates.clear();
+    mHomeX.clear();
+    mHomeZ.clear();
+    mGoalX.clear();
+    mGoalZ.clear();
+    mSpeeds.clear();
+    mTargets.clear();
+    mIdleEndTimes.clear();
+    mPaths.clear();
+    mWaypoints.clear();
+    mTime = 0;
+    mThinkCursor = 0;
+    mRoundTime = 0;
+    mLastRoundTime = 0;
+    mRandomState = const_randomSeed;
+}
+
+void NpcSystem::update(EntityRegistry& entities, TimePoint difference)
+{
+    mTime += difference;
+    mRoundTime += difference;
+
+    resolveEntities(entities);
+
+    if (mEntities.empty())
+        return;
+
+    collectPlayers(entities);
+    think(entities);
+    steer(entities, difference / 1000.f);
+}
+
+void NpcSystem::resolveEntities(EntityRegistry& entities)
+{
+    mIndices.resize(mEntities.size());
+
+    uint32_t npc = 0;
+    while (npc < size())
+    {
+        uint32_t index = entities.getIndex(mEntities[npc]);
+
+        // despawned by someone else, e.g. killed
+        if (index == UINT32_MAX)
+        {
+            remove(npc);
+            mIndices.pop_back();
+            continue;
+        }
+
+        mIndices[npc] = index;
+        npc++;
+    }
+
+    if (mThinkCursor >= size())
+        mThinkCursor = 0;
+}
+
+void NpcSystem::collectPlayers(EntityRegistry& entities)
+{
+    mPlayerIds.clear();
+    mPlayerX.clear();
+    mPlayerZ.clear();
+
+    const EntityId* ids = entities.getIds();
+    const EntityRegistry::Type* types = entities.getTypes();
+    const float* positionX = entities.getPositionX();
+    const float* positionZ = entities.getPositionZ();
+
+    for (uint32_t index = 0; index < entities.size(); index++)
+    {
+        if (types[index] != EntityRegistry::Type::PLAYER)
+            continue;
+
+        mPlayerIds.push_back(ids[index]);
+        mPlayerX.push_back(positionX[index]);
+        mPlayerZ.push_back(positionZ[index]);
+    }
+
+    mCandidates.resize(mPlayerIds.size());
+}
+
+void NpcSystem::think(EntityRegistry& entities)
+{
+    uint64_t deadline = getTimeNanoseconds() + mThinkBudget;
+    uint32_t remaining = size();
+
+    // at least one batch per tick, so the NPCs never stop thinking; at most one round
+    do
+    {
+        uint32_t batchEnd = std::min(size(), mThinkCursor + std::min(remaining, const_thinkBatchSize));
+        remaining -= batchEnd - mThinkCursor;
+
+        for (; mThinkCursor < batchEnd; mThinkCursor++)
+            thinkNpc(entities, mThinkCursor);
+
+        if (mThinkCursor == size())
+        {
+            mThinkCursor = 0;
+            mLastRoundTime = mRoundTime;
+            mRoundTime = 0;
+        }
+    }
+    while (remaining > 0 && getTimeNanoseconds() < deadline);
+}
+
+void NpcSystem::thinkNpc(EntityRegistry& entities, uint32_t npc)
+{
+    uint32_t index = mIndices[npc];
+    float x = entities.getPositionX()[index];
+    float z = entities.getPositionZ()[index];
+
+    switch (mStates[npc])
+    {
+        case State::IDLE:
+        case State::PATROL:
+        {
+            EntityId target = findNearestPlayer(x, z, const_aggroRadius);
+            if (target != INVALID_ENTITY)
+            {
+                mStates[npc] = State::CHASE;
+                mTargets[npc] = target;
+                mSpeeds[npc] = const_runSpeed;
+                break;
+            }
+
+            float goalDistanceX = mGoalX[npc] - x;
+            float goalDistanceZ = mGoalZ[npc] - z;
+            bool arrived = goalDistanceX * goalDistanceX + goalDistanceZ * goalDistanceZ < const_arriveDistance * const_arriveDistance;
+
+            if (mStates[npc] == State::PATROL && arrived)
+            {
+                mStates[npc] = State::IDLE;
+                mSpeeds[npc] = 0.f;
+                mIdleEndTimes[npc] = mTime + const_minIdleTime + (TimePoint)((random() + 1.f) * 0.5f * (const_maxIdleTime - const_minIdleTime));
+            }
+            else if (mStates[npc] == State::IDLE && (int32_t)(mTime - mIdleEndTimes[npc]) >= 0)
+            {
+                mStates[npc] = State::PATROL;
+                mSpeeds[npc] = const_walkSpeed;
+                mGoalX[npc] = mHomeX[npc] + random() * const_patrolRadius;
+                mGoalZ[npc] = mHomeZ[npc] + random() * const_patrolRadius;
+            }
+            break;
+        }
+        case State::CHASE:
+        {
+            uint32_t targetIndex = entities.getIndex(mTargets[npc]);
+            bool lost = targetIndex == UINT32_MAX;
+
+            if (!lost)
+            {
+                float targetX = entities.getPositionX()[targetIndex];
+                float targetZ = entities.getPositionZ()[targetIndex];
+                float distanceX = targetX - x;
+                float distanceZ = targetZ - z;
+                float homeDistanceX = targetX - mHomeX[npc];
+                float homeDistanceZ = targetZ - mHomeZ[npc];
+
+                lost = distanceX * distanceX + distanceZ * distanceZ > const_loseRadius * const_loseRadius ||
+                       homeDistanceX * homeDistanceX + homeDistanceZ * homeDistanceZ > const_leashRadius * const_leashRadius;
+            }
+
+            if (lost)
+                returnHome(npc, x, z);
+            break;
+        }
+        case State::RETURN:
+        {
+            float homeDistanceX = mHomeX[npc] - x;
+            float homeDistanceZ = mHomeZ[npc] - z;
+
+            if (homeDistanceX * homeDistanceX + homeDistanceZ * homeDistanceZ < const_arriveDistance * const_arriveDistance)
+            {
+                mStates[npc] = State::IDLE;
+                mSpeeds[npc] = 0.f;
+                mIdleEndTimes[npc] = mTime + const_minIdleTime;
+                mPaths[npc].reset();
+            }
+            break;
+        }
+    }
+}
+
+void NpcSystem::steer(EntityRegistry& entities, float seconds)
+{
+    const float* positionX = entities.getPositionX();
+    const float* positionZ = entities.getPositionZ();
+    const float* velocityX = entities.getVelocityX();
+    const float* velocityZ = entities.getVelocityZ();
+
+    for (uint32_t npc = 0; npc < size(); npc++)
+    {
+        uint32_t index = mIndices[npc];
+        float stopDistance = 0.f;
+
+        if (mStates[npc] == State::CHASE)
+        {
+            // follow the target between two thinks, it's loss is noticed by the next think
+            uint32_t targetIndex = entities.getIndex(mTargets[npc]);
+            if (targetIndex != UINT32_MAX)
+            {
+                mGoalX[npc] = positionX[targetIndex];
+                mGoalZ[npc] = positionZ[targetIndex];
+            }
+
+            stopDistance = const_attackRange;
+        }
+        else if (mStates[npc] == State::RETURN && mPaths[npc])
+        {
+            followPath(npc, positionX[index], positionZ[index]);
+        }
+
+        float distanceX = mGoalX[npc] - positionX[index];
+        float distanceZ = mGoalZ[npc] - positionZ[index];
+        float distance = std::sqrt(distanceX * distanceX + distanceZ * distanceZ);
+        float travel = distance - stopDistance;
+
+        float newVelocityX = 0.f;
+        float newVelocityZ = 0.f;
+
+        if (mSpeeds[npc] > 0.f && travel > const_stopTolerance)
+        {
+            // slow down for the last step instead of overshooting the goal
+            float speed = seconds > 0.f ? std::min(mSpeeds[npc], travel / seconds) : mSpeeds[npc];
+            newVelocityX = distanceX / distance * speed;
+            newVelocityZ = distanceZ / distance * speed;
+        }
+
+        // unchanged velocities are not marked dirty
+        if (newVelocityX != velocityX[index] || newVelocityZ != velocityZ[index])
+            entities.setVelocity(index, newVelocityX, 0.f, newVelocityZ);
+    }
+}
+
+void NpcSystem::separate(EntityRegistry& entities, const std::vector<Broadphase::Pair>& pairs)
+{
+    const EntityRegistry::Type* types = entities.getTypes();
+    const float* positionX = entities.getPositionX();
+    const float* positionY = entities.getPositionY();
+    const float* positionZ = entities.getPositionZ();
+    const float* extents = entities.getExtents();
+
+    for (const Broadphase::Pair& pair : pairs)
+    {
+        bool firstMoves = types[pair.first] == EntityRegistry::Type::NPC;
+        bool secondMoves = types[pair.second] == EntityRegistry::Type::NPC;
+
+        // players are moved by their clients only
+        if (!firstMoves && !secondMoves)
+            continue;
+
+        float distanceX = positionX[pair.second] - positionX[pair.first];
+        float distanceZ = positionZ[pair.second] - positionZ[pair.first];
+        float size = extents[pair.first] + extents[pair.second];
+
+        // pushed apart along the axis with the smaller overlap, earlier pushes may have separated them already
+        float overlapX = size - std::abs(distanceX);
+        float overlapZ = size - std::abs(distanceZ);
+
+        if (overlapX <= 0.f || overlapZ <= 0.f)
+            continue;
+
+        float pushX = 0.f;
+        float pushZ = 0.f;
+
+        if (overlapX < overlapZ)
+            pushX = distanceX < 0.f ? -overlapX : overlapX;
+        else
+            pushZ = distanceZ < 0.f ? -overlapZ : overlapZ;
+
+        // both NPCs move half of the way
+        float share = firstMoves && secondMoves ? 0.5f : 1.f;
+
+        if (firstMoves)
+            entities.setPosition(pair.first, positionX[pair.first] - pushX * share, positionY[pair.first], positionZ[pair.first] - pushZ * share);
+
+        if (secondMoves)
+            entities.setPosition(pair.second, positionX[pair.second] + pushX * share, positionY[pair.second], positionZ[pair.second] + pushZ * share);
+    }
+}
+
+void NpcSystem::returnHome(uint32_t npc, float x, float z)
+{
+    mStates[npc] = State::RETURN;
+    mTargets[npc] = INVALID_ENTITY;
+    mSpeeds[npc] = const_runSpeed;
+    mPaths[npc].reset();
+
+    // straight home until the path is found, or if there's none
+    mGoalX[npc] = mHomeX[npc];
+    mGoalZ[npc] = mHomeZ[npc];
+
+    if (mPathfinding == nullptr)
+        return;
+
+    EntityId id = mEntities[npc];
+
+    mPathfinding->findPath(x, z, mHomeX[npc], mHomeZ[npc], [this, id](std::shared_ptr<const NavigationGrid::Path> path) {
+        // the NPC may be gone or chasing again meanwhile
+        auto iterator = std::find(mEntities.begin(), mEntities.end(), id);
+        if (iterator == mEntities.end() || path == nullptr)
+            return;
+
+        uint32_t npc = (uint32_t)(iterator - mEntities.begin());
+        if (mStates[npc] != State::RETURN)
+            return;
+
+        // the first waypoint is the center of the cell the search started in, which the NPC already left
+        mPaths[npc] = std::move(path);
+        mWaypoints[npc] = mPaths[npc]->size() > 1 ? 1 : 0;
+        mGoalX[npc] = (*mPaths[npc])[mWaypoints[npc]].x;
+        mGoalZ[npc] = (*mPaths[npc])[mWaypoints[npc]].z;
+    });
+}
+
+void NpcSystem::followPath(uint32_t npc, float x, float z)
+{
+    float distanceX = mGoalX[npc] - x;
+    float distanceZ = mGoalZ[npc] - z;
+
+    if (distanceX * distanceX + distanceZ * distanceZ >= const_arriveDistance * const_arriveDistance)
+        return;
+
+    const NavigationGrid::Path& path = *mPaths[npc];
+
+    // the last waypoint is the center of the home cell, home itself is the end
+    if (++mWaypoints[npc] < path.size())
+    {
+        mGoalX[npc] = path[mWaypoints[npc]].x;
+        mGoalZ[npc] = path[mWaypoints[npc]].z;
+    }
+    else
+    {
+        mGoalX[npc] = mHomeX[npc];
+        mGoalZ[npc] = mHomeZ[npc];
+        mPaths[npc].reset();
+    }
+}
+
+EntityId NpcSystem::findNearestPlayer(float x, float z, float radius)
+{
+    uint32_t count = SimdKernels::filterWithinRadius((uint32_t)mPlayerIds.size(), mPlayerX.data(), mPlayerZ.data(),
+                                                     x, z, radius * radius, mCandidates.data());
+
+    EntityId nearest = INVALID_ENTITY;
+    float nearestDistance = radius * radius;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t player = mCandidates[i];
+        float distanceX = mPlayerX[player] - x;
+        float distanceZ = mPlayerZ[player] - z;
+        float distance = distanceX * distanceX + distanceZ * distanceZ;
+
+        if (distance <= nearestDistance)
+        {
+            nearest = mPlayerIds[player];
+            nearestDistance = distance;
+        }
+    }
+
+    return nearest;
+}
+
+float NpcSystem::random()
+{
+    // xorshift32, deterministic for the same order of calls
+    mRandomState ^= mRandomState << 13;
+    mRandomState ^= mRandomState >> 17;
+    mRandomState ^= mRandomState << 5;
+
+    return (float)(mRandomState >> 8) / (float)(1 << 23) - 1.f;
+}
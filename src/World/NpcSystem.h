@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Broadphase.h"
+#include "EntityRegistry.h"
+#include "NavigationGrid.h"
+#include "utility/utility.h"
+
+class PathfindingService;
+
+/**
+ * @brief Simulates the NPCs (e.g. monsters) of a Zone
+ *
+ * Every NPC is an entity in the EntityRegistry of the Zone and runs a
+ * state machine: it idles at it's home, patrols around it, chases players
+ * coming too close and returns home when the player escapes. The way home
+ * is searched on the NavigationGrid of the Zone, so returning NPCs walk around
+ * obstacles instead of through them.
+ *
+ * The work is split in two parts:
+ *  - thinking: the state transitions, which need to search for players.
+ *    They are time-sliced: every tick continues with the next NPCs until the
+ *    think budget is spent, so a tick never spends more on it, no matter how
+ *    many NPCs the Zone has. With many NPCs, each one thinks less often.
+ *  - steering: every NPC moves towards it's current goal. This is cheap and
+ *    done for all NPCs every tick, in one batch over the arrays.
+ *
+ * The movement itself is done by the movement system of the EntityRegistry,
+ * so NPCs are replicated the same way as players. Afterwards NPCs overlapping
+ * others are pushed apart, so crowds of NPCs don't stand inside each other.
+ *
+ * @remark not thread-safe, used by the Zone thread
+ */
+class NpcSystem
+{
+public:
+    /**
+     * Behaviour state of a NPC
+     */
+    enum class State : uint8_t
+    {
+        /// standing still, waiting for the next patrol
+        IDLE,
+        /// walking to a random point around home
+        PATROL,
+        /// running after a player
+        CHASE,
+        /// going back home after a chase, ignoring players
+        RETURN,
+    };
+
+private:
+    /// Per NPC data, all in the same order
+    std::vector<EntityId> mEntities;
+    std::vector<State> mStates;
+    std::vector<float> mHomeX;
+    std::vector<float> mHomeZ;
+    std::vector<float> mGoalX;
+    std::vector<float> mGoalZ;
+    std::vector<float> mSpeeds;
+
+    /// The chased player of every NPC, INVALID_ENTITY if none
+    std::vector<EntityId> mTargets;
+
+    /// Time until every NPC keeps idling, in milliseconds of mTime
+    std::vector<TimePoint> mIdleEndTimes;
+
+    /// The way home of every returning NPC, nullptr while searching or without a path
+    std::vector<std::shared_ptr<const NavigationGrid::Path>> mPaths;
+
+    /// Index of the waypoint every returning NPC walks to
+    std::vector<uint32_t> mWaypoints;
+
+    /// Dense index of every NPC's entity in the current update
+    std::vector<uint32_t> mIndices;
+
+    /// Milliseconds simulated since the creation of the system
+    TimePoint mTime = 0;
+
+    /// Index of the NPC thinking next
+    uint32_t mThinkCursor = 0;
+
+    /// Maximum nanoseconds spent thinking per tick
+    uint64_t mThinkBudget;
+
+    /// Milliseconds elapsed since the current round of thinking started
+    TimePoint mRoundTime = 0;
+
+    /// Duration of the last complete round of thinking in milliseconds
+    TimePoint mLastRoundTime = 0;
+
+    /// State of the random number generator for patrol points and idle times
+    uint32_t mRandomState;
+
+    /// Positions of all players of the current tick, for the searches
+    std::vector<EntityId> mPlayerIds;
+    std::vector<float> mPlayerX;
+    std::vector<float> mPlayerZ;
+
+    /// Buffer for the results of the searches
+    std::vector<uint32_t> mCandidates;
+
+    /// Searches the ways home, nullptr to walk straight home
+    PathfindingService* mPathfinding = nullptr;
+
+    /**
+     * Looks up the dense indices of the entities, removes the NPCs whose entity was destroyed
+     */
+    void resolveEntities(EntityRegistry& entities);
+
+    /**
+     * Copies the positions of all players
+     */
+    void collectPlayers(EntityRegistry& entities);
+
+    /**
+     * Runs the state machines of the next NPCs until the budget is spent
+     */
+    void think(EntityRegistry& entities);
+
+    /**
+     * Runs the state machine of one NPC
+     * @param npc index of the NPC
+     */
+    void thinkNpc(EntityRegistry& entities, uint32_t npc);
+
+    /**
+     * Moves the goals of chasing NPCs to their targets and sets the velocities of all NPCs
+     * @param seconds duration of the tick
+     */
+    void steer(EntityRegistry& entities, float seconds);
+
+    /**
+     * @return the nearest player within the radius, INVALID_ENTITY if none
+     */
+    EntityId findNearestPlayer(float x, float z, float radius);
+
+    /**
+     * Sends a NPC home, along a path as soon as it's found
+     * @param x, z current position of the NPC
+     */
+    void returnHome(uint32_t npc, float x, float z);
+
+    /**
+     * Moves the goal of a returning NPC to the next waypoint of it's path when it arrived
+     * @param x, z current position of the NPC
+     */
+    void followPath(uint32_t npc, float x, float z);
+
+    /**
+     * @return pseudo random number between -1 and 1
+     */
+    float random();
+
+    /**
+     * Removes a NPC, moves the last one into it's place
+     */
+    void remove(uint32_t npc);
+
+public:
+    NpcSystem();
+
+    /**
+     * Creates a NPC at it's home, with full health
+     * @param x, y, z home position
+     * @return EntityId of the NPC, destroy it with EntityRegistry::destroy()
+     */
+    EntityId spawn(EntityRegistry& entities, float x, float y, float z);
+
+    /**
+     * Updates all NPCs, before the movement system
+     * @param difference milliseconds since the last update
+     */
+    void update(EntityRegistry& entities, TimePoint difference);
+
+    /**
+     * Pushes NPCs out of the boxes of the entities they overlap, after the movement
+     * @param pairs the overlapping entities found by the Broadphase
+     */
+    void separate(EntityRegistry& entities, const std::vector<Broadphase::Pair>& pairs);
+
+    /**
+     * Destroys all NPCs and starts the time and the random numbers from the beginning,
+     * so the same spawns behave the same again
+     */
+    void clear(EntityRegistry& entities);
+
+    /**
+     * @return number of NPCs
+     */
+    uint32_t size() { return (uint32_t)mEntities.size(); }
+
+    /**
+     * Sets the service searching the ways home, the results are delivered before update()
+     * @param pathfinding the service, nullptr to walk straight home
+     */
+    void setPathfinding(PathfindingService* pathfinding) { mPathfinding = pathfinding; }
+
+    /**
+     * Sets the maximum time spent thinking per tick
+     * @param budget nanoseconds
+     */
+    void setThinkBudget(uint64_t budget) { mThinkBudget = budget; }
+
+    /**
+     * @return milliseconds the last round of all NPCs thinking took,
+     *         how late a NPC reacts at most
+     */
+    TimePoint getThinkRoundTime() { return mLastRoundTime; }
+};
@@ -0,0 +1,259 @@
+#include "ObserverStream.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#include "Network/OpcodeHandler.h"
+#include "Network/Packet.h"
+#include "Network/PlayerSession.h"
+#include "utility/WorkerPool.h"
+
+/// Despawns, spawns, moves and properties per packet, far below the largest packet
+static const size_t const_maxFrameEntries = 1024;
+
+/// Viewers per job when sending a frame
+static const uint32_t const_viewerChunkSize = 256;
+
+ObserverStream::ObserverStream(EntityId target, uint64_t delay) : mTarget(target), mDelay(delay)
+{
+    // the viewers can't be asked how much they can take, they all receive the same
+    mScheduler.setBudget(UINT32_MAX);
+}
+
+bool ObserverStream::removeViewer(PlayerSession* viewer)
+{
+    bool removed = false;
+
+    auto remove = [viewer, &removed](std::vector<PlayerSession*>& viewers) {
+        auto iterator = std::find(viewers.begin(), viewers.end(), viewer);
+        if (iterator != viewers.end())
+        {
+            viewers.erase(iterator);
+            removed = true;
+        }
+    };
+
+    remove(mViewers);
+    remove(mWaitingViewers);
+
+    for (auto& frame : mFrames)
+        remove(frame.joiningViewers);
+
+    return removed;
+}
+
+bool ObserverStream::hasViewers()
+{
+    if (!mViewers.empty() || !mWaitingViewers.empty())
+        return true;
+
+    for (auto& frame : mFrames)
+    {
+        if (!frame.joiningViewers.empty())
+            return true;
+    }
+
+    return false;
+}
+
+void ObserverStream::collectViewers(std::vector<PlayerSession*>& viewers)
+{
+    viewers.insert(viewers.end(), mViewers.begin(), mViewers.end());
+    viewers.insert(viewers.end(), mWaitingViewers.begin(), mWaitingViewers.end());
+
+    for (auto& frame : mFrames)
+        viewers.insert(viewers.end(), frame.joiningViewers.begin(), frame.joiningViewers.end());
+}
+
+void ObserverStream::record(uint32_t tick, uint64_t time, EntityRegistry& entities, const ReplicationScheduler::Settings& settings,
+                            float aoiRadius, const ReplicationScheduler::MessageSizes& sizes, bool sweep)
+{
+    mSettings = settings;
+
+    if (mTarget == INVALID_ENTITY)
+    {
+        // the whole Zone, everything at full rate
+        mSettings.lodBands.clear();
+        aoiRadius = FLT_MAX;
+    }
+    else
+    {
+        uint32_t index = entities.getIndex(mTarget);
+        if (index != UINT32_MAX)
+        {
+            mTargetX = entities.getPositionX()[index];
+            mTargetZ = entities.getPositionZ()[index];
+        }
+    }
+
+    const uint32_t* dirty = entities.getDirty();
+    const float* positionX = entities.getPositionX();
+    const float* positionZ = entities.getPositionZ();
+    float squaredAoiRadius = aoiRadius * aoiRadius;
+
+    // a keyframe holds the entities standing still as well
+    sweep = sweep || !mWaitingViewers.empty();
+
+    mCandidates.clear();
+    for (uint32_t index = 0; index < entities.size(); index++)
+    {
+        if (!sweep && (dirty[index] & (EntityRegistry::DIRTY_POSITION | EntityRegistry::DIRTY_PROPERTIES)) == 0)
+            continue;
+
+        float dx = positionX[index] - mTargetX;
+        float dz = positionZ[index] - mTargetZ;
+
+        if (dx*dx + dz*dz <= squaredAoiRadius)
+            mCandidates.push_back(index);
+    }
+
+    // the observed entity itself is seen too, unlike by it's own player
+    mScheduler.begin(tick, time, (uint32_t)mCandidates.size());
+
+    for (uint32_t index : mCandidates)
+        mScheduler.addUpdate(entities.getIds()[index]);
+
+    mScheduler.schedule(entities, mSettings, mTargetX, mTargetZ, aoiRadius, 0, 1, sizes, 0);
+
+    Frame frame;
+    frame.time = time;
+
+    encode(tick, entities, mScheduler.getDespawns(), mScheduler.getSpawns(), mScheduler.getSelection(), mScheduler.getPropertyUpdates(),
+           frame.packets);
+
+    if (!mWaitingViewers.empty())
+    {
+        mKnownEntities.clear();
+        mScheduler.collectReceived(mKnownEntities);
+
+        ReplicatedProperties::Mask publicProperties = ReplicatedProperties::getMask(ReplicatedProperties::Audience::EVERYONE);
+
+        mKnownProperties.clear();
+        for (uint32_t index : mKnownEntities)
+            mKnownProperties.push_back({index, publicProperties});
+
+        encode(tick, entities, std::vector<EntityId>(), mKnownEntities, mKnownEntities, mKnownProperties, frame.keyframePackets);
+        frame.joiningViewers.swap(mWaitingViewers);
+    }
+
+    if (!frame.packets.empty() || !frame.joiningViewers.empty())
+        mFrames.push_back(std::move(frame));
+}
+
+uint32_t ObserverStream::send(uint64_t time)
+{
+    uint32_t packetCount = 0;
+
+    while (!mFrames.empty() && time - mFrames.front().time >= mDelay)
+    {
+        Frame& frame = mFrames.front();
+
+        if (!frame.packets.empty())
+            sendToViewers(frame.packets);
+
+        // the keyframe already contains the changes of it's tick
+        for (auto viewer : frame.joiningViewers)
+        {
+            for (auto& packet : frame.keyframePackets)
+                viewer->sendPacket(packet);
+
+            mViewers.push_back(viewer);
+        }
+
+        packetCount += (uint32_t)(frame.packets.size() * mViewers.size() + frame.keyframePackets.size() * frame.joiningViewers.size());
+        mFrames.pop_front();
+    }
+
+    return packetCount;
+}
+
+void ObserverStream::sendToViewers(const std::vector<std::shared_ptr<Packet>>& packets)
+{
+    uint32_t viewerCount = (uint32_t)mViewers.size();
+
+    auto sendChunk = [this, &packets, viewerCount](uint32_t chunk) {
+        uint32_t end = std::min(viewerCount, (chunk + 1) * const_viewerChunkSize);
+
+        for (uint32_t viewer = chunk * const_viewerChunkSize; viewer < end; viewer++)
+        {
+            for (auto& packet : packets)
+                mViewers[viewer]->sendPacket(packet);
+        }
+    };
+
+    uint32_t chunkCount = (viewerCount + const_viewerChunkSize - 1) / const_viewerChunkSize;
+
+    if (chunkCount <= 1 || sWorkerPool == nullptr)
+    {
+        for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+            sendChunk(chunk);
+    }
+    else
+    {
+        sWorkerPool->parallelFor(chunkCount, sendChunk);
+    }
+}
+
+void ObserverStream::encode(uint32_t tick, EntityRegistry& entities, const std::vector<EntityId>& despawns, const std::vector<uint32_t>& spawns,
+                            const std::vector<uint32_t>& moves, const std::vector<ReplicationScheduler::PropertyUpdate>& properties,
+                            std::vector<std::shared_ptr<Packet>>& packets)
+{
+    const EntityId* ids = entities.getIds();
+    size_t despawn = 0;
+    size_t spawn = 0;
+    size_t move = 0;
+    size_t property = 0;
+
+    while (despawn < despawns.size() || spawn < spawns.size() || move < moves.size() || property < properties.size())
+    {
+        // every packet is filled with the despawns first, then the spawns, the moves and the properties
+        size_t space = const_maxFrameEntries;
+        size_t despawnEnd = despawn + std::min(space, despawns.size() - despawn);
+        space -= despawnEnd - despawn;
+        size_t spawnEnd = spawn + std::min(space, spawns.size() - spawn);
+        space -= spawnEnd - spawn;
+        size_t moveEnd = move + std::min(space, moves.size() - move);
+        space -= moveEnd - move;
+        size_t propertyEnd = property + std::min(space, properties.size() - property);
+
+        std::shared_ptr<Packet> packet = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_OBSERVER_FRAME);
+        packet->setTick(tick);
+
+        *packet << (uint16_t)(despawnEnd - despawn);
+        for (; despawn < despawnEnd; despawn++)
+            *packet << despawns[despawn];
+
+        *packet << (uint16_t)(spawnEnd - spawn);
+        for (; spawn < spawnEnd; spawn++)
+        {
+            uint32_t index = spawns[spawn];
+            *packet << ids[index];
+            *packet << (uint8_t)entities.getTypes()[index];
+            *packet << entities.getExtents()[index];
+        }
+
+        *packet << (uint16_t)(moveEnd - move);
+        for (; move < moveEnd; move++)
+        {
+            uint32_t index = moves[move];
+            *packet << ids[index];
+            *packet << entities.getPositionX()[index];
+            *packet << entities.getPositionY()[index];
+            *packet << entities.getPositionZ()[index];
+            *packet << entities.getVelocityX()[index];
+            *packet << entities.getVelocityY()[index];
+            *packet << entities.getVelocityZ()[index];
+        }
+
+        *packet << (uint16_t)(propertyEnd - property);
+        for (; property < propertyEnd; property++)
+        {
+            const ReplicationScheduler::PropertyUpdate& update = properties[property];
+            *packet << ids[update.index];
+            *packet << update.mask;
+            ReplicatedProperties::write(*packet, entities, update.index, update.mask);
+        }
+
+        packets.push_back(std::move(packet));
+    }
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "EntityRegistry.h"
+#include "ReplicationScheduler.h"
+
+class Packet;
+class PlayerSession;
+
+/**
+ * @brief What the observers of a Zone or of an entity see, e.g. spectators of a match
+ *
+ * Observers (viewers) are PlayerSessions, which don't need an entity or a Zone
+ * of their own, a spectator only sends CS_OBSERVE (see Connection). All
+ * viewers of a target share one stream: the updates are scheduled once per tick
+ * for the target, as if it was a player (see ReplicationScheduler), and encoded
+ * once into frames (SC_OBSERVER_FRAME). Every viewer is sent the same packets,
+ * so a viewer only costs passing on the packets, which is spread over the WorkerPool.
+ *
+ * The target is either the whole Zone or the view of an entity, i.e. it's area
+ * of interest. When the entity disappears, the stream keeps showing the place
+ * it was seen last. Entities standing still are found by the periodic sweep
+ * of the Zone, like for the players, and for every keyframe.
+ *
+ * The frames can be held back for a delay, e.g. for tournaments, so the
+ * players can't watch their opponents. Viewers joining the stream wait for
+ * the next keyframe, which holds everything known at the end of it's tick,
+ * and then receive the frames after it.
+ *
+ * @remark not thread-safe, used by the Zone thread
+ */
+class ObserverStream
+{
+    /**
+     * The encoded changes of a tick
+     */
+    struct Frame
+    {
+        /// milliseconds the Zone simulated when the frame was recorded
+        uint64_t time;
+
+        /// despawns, spawns, moves and properties of the tick, for the viewers which joined before
+        std::vector<std::shared_ptr<Packet>> packets;
+
+        /// spawns, moves and public properties of every entity known at the end of the tick, empty if no viewer joins
+        std::vector<std::shared_ptr<Packet>> keyframePackets;
+
+        /// the viewers starting with this frame
+        std::vector<PlayerSession*> joiningViewers;
+    };
+
+    /// the observed entity, INVALID_ENTITY for the whole Zone
+    EntityId mTarget;
+
+    /// milliseconds the frames are held back
+    uint64_t mDelay;
+
+    /// position the target was seen last
+    float mTargetX = 0.f;
+    float mTargetZ = 0.f;
+
+    /// decides what the viewers receive, like for a player at the target
+    ReplicationScheduler mScheduler;
+
+    /// settings of the Zone, without LOD bands when observing the whole Zone
+    ReplicationScheduler::Settings mSettings;
+
+    /// frames held back, oldest first
+    std::deque<Frame> mFrames;
+
+    /// viewers receiving the frames
+    std::vector<PlayerSession*> mViewers;
+
+    /// viewers waiting for the next recorded keyframe
+    std::vector<PlayerSession*> mWaitingViewers;
+
+    /// dense indices of the entities which moved or changed near the target in the current tick, all near ones during a sweep
+    std::vector<uint32_t> mCandidates;
+
+    /// dense indices of the entities in the keyframe of the current tick
+    std::vector<uint32_t> mKnownEntities;
+
+    /// public properties of the entities in the keyframe of the current tick
+    std::vector<ReplicationScheduler::PropertyUpdate> mKnownProperties;
+
+    /**
+     * Encodes changes into SC_OBSERVER_FRAME packets, split when they get too large
+     * @param tick number of the tick
+     * @param entities the entities of the Zone
+     * @param despawns entities disappearing
+     * @param spawns dense indices of the entities appearing
+     * @param moves dense indices of the entities with their position and velocity
+     * @param properties entities with the properties to send
+     * @param packets receives the packets
+     */
+    static void encode(uint32_t tick, EntityRegistry& entities, const std::vector<EntityId>& despawns, const std::vector<uint32_t>& spawns,
+                       const std::vector<uint32_t>& moves, const std::vector<ReplicationScheduler::PropertyUpdate>& properties,
+                       std::vector<std::shared_ptr<Packet>>& packets);
+
+    /**
+     * Sends packets to all viewers, in parallel on the WorkerPool when there are many
+     */
+    void sendToViewers(const std::vector<std::shared_ptr<Packet>>& packets);
+
+public:
+    /**
+     * Creates a stream without viewers
+     * @param target the observed entity, INVALID_ENTITY for the whole Zone
+     * @param delay milliseconds the frames are held back
+     */
+    ObserverStream(EntityId target, uint64_t delay);
+
+    /**
+     * @return the observed entity, INVALID_ENTITY for the whole Zone
+     */
+    EntityId getTarget() { return mTarget; }
+
+    /**
+     * @return milliseconds the frames are held back
+     */
+    uint64_t getDelay() { return mDelay; }
+
+    /**
+     * Adds a viewer, it's sent the frames starting with the next keyframe
+     */
+    void addViewer(PlayerSession* viewer) { mWaitingViewers.push_back(viewer); }
+
+    /**
+     * Removes a viewer, no matter if it's waiting for it's keyframe
+     * @return true if the session was a viewer of this stream
+     */
+    bool removeViewer(PlayerSession* viewer);
+
+    /**
+     * @return true if the stream has viewers, including the waiting ones
+     */
+    bool hasViewers();
+
+    /**
+     * Collects all viewers, including the waiting ones
+     * @param viewers receives the viewers
+     */
+    void collectViewers(std::vector<PlayerSession*>& viewers);
+
+    /**
+     * Schedules and encodes the changes of the tick, see ReplicationScheduler::schedule()
+     * @param tick number of the tick of the Zone
+     * @param time milliseconds the Zone simulated
+     * @param entities the entities of the Zone
+     * @param settings LOD bands and extrapolation error of the Zone
+     * @param aoiRadius radius of the area of interest of an entity
+     * @param sizes bytes of the messages
+     * @param sweep true if all entities are considered, not only the changed ones, so the viewers notice those standing still
+     */
+    void record(uint32_t tick, uint64_t time, EntityRegistry& entities, const ReplicationScheduler::Settings& settings,
+                float aoiRadius, const ReplicationScheduler::MessageSizes& sizes, bool sweep);
+
+    /**
+     * Sends the frames which were held back long enough to the viewers
+     * @param time milliseconds the Zone simulated
+     * @return number of packets sent
+     */
+    uint32_t send(uint64_t time);
+};
@@ -0,0 +1,159 @@
+#include "PathfindingService.h"
+
+#include "Metrics/Metrics.h"
+#include "utility/utility.h"
+
+/// Maximum number of cached paths
+static const size_t const_cacheCapacity = 1024;
+
+PathfindingService::PathfindingService() :
+        mSearchCount(sMetrics->get("pathfinding.searches")),
+        mCacheHitCount(sMetrics->get("pathfinding.cache_hits")),
+        mFailureCount(sMetrics->get("pathfinding.failures"))
+{
+}
+
+PathfindingService::~PathfindingService()
+{
+    if (sWorkerPool != nullptr)
+        sWorkerPool->wait(mJobs);
+}
+
+void PathfindingService::setGrid(std::shared_ptr<const NavigationGrid> grid)
+{
+    // results of the old grid must not end up in the cache
+    if (sWorkerPool != nullptr)
+        sWorkerPool->wait(mJobs);
+
+    update();
+
+    mGrid = std::move(grid);
+    mCache.clear();
+    mCacheIndex.clear();
+}
+
+void PathfindingService::findPath(float startX, float startZ, float endX, float endZ, Callback callback)
+{
+    NavigationGrid::CellIndex start;
+    NavigationGrid::CellIndex end;
+
+    if (!mGrid || !mGrid->findCell(startX, startZ, start) || !mGrid->findCell(endX, endZ, end))
+    {
+        mFailureCount++;
+        mReadyResults.emplace_back(std::move(callback), nullptr);
+        return;
+    }
+
+    // unique, grids have less than 2^32 cells
+    uint64_t cacheKey = start * mGrid->getCellCount() + end;
+
+    std::shared_ptr<const NavigationGrid::Path> path = findInCache(cacheKey);
+    if (path)
+    {
+        mCacheHitCount++;
+        mReadyResults.emplace_back(std::move(callback), std::move(path));
+        return;
+    }
+
+    uint32_t requestId = mNextRequestId++;
+    mPendingRequests[requestId] = {std::move(callback), cacheKey, getTimeNanoseconds()};
+
+    std::shared_ptr<const NavigationGrid> grid = mGrid;
+    auto search = [this, grid, start, end, requestId]() {
+        std::shared_ptr<NavigationGrid::Path> path = std::make_shared<NavigationGrid::Path>();
+
+        if (!grid->findPath(start, end, *path))
+            path.reset();
+
+        mResults.enqueue({requestId, std::move(path)});
+    };
+
+    mSearchCount++;
+
+    if (sWorkerPool != nullptr)
+        sWorkerPool->spawn(mJobs, search);
+    else
+        search();
+}
+
+void PathfindingService::update()
+{
+    // callbacks may request new paths, those are delivered by the next update
+    std::vector<std::pair<Callback, std::shared_ptr<const NavigationGrid::Path>>> readyResults;
+    readyResults.swap(mReadyResults);
+
+    for (auto& result : readyResults)
+        result.first(result.second);
+
+    uint64_t currentTime = getTimeNanoseconds();
+
+    Result result;
+    while (mResults.try_dequeue(result))
+    {
+        auto iterator = mPendingRequests.find(result.requestId);
+
+        // dropped by reset()
+        if (iterator == mPendingRequests.end())
+            continue;
+
+        Request request = std::move(iterator->second);
+        mPendingRequests.erase(iterator);
+
+        mLatency.record((currentTime - request.submitTime) / 1000);
+
+        if (result.path)
+            insertIntoCache(request.cacheKey, result.path);
+        else
+            mFailureCount++;
+
+        request.callback(result.path);
+    }
+}
+
+void PathfindingService::reset()
+{
+    if (sWorkerPool != nullptr)
+        sWorkerPool->wait(mJobs);
+
+    Result result;
+    while (mResults.try_dequeue(result));
+
+    mPendingRequests.clear();
+    mReadyResults.clear();
+    mCache.clear();
+    mCacheIndex.clear();
+    mGrid.reset();
+    mLatency.reset();
+}
+
+void PathfindingService::insertIntoCache(uint64_t cacheKey, std::shared_ptr<const NavigationGrid::Path> path)
+{
+    // the same route may have been searched twice at once
+    auto iterator = mCacheIndex.find(cacheKey);
+    if (iterator != mCacheIndex.end())
+    {
+        mCache.splice(mCache.begin(), mCache, iterator->second);
+        return;
+    }
+
+    if (mCache.size() >= const_cacheCapacity)
+    {
+        mCacheIndex.erase(mCache.back().first);
+        mCache.pop_back();
+    }
+
+    mCache.emplace_front(cacheKey, std::move(path));
+    mCacheIndex[cacheKey] = mCache.begin();
+}
+
+std::shared_ptr<const NavigationGrid::Path> PathfindingService::findInCache(uint64_t cacheKey)
+{
+    auto iterator = mCacheIndex.find(cacheKey);
+    if (iterator == mCacheIndex.end())
+        return nullptr;
+
+    // move to the front, it's the most recently used now
+    mCache.splice(mCache.begin(), mCache, iterator->second);
+
+    return iterator->second->second;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "concurrentqueue/concurrentqueue.h"
+
+#include "NavigationGrid.h"
+#include "utility/Histogram.h"
+#include "utility/WorkerPool.h"
+
+/**
+ * @brief Finds paths for a Zone without blocking it's tick
+ *
+ * The Zone submits requests, which are searched on the NavigationGrid of the
+ * Zone by jobs of the WorkerPool. The results are delivered by update() on a
+ * later tick, in the Zone thread.
+ *
+ * Found paths are kept in a LRU cache keyed by the start and end cell, so
+ * repeated routes (e.g. NPCs returning to the same spawn) don't search again.
+ *
+ * @remark not thread-safe, used by the Zone thread
+ */
+class PathfindingService
+{
+public:
+    /**
+     * Receives the result of a request
+     * @param path the found path, nullptr if there's none
+     */
+    typedef std::function<void(std::shared_ptr<const NavigationGrid::Path> path)> Callback;
+
+private:
+    /**
+     * A request waiting for it's search
+     */
+    struct Request
+    {
+        Callback callback;
+        uint64_t cacheKey;
+        /// getTimeNanoseconds() at submission
+        uint64_t submitTime;
+    };
+
+    /**
+     * The outcome of a search, passed from the worker to the Zone thread
+     */
+    struct Result
+    {
+        uint32_t requestId;
+        std::shared_ptr<const NavigationGrid::Path> path;
+    };
+
+    /// LRU list of cached paths by cache key, most recently used first
+    typedef std::list<std::pair<uint64_t, std::shared_ptr<const NavigationGrid::Path>>> CacheList;
+
+    /// The grid searched, nullptr if none, every path fails then
+    std::shared_ptr<const NavigationGrid> mGrid;
+
+    /// Id of the next request
+    uint32_t mNextRequestId = 0;
+
+    /// Requests searched by the workers, by id
+    std::unordered_map<uint32_t, Request> mPendingRequests;
+
+    /// Results known at submission (cache hits, invalid requests), delivered by the next update()
+    std::vector<std::pair<Callback, std::shared_ptr<const NavigationGrid::Path>>> mReadyResults;
+
+    /// Results of the workers
+    moodycamel::ConcurrentQueue<Result> mResults;
+
+    /// All running searches
+    WorkerPool::JobGroup mJobs;
+
+    CacheList mCache;
+    std::unordered_map<uint64_t, CacheList::iterator> mCacheIndex;
+
+    /// Microseconds from submission to delivery of searched paths
+    Histogram mLatency;
+
+    std::atomic<int64_t>& mSearchCount;
+    std::atomic<int64_t>& mCacheHitCount;
+    std::atomic<int64_t>& mFailureCount;
+
+    /**
+     * Stores a path in the cache, dropping the least recently used one if full
+     */
+    void insertIntoCache(uint64_t cacheKey, std::shared_ptr<const NavigationGrid::Path> path);
+
+    /**
+     * @return the cached path, nullptr if not cached
+     */
+    std::shared_ptr<const NavigationGrid::Path> findInCache(uint64_t cacheKey);
+
+public:
+    PathfindingService();
+
+    /**
+     * Waits for the running searches
+     */
+    ~PathfindingService();
+
+    /**
+     * Sets the grid to search, waits for running searches and clears the cache
+     * @param grid the grid, nullptr for none
+     */
+    void setGrid(std::shared_ptr<const NavigationGrid> grid);
+
+    /**
+     * @return the grid searched, nullptr if none
+     */
+    const std::shared_ptr<const NavigationGrid>& getGrid() { return mGrid; }
+
+    /**
+     * Requests a path, the callback is called by a later update()
+     * @param startX, startZ start position
+     * @param endX, endZ destination
+     * @param callback receives the path
+     */
+    void findPath(float startX, float startZ, float endX, float endZ, Callback callback);
+
+    /**
+     * Delivers the finished requests
+     */
+    void update();
+
+    /**
+     * Drops all requests, without calling their callbacks, and the grid
+     */
+    void reset();
+
+    /**
+     * @return true if a request wasn't delivered yet
+     */
+    bool hasRequests() { return !mPendingRequests.empty() || !mReadyResults.empty(); }
+
+    /**
+     * @return the latency of searched paths in microseconds
+     */
+    Histogram& getLatency() { return mLatency; }
+};
@@ -0,0 +1,215 @@
+#include "PositionHistory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "utility/SimdKernels.h"
+
+/// Slots per frame allocated at least
+static const uint32_t const_minCapacity = 64;
+
+PositionHistory::PositionHistory()
+{
+    mTicks.resize(mSettings.frameCount, 0);
+    mSlotCounts.resize(mSettings.frameCount, 0);
+}
+
+void PositionHistory::setSettings(const Settings& settings)
+{
+    mSettings = settings;
+    mSettings.frameCount = std::max(mSettings.frameCount, 1u);
+    clear();
+}
+
+void PositionHistory::clear()
+{
+    mCapacity = 0;
+    std::vector<EntityId>().swap(mIds);
+    std::vector<float>().swap(mPositionX);
+    std::vector<float>().swap(mPositionY);
+    std::vector<float>().swap(mPositionZ);
+    std::vector<float>().swap(mQueryX);
+    std::vector<float>().swap(mQueryZ);
+    std::vector<uint32_t>().swap(mQuerySlots);
+
+    mTicks.assign(mSettings.frameCount, 0);
+    mSlotCounts.assign(mSettings.frameCount, 0);
+    mNewestFrame = 0;
+    mFrameCount = 0;
+}
+
+void PositionHistory::grow(uint32_t slotCount)
+{
+    uint32_t capacity = std::max(mCapacity, const_minCapacity);
+    while (capacity < slotCount)
+        capacity *= 2;
+    capacity = std::min(capacity, std::max(mSettings.maxSlots, slotCount));
+
+    size_t size = (size_t)mSettings.frameCount * capacity;
+    std::vector<EntityId> ids(size, INVALID_ENTITY);
+    std::vector<float> positionX(size, std::numeric_limits<float>::quiet_NaN());
+    std::vector<float> positionY(size, 0.f);
+    std::vector<float> positionZ(size, 0.f);
+
+    for (uint32_t frame = 0; frame < mSettings.frameCount && mCapacity > 0; frame++)
+    {
+        size_t from = (size_t)frame * mCapacity;
+        size_t to = (size_t)frame * capacity;
+
+        std::copy(mIds.begin() + from, mIds.begin() + from + mCapacity, ids.begin() + to);
+        std::copy(mPositionX.begin() + from, mPositionX.begin() + from + mCapacity, positionX.begin() + to);
+        std::copy(mPositionY.begin() + from, mPositionY.begin() + from + mCapacity, positionY.begin() + to);
+        std::copy(mPositionZ.begin() + from, mPositionZ.begin() + from + mCapacity, positionZ.begin() + to);
+    }
+
+    mIds.swap(ids);
+    mPositionX.swap(positionX);
+    mPositionY.swap(positionY);
+    mPositionZ.swap(positionZ);
+    mCapacity = capacity;
+
+    mQueryX.resize(capacity);
+    mQueryZ.resize(capacity);
+    mQuerySlots.resize(capacity);
+}
+
+void PositionHistory::record(uint32_t tick, EntityRegistry& entities)
+{
+    // a gap would make interpolating between neighbouring frames wrong
+    if (mFrameCount > 0 && tick != getNewestTick() + 1)
+        mFrameCount = 0;
+
+    uint32_t slotCount = std::min(entities.getSlotCount(), mSettings.maxSlots);
+    if (slotCount > mCapacity)
+        grow(slotCount);
+
+    uint32_t frame = mFrameCount == 0 ? 0 : (mNewestFrame + 1) % mSettings.frameCount;
+    size_t offset = (size_t)frame * mCapacity;
+
+    EntityId* ids = mIds.data() + offset;
+    float* positionX = mPositionX.data() + offset;
+    float* positionY = mPositionY.data() + offset;
+    float* positionZ = mPositionZ.data() + offset;
+
+    // free slots stay empty, NaN is never within a radius
+    std::fill(ids, ids + slotCount, INVALID_ENTITY);
+    std::fill(positionX, positionX + slotCount, std::numeric_limits<float>::quiet_NaN());
+
+    const EntityId* entityIds = entities.getIds();
+    const float* entityX = entities.getPositionX();
+    const float* entityY = entities.getPositionY();
+    const float* entityZ = entities.getPositionZ();
+
+    for (uint32_t index = 0; index < entities.size(); index++)
+    {
+        uint32_t slot = EntityRegistry::getSlot(entityIds[index]);
+        if (slot >= slotCount)
+            continue;
+
+        ids[slot] = entityIds[index];
+        positionX[slot] = entityX[index];
+        positionY[slot] = entityY[index];
+        positionZ[slot] = entityZ[index];
+    }
+
+    mTicks[frame] = tick;
+    mSlotCounts[frame] = slotCount;
+    mNewestFrame = frame;
+    mFrameCount = std::min(mFrameCount + 1, mSettings.frameCount);
+}
+
+uint32_t PositionHistory::findFrame(uint32_t tick)
+{
+    if (mFrameCount == 0)
+        return UINT32_MAX;
+
+    uint32_t age = getNewestTick() - tick;
+    if (age >= mFrameCount)
+        return UINT32_MAX;
+
+    return (mNewestFrame + mSettings.frameCount - age) % mSettings.frameCount;
+}
+
+bool PositionHistory::getPosition(EntityId id, uint32_t tick, float fraction, float& x, float& y, float& z)
+{
+    uint32_t frame = findFrame(tick);
+    if (frame == UINT32_MAX)
+        return false;
+
+    uint32_t slot = EntityRegistry::getSlot(id);
+    size_t index = (size_t)frame * mCapacity + slot;
+    if (slot >= mSlotCounts[frame] || mIds[index] != id)
+        return false;
+
+    x = mPositionX[index];
+    y = mPositionY[index];
+    z = mPositionZ[index];
+
+    if (fraction <= 0.f || frame == mNewestFrame)
+        return true;
+
+    uint32_t nextFrame = (frame + 1) % mSettings.frameCount;
+    size_t nextIndex = (size_t)nextFrame * mCapacity + slot;
+
+    // the entity was destroyed in the next tick, stays at it's last position
+    if (slot >= mSlotCounts[nextFrame] || mIds[nextIndex] != id)
+        return true;
+
+    fraction = std::min(fraction, 1.f);
+    x += (mPositionX[nextIndex] - x) * fraction;
+    y += (mPositionY[nextIndex] - y) * fraction;
+    z += (mPositionZ[nextIndex] - z) * fraction;
+    return true;
+}
+
+bool PositionHistory::findWithinRadius(uint32_t tick, float fraction, float x, float z, float radius,
+                                       std::vector<EntityId>& result)
+{
+    result.clear();
+
+    uint32_t frame = findFrame(tick);
+    if (frame == UINT32_MAX)
+        return false;
+
+    uint32_t slotCount = mSlotCounts[frame];
+    size_t offset = (size_t)frame * mCapacity;
+    const EntityId* ids = mIds.data() + offset;
+    const float* positionX = mPositionX.data() + offset;
+    const float* positionZ = mPositionZ.data() + offset;
+
+    if (fraction > 0.f && frame != mNewestFrame)
+    {
+        uint32_t nextFrame = (frame + 1) % mSettings.frameCount;
+        size_t nextOffset = (size_t)nextFrame * mCapacity;
+        uint32_t nextSlotCount = mSlotCounts[nextFrame];
+        fraction = std::min(fraction, 1.f);
+
+        for (uint32_t slot = 0; slot < slotCount; slot++)
+        {
+            float fromX = positionX[slot];
+            float fromZ = positionZ[slot];
+
+            if (slot < nextSlotCount && mIds[nextOffset + slot] == ids[slot])
+            {
+                fromX += (mPositionX[nextOffset + slot] - fromX) * fraction;
+                fromZ += (mPositionZ[nextOffset + slot] - fromZ) * fraction;
+            }
+
+            mQueryX[slot] = fromX;
+            mQueryZ[slot] = fromZ;
+        }
+
+        positionX = mQueryX.data();
+        positionZ = mQueryZ.data();
+    }
+
+    uint32_t count = SimdKernels::filterWithinRadius(slotCount, positionX, positionZ, x, z, radius * radius,
+                                                     mQuerySlots.data());
+
+    result.reserve(count);
+    for (uint32_t index = 0; index < count; index++)
+        result.push_back(ids[mQuerySlots[index]]);
+
+    return true;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "EntityRegistry.h"
+
+/**
+ * @brief The positions of all entities of a Zone during the last ticks, for lag compensation
+ *
+ * When a player acts (e.g. shoots), it sees the others where they were some
+ * ticks ago. Hits are validated against the positions of that time, rewound
+ * with this history.
+ *
+ * The history is a ring buffer of frames, one per tick. Every frame stores the
+ * positions as structure of arrays, indexed by the slot of the entity (see
+ * EntityRegistry::getSlot()), so looking up an entity is a single access.
+ * The buffers only grow when the Zone gets more entities, never per tick.
+ * The memory is limited by the number of frames and the maximum number of slots.
+ *
+ * @remark not thread-safe, used by the Zone thread
+ */
+class PositionHistory
+{
+public:
+    struct Settings
+    {
+        /// Number of ticks kept
+        uint32_t frameCount = 32;
+
+        /// Entities with a higher slot are not recorded
+        uint32_t maxSlots = 65536;
+    };
+
+private:
+    Settings mSettings;
+
+    /// Slots per frame in the buffers
+    uint32_t mCapacity = 0;
+
+    /// Entity of every slot of every frame, INVALID_ENTITY for empty slots
+    std::vector<EntityId> mIds;
+
+    /// Position of every slot of every frame, NaN for empty slots
+    std::vector<float> mPositionX;
+    std::vector<float> mPositionY;
+    std::vector<float> mPositionZ;
+
+    /// Tick and number of used slots of every frame
+    std::vector<uint32_t> mTicks;
+    std::vector<uint32_t> mSlotCounts;
+
+    /// Frame of the newest tick
+    uint32_t mNewestFrame = 0;
+
+    /// Number of recorded frames, at most frameCount
+    uint32_t mFrameCount = 0;
+
+    /// Interpolated positions of a radius query
+    std::vector<float> mQueryX;
+    std::vector<float> mQueryZ;
+    std::vector<uint32_t> mQuerySlots;
+
+    /**
+     * Grows the buffers for more slots per frame, keeps the recorded frames
+     */
+    void grow(uint32_t slotCount);
+
+    /**
+     * @return the frame of a tick, UINT32_MAX if it's not recorded
+     */
+    uint32_t findFrame(uint32_t tick);
+
+public:
+    PositionHistory();
+
+    /**
+     * Changes the limits, clears the history
+     */
+    void setSettings(const Settings& settings);
+    const Settings& getSettings() { return mSettings; }
+
+    /**
+     * Forgets all recorded ticks and releases the memory
+     */
+    void clear();
+
+    /**
+     * Records the positions of all entities, replaces the oldest tick when full
+     * @param tick number of the tick, increasing by one every tick
+     */
+    void record(uint32_t tick, EntityRegistry& entities);
+
+    /**
+     * Finds the position of an entity in the past
+     * @param id the entity
+     * @param tick the tick
+     * @param fraction time between tick and the next tick, 0 to 1, for interpolation
+     * @param x, y, z receive the position
+     * @return false if the entity or the tick is not recorded
+     */
+    bool getPosition(EntityId id, uint32_t tick, float fraction, float& x, float& y, float& z);
+
+    /**
+     * Finds the entities which were near a position in the past
+     * @param tick the tick
+     * @param fraction time between tick and the next tick, 0 to 1, for interpolation
+     * @param x, z center on the ground plane
+     * @param radius the radius
+     * @param result receives the entities, in slot order
+     * @return false if the tick is not recorded
+     */
+    bool findWithinRadius(uint32_t tick, float fraction, float x, float z, float radius, std::vector<EntityId>& result);
+
+    /**
+     * @return true if ticks are recorded, the range is [getOldestTick(), getNewestTick()]
+     */
+    bool isEmpty() { return mFrameCount == 0; }
+    uint32_t getNewestTick() { return mTicks[mNewestFrame]; }
+    uint32_t getOldestTick() { return mTicks[mNewestFrame] - (mFrameCount - 1); }
+
+    /**
+     * @return bytes used by the buffers
+     */
+    size_t getMemoryUsage() { return (size_t)mSettings.frameCount * mCapacity * (sizeof(EntityId) + 3 * sizeof(float)); }
+};
@@ -0,0 +1,101 @@
+#include "ReplicatedProperties.h"
+
+#include <cstring>
+
+#include "EntityRegistry.h"
+#include "Network/ByteBuffer.h"
+
+/**
+ * The metadata of a property at runtime, for walking the bits of a mask
+ */
+struct PropertyInfo
+{
+    uint32_t size;
+    ReplicatedProperties::Audience audience;
+};
+
+template <ReplicatedProperties::Property P>
+static PropertyInfo describe()
+{
+    typedef typename ReplicatedProperties::Traits<P>::Type Type;
+    static_assert(sizeof(Type) == 1 || sizeof(Type) == 2 || sizeof(Type) == 4, "ReplicatedProperties: unsupported size");
+
+    return {sizeof(Type), ReplicatedProperties::Traits<P>::audience};
+}
+
+/// By Property
+static const PropertyInfo const_properties[] = {
+    describe<ReplicatedProperties::HEALTH>(),
+    describe<ReplicatedProperties::MAX_HEALTH>(),
+    describe<ReplicatedProperties::STATE_FLAGS>(),
+    describe<ReplicatedProperties::WEAPON>(),
+    describe<ReplicatedProperties::ARMOR>(),
+    describe<ReplicatedProperties::MANA>(),
+};
+
+static_assert(sizeof(const_properties) / sizeof(PropertyInfo) == ReplicatedProperties::COUNT, "ReplicatedProperties: a Property is not described");
+static_assert(ReplicatedProperties::COUNT <= sizeof(ReplicatedProperties::Mask) * 8, "ReplicatedProperties: too many properties for the Mask");
+
+uint32_t ReplicatedProperties::getSize(Property property)
+{
+    return const_properties[property].size;
+}
+
+uint32_t ReplicatedProperties::getSize(Mask mask)
+{
+    uint32_t size = 0;
+
+    for (uint32_t property = 0; property < COUNT; property++)
+    {
+        if ((mask & (1u << property)) != 0)
+            size += const_properties[property].size;
+    }
+
+    return size;
+}
+
+ReplicatedProperties::Mask ReplicatedProperties::getMask(Audience audience)
+{
+    Mask mask = 0;
+
+    for (uint32_t property = 0; property < COUNT; property++)
+    {
+        if (const_properties[property].audience == audience)
+            mask |= 1u << property;
+    }
+
+    return mask;
+}
+
+void ReplicatedProperties::write(ByteBuffer& buffer, const EntityRegistry& entities, uint32_t index, Mask mask)
+{
+    for (uint32_t property = 0; property < COUNT; property++)
+    {
+        if ((mask & (1u << property)) == 0)
+            continue;
+
+        uint32_t size = const_properties[property].size;
+        const uint8_t* value = entities.getPropertyValues((Property)property) + index * size;
+
+        switch (size)
+        {
+            case 1:
+                buffer << value[0];
+                break;
+            case 2:
+            {
+                uint16_t number;
+                std::memcpy(&number, value, sizeof(number));
+                buffer << number;
+                break;
+            }
+            case 4:
+            {
+                uint32_t number;
+                std::memcpy(&number, value, sizeof(number));
+                buffer << number;
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+
+class ByteBuffer;
+class EntityRegistry;
+
+/**
+ * @brief The properties of entities replicated to the players besides their movement, e.g. health
+ *
+ * Every property is declared once below with it's replication metadata (see
+ * Traits): the type of it's value and who may see it. The EntityRegistry stores
+ * every property as a dense array like the other components, changing it with
+ * EntityRegistry::setProperty() sets it's bit in the dirty mask of the entity.
+ *
+ * Every player collects the bits of the properties which changed since it
+ * received them, for every entity it knows (see ReplicationScheduler). An
+ * update (SC_PROPERTIES) holds only these properties: the EntityId, the mask
+ * and the values of the set bits in the order of the bits. The owner of an
+ * entity and the members of it's party also see the properties of the party.
+ */
+class ReplicatedProperties
+{
+public:
+    /**
+     * All replicated properties, at most 16
+     */
+    enum Property : uint8_t
+    {
+        HEALTH,
+        MAX_HEALTH,
+        /// bits like stunned or in combat, defined by the game logic
+        STATE_FLAGS,
+        WEAPON,
+        ARMOR,
+        MANA,
+        COUNT,
+    };
+
+    /**
+     * Who sees a property
+     */
+    enum class Audience : uint8_t
+    {
+        EVERYONE,
+        /// the owner and the members of it's party
+        PARTY,
+    };
+
+    /// One bit per Property
+    typedef uint16_t Mask;
+
+    /**
+     * Replication metadata of a property: it's Type (1, 2 or 4 bytes) and it's Audience
+     */
+    template <Property P>
+    struct Traits;
+
+    /**
+     * @return bytes of the value of a property
+     */
+    static uint32_t getSize(Property property);
+
+    /**
+     * @return bytes of the values of all properties of a mask
+     */
+    static uint32_t getSize(Mask mask);
+
+    /**
+     * @return mask of all properties of an audience
+     */
+    static Mask getMask(Audience audience);
+
+    /**
+     * Writes the values of the properties of a mask, in the order of their bits
+     * @param buffer to write into
+     * @param entities the entities of the Zone
+     * @param index dense index of the entity
+     * @param mask the properties
+     */
+    static void write(ByteBuffer& buffer, const EntityRegistry& entities, uint32_t index, Mask mask);
+};
+
+template <> struct ReplicatedProperties::Traits<ReplicatedProperties::HEALTH>
+{
+    typedef uint16_t Type;
+    static const Audience audience = Audience::EVERYONE;
+};
+
+template <> struct ReplicatedProperties::Traits<ReplicatedProperties::MAX_HEALTH>
+{
+    typedef uint16_t Type;
+    static const Audience audience = Audience::EVERYONE;
+};
+
+template <> struct ReplicatedProperties::Traits<ReplicatedProperties::STATE_FLAGS>
+{
+    typedef uint32_t Type;
+    static const Audience audience = Audience::EVERYONE;
+};
+
+template <> struct ReplicatedProperties::Traits<ReplicatedProperties::WEAPON>
+{
+    typedef uint16_t Type;
+    static const Audience audience = Audience::EVERYONE;
+};
+
+template <> struct ReplicatedProperties::Traits<ReplicatedProperties::ARMOR>
+{
+    typedef uint16_t Type;
+    static const Audience audience = Audience::EVERYONE;
+};
+
+template <> struct ReplicatedProperties::Traits<ReplicatedProperties::MANA>
+{
+    typedef uint16_t Type;
+    static const Audience audience = Audience::PARTY;
+};
@@ -0,0 +1,378 @@
+#include "ReplicationScheduler.h"
+
+#include <algorithm>
+
+#include "Network/PlayerSession.h"
+
+/// Relevance of the entities by Type
+static const float const_typeRelevance[] = {1.f, 0.5f, 2.f};
+
+/// Factor of the relevance of members of the own party
+static const float const_partyRelevance = 2.f;
+
+/// Priority gained per tick at the border of the area of interest, relative to the center
+static const float const_minDistanceWeight = 0.1f;
+
+/// Bytes per tick a player receives at least, at most and at first
+static const uint32_t const_minBudget = 512;
+static const uint32_t const_maxBudget = 16384;
+static const uint32_t const_initialBudget = 4096;
+
+/// Bytes per tick the budget grows while the client keeps up
+static const uint32_t const_budgetStep = 256;
+
+/// Bytes in the send queue above which the client is considered congested
+static const uint32_t const_maxQueuedBytes = 32768;
+
+/**
+ * @return cell of an EntityId in a table of mask + 1 cells
+ */
+static inline uint32_t findCell(EntityId id, uint32_t mask)
+{
+    return (id * 2654435761u) & mask;
+}
+
+ReplicationScheduler::ReplicationScheduler() : mBudget(const_initialBudget)
+{
+
+}
+
+void ReplicationScheduler::clear()
+{
+    mEntries.clear();
+    mSelection.clear();
+    mSpawns.clear();
+    mDespawns.clear();
+    mPropertyUpdates.clear();
+    mBudget = const_initialBudget;
+}
+
+void ReplicationScheduler::updateBudget(uint32_t queuedBytes)
+{
+    // like the congestion control of TCP: back off fast, recover slowly
+    if (queuedBytes > const_maxQueuedBytes)
+        mBudget = std::max(mBudget / 2, const_minBudget);
+    else if (queuedBytes < const_maxQueuedBytes / 4)
+        mBudget = std::min(mBudget + const_budgetStep, const_maxBudget);
+}
+
+void ReplicationScheduler::buildTable(uint32_t count)
+{
+    // at most half full, so the probe sequences stay short
+    uint32_t size = 16;
+    while (size < 2 * count)
+        size *= 2;
+
+    mTable.assign(size, UINT32_MAX);
+
+    uint32_t mask = size - 1;
+    for (uint32_t entry = 0; entry < mEntries.size(); entry++)
+    {
+        uint32_t cell = findCell(mEntries[entry].id, mask);
+        while (mTable[cell] != UINT32_MAX)
+            cell = (cell + 1) & mask;
+
+        mTable[cell] = entry;
+    }
+}
+
+void ReplicationScheduler::begin(uint32_t tick, uint64_t time, uint32_t maxUpdates)
+{
+    mTick = tick;
+    mTime = time;
+    mSelection.clear();
+    mSpawns.clear();
+    mDespawns.clear();
+    mPropertyUpdates.clear();
+    mLodSkippedCount = 0;
+    mExtrapolatedCount = 0;
+    mFramed = false;
+
+    for (auto& entry : mEntries)
+    {
+        entry.moved = false;
+        entry.framed = false;
+    }
+
+    buildTable((uint32_t)mEntries.size() + maxUpdates);
+}
+
+void ReplicationScheduler::addUpdate(EntityId id, bool framed)
+{
+    uint32_t mask = (uint32_t)mTable.size() - 1;
+    uint32_t cell = findCell(id, mask);
+
+    while (mTable[cell] != UINT32_MAX)
+    {
+        if (mEntries[mTable[cell]].id == id)
+        {
+            mEntries[mTable[cell]].moved = true;
+            mEntries[mTable[cell]].framed |= framed;
+            return;
+        }
+
+        cell = (cell + 1) & mask;
+    }
+
+    mTable[cell] = (uint32_t)mEntries.size();
+
+    Entry entry = {};
+    entry.id = id;
+    entry.moved = true;
+    entry.framed = framed;
+    entry.leaveTime = UINT64_MAX;
+    mEntries.push_back(entry);
+}
+
+void ReplicationScheduler::schedule(EntityRegistry& entities, const Settings& settings, float x, float z, float aoiRadius,
+                                    uint32_t partyId, uint32_t distantUpdateInterval, const MessageSizes& sizes, uint32_t frameSize)
+{
+    float squaredAoiRadius = aoiRadius * aoiRadius;
+    float inverseSquaredAoiRadius = 1.f / squaredAoiRadius;
+    float leaveRadius = aoiRadius * settings.leaveRadiusFactor;
+    float squaredLeaveRadius = leaveRadius * leaveRadius;
+    float squaredMaxError = settings.maxExtrapolationError * settings.maxExtrapolationError;
+    const EntityRegistry::Type* types = entities.getTypes();
+    PlayerSession* const* owners = entities.getOwners();
+    const float* positionX = entities.getPositionX();
+    const float* positionY = entities.getPositionY();
+    const float* positionZ = entities.getPositionZ();
+    const uint32_t* dirty = entities.getDirty();
+    const ReplicatedProperties::Mask* propertyDirty = entities.getPropertyDirty();
+    ReplicatedProperties::Mask publicProperties = ReplicatedProperties::getMask(ReplicatedProperties::Audience::EVERYONE);
+    ReplicatedProperties::Mask partyProperties = ReplicatedProperties::getMask(ReplicatedProperties::Audience::PARTY);
+    uint32_t newEntitySize = sizes.spawn + sizes.properties + ReplicatedProperties::getSize(publicProperties | partyProperties);
+
+    // the frames can't be split, they are only sent with the spawns of all unknown entities in them
+    uint32_t available = mBudget;
+    if (frameSize != 0)
+    {
+        uint32_t frameCost = frameSize;
+        for (auto& entry : mEntries)
+        {
+            if (entry.framed && !entry.received)
+                frameCost += newEntitySize;
+        }
+
+        mFramed = frameCost <= mBudget;
+        if (mFramed)
+            available -= frameCost;
+    }
+
+    mQueue.clear();
+
+    // forget the entities the player can't see anymore, queue the ones the client can't extrapolate
+    uint32_t count = 0;
+    for (uint32_t entry = 0; entry < mEntries.size(); entry++)
+    {
+        Entry& previous = mEntries[entry];
+
+        uint32_t index = entities.getIndex(previous.id);
+        if (index == UINT32_MAX)
+        {
+            if (previous.received)
+                mDespawns.push_back(previous.id);
+
+            continue;
+        }
+
+        float dx = positionX[index] - x;
+        float dz = positionZ[index] - z;
+        float squaredDistance = dx*dx + dz*dz;
+
+        // entities along the border stay, until they are away long enough, the ones in the frames anyway
+        bool framed = mFramed && previous.framed;
+        if (!(squaredDistance <= squaredLeaveRadius) && !framed)
+        {
+            if (previous.leaveTime == UINT64_MAX)
+                previous.leaveTime = mTime;
+
+            if (mTime - previous.leaveTime >= settings.despawnDelay || !previous.received)
+            {
+                if (previous.received)
+                    mDespawns.push_back(previous.id);
+
+                continue;
+            }
+        }
+        else
+        {
+            previous.leaveTime = UINT64_MAX;
+        }
+
+        if (count != entry)
+            mEntries[count] = mEntries[entry];
+
+        Entry& current = mEntries[count++];
+        current.index = index;
+
+        bool partyMember = partyId != 0 && owners[index] != nullptr && owners[index]->getPartyId() == partyId;
+        ReplicatedProperties::Mask visibleProperties = partyMember ? publicProperties | partyProperties : publicProperties;
+
+        // the changes add up until the player receives them, a new entity is sent with all properties
+        if (current.received)
+            current.pendingProperties |= propertyDirty[index] & visibleProperties;
+        else
+            current.pendingProperties = visibleProperties;
+
+        // a leaving entity isn't updated anymore, the client keeps extrapolating it
+        if (current.leaveTime != UINT64_MAX)
+            continue;
+
+        current.positionPending = true;
+
+        // only the moves count for the metrics, not the changed properties
+        bool moved = current.moved && (dirty[index] & EntityRegistry::DIRTY_POSITION) != 0;
+
+        if (framed)
+        {
+            // the frames carry the move, a new entity is spawned before them with all properties, already paid for
+            if (!current.received)
+            {
+                mSpawns.push_back(index);
+                mPropertyUpdates.push_back({index, current.pendingProperties});
+                current.pendingProperties = 0;
+            }
+
+            markSent(current, entities);
+            current.positionPending = false;
+
+            // changed properties wait for the budget like the others
+            if (current.pendingProperties == 0)
+                continue;
+        }
+        else if (current.received)
+        {
+            float seconds = (mTime - current.sentTime) / 1000.f;
+            float errorX = positionX[index] - (current.sentX + current.sentVelocityX * seconds);
+            float errorY = positionY[index] - (current.sentY + current.sentVelocityY * seconds);
+            float errorZ = positionZ[index] - (current.sentZ + current.sentVelocityZ * seconds);
+
+            current.positionPending = errorX*errorX + errorY*errorY + errorZ*errorZ > squaredMaxError;
+
+            if (!current.positionPending)
+                mExtrapolatedCount += moved;
+
+            if (!current.positionPending && current.pendingProperties == 0)
+            {
+                current.priority = 0.f;
+                continue;
+            }
+
+            uint32_t band = 0;
+            while (band + 1 < settings.lodBands.size() && squaredDistance > settings.lodBands[band].distance * settings.lodBands[band].distance)
+                band++;
+
+            uint32_t interval = settings.lodBands.empty() ? 1 : settings.lodBands[band].interval;
+            if (band > 0)
+                interval *= distantUpdateInterval;
+
+            if (mTick - current.sentTick < interval)
+            {
+                mLodSkippedCount += moved;
+                continue;
+            }
+        }
+
+        float relevance = const_typeRelevance[(size_t)types[index]];
+        if (partyMember)
+            relevance *= const_partyRelevance;
+
+        current.priority += relevance * (1.f + const_minDistanceWeight - squaredDistance * inverseSquaredAoiRadius);
+        mQueue.push_back({current.priority, count - 1});
+    }
+    mEntries.resize(count);
+
+    uint32_t queueCount = (uint32_t)mQueue.size();
+    uint32_t selectionCount = std::min(queueCount, available / sizes.update);
+
+    // without a frame a new entity fits at least, with all it's properties, a frame already used up the minimum
+    uint32_t budget = available;
+    if (!mFramed)
+    {
+        selectionCount = std::min(queueCount, std::max(selectionCount, 1u));
+        budget = std::max(budget, sizes.update + newEntitySize);
+    }
+
+    if (selectionCount < queueCount)
+    {
+        std::nth_element(mQueue.begin(), mQueue.begin() + selectionCount, mQueue.end(),
+                         [](const QueueEntry& first, const QueueEntry& second) {
+                             return first.priority > second.priority;
+                         });
+    }
+
+    for (uint32_t entry = 0; entry < selectionCount; entry++)
+    {
+        Entry& selected = mEntries[mQueue[entry].entry];
+        uint32_t index = selected.index;
+
+        // the spawns are sent additionally, the updates which don't fit anymore wait
+        uint32_t size = 0;
+        if (selected.positionPending)
+            size += sizes.update;
+        if (selected.pendingProperties != 0)
+            size += sizes.properties + ReplicatedProperties::getSize(selected.pendingProperties);
+        if (!selected.received)
+            size += sizes.spawn;
+
+        if (size > budget)
+            continue;
+
+        budget -= size;
+
+        if (!selected.received)
+            mSpawns.push_back(index);
+
+        if (selected.positionPending)
+        {
+            markSent(selected, entities);
+            mSelection.push_back(index);
+        }
+        else
+        {
+            selected.priority = 0.f;
+        }
+
+        if (selected.pendingProperties != 0)
+        {
+            mPropertyUpdates.push_back({index, selected.pendingProperties});
+            selected.pendingProperties = 0;
+        }
+    }
+}
+
+void ReplicationScheduler::collectReceived(std::vector<uint32_t>& indices)
+{
+    for (auto& entry : mEntries)
+    {
+        if (entry.received)
+            indices.push_back(entry.index);
+    }
+}
+
+void ReplicationScheduler::collectReceivedIds(std::vector<EntityId>& ids)
+{
+    for (auto& entry : mEntries)
+    {
+        if (entry.received)
+            ids.push_back(entry.id);
+    }
+}
+
+void ReplicationScheduler::markSent(Entry& entry, EntityRegistry& entities)
+{
+    uint32_t index = entry.index;
+
+    // remember what the client extrapolates from now on, the priority starts again from 0
+    entry.priority = 0.f;
+    entry.received = true;
+    entry.sentTick = mTick;
+    entry.sentTime = mTime;
+    entry.sentX = entities.getPositionX()[index];
+    entry.sentY = entities.getPositionY()[index];
+    entry.sentZ = entities.getPositionZ()[index];
+    entry.sentVelocityX = entities.getVelocityX()[index];
+    entry.sentVelocityY = entities.getVelocityY()[index];
+    entry.sentVelocityZ = entities.getVelocityZ()[index];
+}
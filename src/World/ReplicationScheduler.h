@@ -0,0 +1,316 @@
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#include "EntityRegistry.h"
+#include "ReplicatedProperties.h"
+
+/**
+ * @brief Decides which entity updates a player receives in a tick
+ *
+ * A player in a crowd can't receive every update of every entity around it
+ * every tick. Every entity with an update the player didn't receive yet is
+ * pending and gains priority each tick, more when it's near or relevant
+ * (e.g. a member of the party). Every tick the updates with the highest
+ * priority are sent, as many as fit into the byte budget of the player,
+ * the others wait and gain more priority for the next tick. So every entity
+ * is updated eventually, near ones more often.
+ *
+ * Updates are sent less often than possible:
+ *  - level of detail: the farther an entity is, the more ticks have to pass
+ *    between two of it's updates, see Settings::lodBands.
+ *  - dead reckoning: the client extrapolates every entity with the velocity
+ *    of it's last update. The scheduler does the same for every entity the
+ *    player knows, an entity is only pending when the extrapolated position
+ *    is further off than Settings::maxExtrapolationError.
+ *
+ * The player is told when an entity appears (spawn) and disappears (despawn).
+ * An entity appears when it moves within the area of interest, or when the
+ * periodic sweep of the Zone finds it there standing still, but only
+ * disappears when it's farther than the larger leave radius for some time,
+ * so entities moving along the border don't appear and disappear every tick.
+ *
+ * The replicated properties of an entity (see ReplicatedProperties) are sent
+ * when they changed since the player received them, without a position
+ * update if the client extrapolates the position well enough.
+ *
+ * In crowded areas the Zone sends the players shared frames with all moves of
+ * the cells around them instead (see Zone::replicate()), when the frames fit
+ * into the budget together with the spawns of the entities in them the player
+ * doesn't know yet. The spawns are sent before the frames, the entities in the
+ * frames stay known and the rest of the budget is left for the other updates.
+ *
+ * The budget adapts to the bytes waiting in the send queue of the connection:
+ * it's halved when the client can't keep up and grows slowly again.
+ *
+ * The known entities are kept in flat arrays, the scheduler doesn't
+ * allocate per tick once it has grown.
+ *
+ * @remark not thread-safe, used by the Zone thread replicating to the player
+ */
+class ReplicationScheduler
+{
+public:
+    /**
+     * Update rate of the entities up to a distance
+     */
+    struct LodBand
+    {
+        /// Distance to the player up to which the band applies
+        float distance;
+
+        /// Ticks between two updates at least
+        uint32_t interval;
+    };
+
+    /**
+     * How the players of a Zone are updated
+     */
+    struct Settings
+    {
+        /// Bands ordered by distance, entities beyond the last band are updated at it's interval
+        std::vector<LodBand> lodBands = {{30.f, 1}, {100.f, 4}, {FLT_MAX, 10}};
+
+        /// Distance the position extrapolated by the client may be off, 0 sends every change
+        float maxExtrapolationError = 0.1f;
+
+        /// Factor of the area of interest, known entities disappear only beyond this radius
+        float leaveRadiusFactor = 1.2f;
+
+        /// Milliseconds an entity has to stay beyond the leave radius to disappear
+        uint64_t despawnDelay = 1000;
+    };
+
+    /**
+     * Bytes of the messages on the wire, for the budget
+     */
+    struct MessageSizes
+    {
+        /// a position update
+        uint32_t update;
+
+        /// a spawn, sent before the first update
+        uint32_t spawn;
+
+        /// a property update without the values
+        uint32_t properties;
+    };
+
+    /**
+     * Properties of an entity to send to the player
+     */
+    struct PropertyUpdate
+    {
+        /// dense index
+        uint32_t index;
+
+        ReplicatedProperties::Mask mask;
+    };
+
+private:
+    /**
+     * An entity known to the player
+     */
+    struct Entry
+    {
+        EntityId id;
+
+        /// accumulated priority, while the update is pending
+        float priority;
+
+        /// dense index in the current tick
+        uint32_t index;
+
+        /// true if the entity moved or changed it's properties in the current tick
+        bool moved;
+
+        /// true if the move of the entity is in the cell frames of the current tick
+        bool framed;
+
+        /// true if the player received an update of the entity, which spawned it
+        bool received;
+
+        /// true if the client can't extrapolate the position well enough, in the current tick
+        bool positionPending;
+
+        /// properties which changed since the player received them
+        ReplicatedProperties::Mask pendingProperties;
+
+        /// time in milliseconds the entity left the leave radius, UINT64_MAX while inside
+        uint64_t leaveTime;
+
+        /// tick and time in milliseconds of the last update the player received
+        uint32_t sentTick;
+        uint64_t sentTime;
+
+        /// position and velocity of the last update, extrapolated by the client
+        float sentX, sentY, sentZ;
+        float sentVelocityX, sentVelocityY, sentVelocityZ;
+    };
+
+    /// All entities known to the player
+    std::vector<Entry> mEntries;
+
+    /// Open addressing set of mEntries by EntityId, rebuilt every tick, UINT32_MAX for free cells
+    std::vector<uint32_t> mTable;
+
+    /**
+     * Priority and position in mEntries, for selecting without following the index
+     */
+    struct QueueEntry
+    {
+        float priority;
+        uint32_t entry;
+    };
+
+    /// Pending entries of the current tick, the first ones are selected
+    std::vector<QueueEntry> mQueue;
+
+    /// Dense indices of the entities sent in the current tick
+    std::vector<uint32_t> mSelection;
+
+    /// Dense indices of the entities appearing in the current tick, also in mSelection
+    std::vector<uint32_t> mSpawns;
+
+    /// Entities disappearing in the current tick
+    std::vector<EntityId> mDespawns;
+
+    /// Properties sent in the current tick
+    std::vector<PropertyUpdate> mPropertyUpdates;
+
+    /// Bytes the player may receive per tick
+    uint32_t mBudget;
+
+    /// true if the player receives the cell frames in the current tick
+    bool mFramed = false;
+
+    /// Tick and time in milliseconds of the Zone in the current tick
+    uint32_t mTick = 0;
+    uint64_t mTime = 0;
+
+    /// Moved entities not sent in the current tick because of their LOD band
+    uint32_t mLodSkippedCount = 0;
+
+    /// Moved entities not sent in the current tick because the client extrapolates them well enough
+    uint32_t mExtrapolatedCount = 0;
+
+    /**
+     * Clears mTable for count entries and inserts all entries
+     */
+    void buildTable(uint32_t count);
+
+    /**
+     * Remembers that the player received the current state of an entity
+     */
+    void markSent(Entry& entry, EntityRegistry& entities);
+
+public:
+    ReplicationScheduler();
+
+    /**
+     * Forgets all known entities, e.g. when the player changes the Zone
+     */
+    void clear();
+
+    /**
+     * Adapts the budget to the bytes still waiting to be sent to the client
+     * @param queuedBytes bytes in the send queue of the connection
+     */
+    void updateBudget(uint32_t queuedBytes);
+
+    /**
+     * @return bytes the player may receive per tick
+     */
+    uint32_t getBudget() { return mBudget; }
+
+    /**
+     * Sets the budget, for receivers without a connection of their own, e.g. an ObserverStream
+     * @param budget bytes per tick
+     */
+    void setBudget(uint32_t budget) { mBudget = budget; }
+
+    /**
+     * Starts a tick, to be called before adding the updates of the tick
+     * @param tick number of the tick of the Zone
+     * @param time milliseconds the Zone simulated, for extrapolating
+     * @param maxUpdates number of addUpdate() calls in this tick at most
+     */
+    void begin(uint32_t tick, uint64_t time, uint32_t maxUpdates);
+
+    /**
+     * Adds an entity which moved or changed it's properties in the area of interest, or any entity
+     * in it during a sweep, the player learns about new entities this way
+     * @param id the entity
+     * @param framed true if the move of the entity is in the cell frames the player may receive
+     */
+    void addUpdate(EntityId id, bool framed = false);
+
+    /**
+     * Selects the updates of the tick, see getSelection().
+     * Entities which were destroyed or stayed beyond the leave radius long enough disappear.
+     * @param entities the entities of the Zone
+     * @param settings LOD bands and extrapolation error of the Zone
+     * @param x, z position of the player
+     * @param aoiRadius radius of the area of interest of the player
+     * @param partyId party of the player, 0 if none
+     * @param distantUpdateInterval factor for the intervals of all but the first LOD band, for shedding load
+     * @param sizes bytes of the messages
+     * @param frameSize bytes of the cell frames the player may receive, 0 if none, see isFramed()
+     */
+    void schedule(EntityRegistry& entities, const Settings& settings, float x, float z, float aoiRadius,
+                  uint32_t partyId, uint32_t distantUpdateInterval, const MessageSizes& sizes, uint32_t frameSize);
+
+    /**
+     * @return true if the player receives the cell frames in the current tick, after the spawns
+     */
+    bool isFramed() { return mFramed; }
+
+    /**
+     * @return dense indices of the entities to send in the current tick
+     */
+    const std::vector<uint32_t>& getSelection() { return mSelection; }
+
+    /**
+     * @return dense indices of the entities appearing in the current tick, to be sent before the updates
+     */
+    const std::vector<uint32_t>& getSpawns() { return mSpawns; }
+
+    /**
+     * @return entities disappearing in the current tick
+     */
+    const std::vector<EntityId>& getDespawns() { return mDespawns; }
+
+    /**
+     * @return properties to send in the current tick, with their entity
+     */
+    const std::vector<PropertyUpdate>& getPropertyUpdates() { return mPropertyUpdates; }
+
+    /**
+     * @return number of entities known to the player
+     */
+    uint32_t getKnownCount() { return (uint32_t)mEntries.size(); }
+
+    /**
+     * Collects the entities the player received, after schedule()
+     * @param indices receives the dense indices
+     */
+    void collectReceived(std::vector<uint32_t>& indices);
+
+    /**
+     * Collects the entities the player received, e.g. for despawning them before clear()
+     * @param ids receives the EntityIds
+     */
+    void collectReceivedIds(std::vector<EntityId>& ids);
+
+    /**
+     * @return moved entities not sent in the current tick because of their LOD band
+     */
+    uint32_t getLodSkippedCount() { return mLodSkippedCount; }
+
+    /**
+     * @return moved entities not sent in the current tick because the client extrapolates them well enough
+     */
+    uint32_t getExtrapolatedCount() { return mExtrapolatedCount; }
+};
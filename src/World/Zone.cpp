@@ -1,34 +1,1190 @@
 #include "Zone.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "Network/Connection.h"
 #include "Network/Packet.h"
 #include "Network/PlayerSession.h"
 #include "Network/OpcodeHandler.h"
+#include "ZoneManager.h"
+#include "ZonePool.h"
+#include "utility/SimdKernels.h"
+#include "utility/WorkerPool.h"
+#include "Metrics/Metrics.h"
+#include "Log/Logger.h"
+
+/// Default ticks per second with players
+static const uint32_t const_tickRate = 20;
+/// Default ticks per second without players, when not hibernating
+static const uint32_t const_idleTickRate = 1;
+/// Ticks which may run back-to-back after an overrun
+static const uint32_t const_maxBurstTicks = 2;
+/// Default radius around a player in which it receives updates of others
+static const float const_aoiRadius = 100.f;
+/// A region is split when it holds more players
+static const uint32_t const_regionCapacity = 500;
+/// The regions are merged when the Zone holds less players
+static const uint32_t const_mergeThreshold = const_regionCapacity / 2;
+/// Milliseconds until a split partition is rebuilt for the current positions
+static const TimePoint const_partitionRebuildInterval = 1000;
+/// Upper limit of regions, independent of the number of workers
+static const uint32_t const_maxRegions = 16;
+/// PlayerSessions or entities per job of the input and replication phases
+static const uint32_t const_chunkSize = 64;
+/// Bytes of a position update on the wire: length, opcode, sequence, tick, EntityId, position and velocity
+static const uint32_t const_updateSize = 2+2+2+4+4+3*4+3*4;
+/// Bytes of a spawn on the wire: length, opcode, sequence, tick, EntityId, type and extent
+static const uint32_t const_spawnSize = 2+2+2+4+4+1+4;
+/// Bytes of a property update on the wire without the values: length, opcode, sequence, tick, EntityId and mask
+static const uint32_t const_propertiesSize = 2+2+2+4+4+2;
+/// All sizes for the ReplicationSchedulers
+static const ReplicationScheduler::MessageSizes const_messageSizes = {const_updateSize, const_spawnSize, const_propertiesSize};
+/// mScheduledEntities: the position update is sent
+static const uint8_t const_scheduledMove = 1 << 0;
+/// mScheduledEntities: the public properties which changed in the tick are sent
+static const uint8_t const_scheduledProperties = 1 << 1;
+/// Ticks between two sweeps replicating all entities, not only the changed ones, so players notice those standing still
+static const uint32_t const_aoiSweepInterval = 10;
+/// Players in a cell from which on the players around receive cell frames
+static const uint32_t const_crowdedCellPlayers = 64;
+/// Moves per cell frame, far below the largest packet
+static const uint32_t const_maxFrameMoves = 1024;
+/// Bytes of a cell frame on the wire besides the moves: length, opcode, sequence, tick and count
+static const uint32_t const_frameHeaderSize = 2+2+2+4+2;
+/// Bytes of a move in a cell frame: EntityId, position and velocity
+static const uint32_t const_frameMoveSize = 4+3*4+3*4;
+/// Limits of the cell coordinates, far outside of any Zone
+static const float const_maxCellCoordinate = (float)(1 << 24);
+/// Health and mana of a player entering the Zone
+static const uint16_t const_playerHealth = 100;
+static const uint16_t const_playerMana = 100;
+/// Milliseconds a deferrable timer is postponed while non-critical work is deferred
+static const TimePoint const_deferDelay = 250;
+/// The partition is rebuilt this many times less often while non-critical work is deferred
+static const TimePoint const_deferredRebuildFactor = 4;
+
+Zone::Zone(uint32_t id, bool instance) :
+        mId(id),
+        mInstance(instance),
+        mHandoffCount(sMetrics->get("zone.handoffs")),
+        mDegradedZoneCount(sMetrics->get("zone.degraded_zones")),
+        mDegradationChangeCount(sMetrics->get("zone.degradation_changes")),
+        mRejectedMovementCount(sMetrics->get("zone.rejected_movements")),
+        mTickRate(const_tickRate),
+        mIdleTickRate(const_idleTickRate),
+        mTickScheduler(const_tickRate),
+        mScheduledTickRate(const_tickRate),
+        mAoiRadius(const_aoiRadius)
+{
+    mTickScheduler.setCatchUpPolicy(TickScheduler::CatchUpPolicy::BURST, const_maxBurstTicks);
+    mTickScheduler.reset(getTimeNanoseconds());
+
+    mNpcs.setPathfinding(&mPathfinding);
+    mRegions.resize(1);
+    registerMetrics();
+}
+
+void Zone::registerMetrics()
+{
+    std::string prefix = mInstance ? std::string("zone.instances") : fmt::format("zone.{}", mId);
+
+    mLodSkippedMetric = &sMetrics->get(prefix + ".lod_skipped_updates");
+    mExtrapolatedMetric = &sMetrics->get(prefix + ".extrapolated_updates");
+    mSavedBytesMetric = &sMetrics->get(prefix + ".replication_saved_bytes");
+    mSpawnMetric = &sMetrics->get(prefix + ".spawns");
+    mDespawnMetric = &sMetrics->get(prefix + ".despawns");
+    mCellFrameMetric = &sMetrics->get(prefix + ".cell_frames");
+    mObserverPacketMetric = &sMetrics->get(prefix + ".observer_packets");
+}
+
+void Zone::reset(uint32_t id, bool instance)
+{
+    std::lock_guard<std::mutex> lock(mSessionListMutex);
+
+    assert(mSessionList.empty());
+    assert(mIncomingHandoffs.size_approx() == 0);
+
+    // handed off while the instance was destroyed, the sessions must not end up in an unrelated instance
+    Handoff handoff;
+    while (mIncomingHandoffs.try_dequeue(handoff))
+    {
+        if (std::find(mDepartedSessions.begin(), mDepartedSessions.end(), handoff.session) != mDepartedSessions.end())
+            continue;
+
+        log->error("Zone {}: session handed off while the instance was destroyed, assigning it again", mId);
+        sZoneManager->assignZone(handoff.session);
+    }
+
+    mId = id;
+    mInstance = instance;
+    registerMetrics();
+    mZonePool = nullptr;
+    mCapacity = 0;
+    mTickRate = const_tickRate;
+    mIdleTickRate = const_idleTickRate;
+    mHibernationAllowed = true;
+    mTickScheduler.setTickRate(const_tickRate);
+    mTickScheduler.reset(getTimeNanoseconds());
+    mTickScheduler.resetHistograms();
+    mScheduledTickRate = const_tickRate;
+    mDifferenceRemainder = 0;
+    mHibernating = false;
+    mWoken = false;
+    mTickCost = 0;
+    mLastMigrationTime = 0;
+    mAoiRadius = const_aoiRadius;
+    resetDegradation();
+
+    mPartition.reset();
+    mPartitionAge = 0;
+    mRegions.resize(1);
+    mDepartedSessions.clear();
+
+    {
+        std::lock_guard<std::mutex> observerLock(mObserverMutex);
+
+        // the observers would otherwise still leave the reused Zone later
+        std::vector<PlayerSession*> viewers;
+        for (auto& stream : mObserverStreams)
+            stream.collectViewers(viewers);
+
+        for (auto viewer : viewers)
+            viewer->forgetObservedZone(this);
+
+        mObserverStreams.clear();
+        mObserverCount = 0;
+    }
+
+    mNpcs.clear(mEntities);
+    mEntities.clear();
+    mBroadphase.clear();
+    mSpawnPackets.clear();
+    mTickNumber = 0;
+    mTime = 0;
+    mReplicationSettings = ReplicationScheduler::Settings();
+    mPositionHistory.clear();
+    mMovementValidator = MovementValidator();
+    mPathfinding.reset();
+
+    Timer timer;
+    while (mNewTimers.try_dequeue(timer));
+    mTimers.clear();
+    mNextTimerTime = UINT64_MAX;
+}
 
 void Zone::update(TimePoint difference)
 {
+    std::lock_guard<std::mutex> lock(mSessionListMutex);
+
+    adoptHandoffs();
+    mTickNumber++;
+    mTime += difference;
+
+    uint64_t phaseStartTime = getTimeNanoseconds();
+
+    processInput(difference);
+    phaseStartTime = finishPhase(TickPhase::INPUT, phaseStartTime);
+
+    simulate(difference);
+    phaseStartTime = finishPhase(TickPhase::SIMULATE, phaseStartTime);
+
+    replicate();
+    phaseStartTime = finishPhase(TickPhase::REPLICATE, phaseStartTime);
+
+    flush();
+    finishPhase(TickPhase::FLUSH, phaseStartTime);
+}
+
+uint64_t Zone::finishPhase(TickPhase phase, uint64_t startTime)
+{
+    uint64_t currentTime = getTimeNanoseconds();
+    mPhaseDurations[(size_t)phase] = currentTime - startTime;
+    return currentTime;
+}
+
+const char* Zone::getPhaseName(TickPhase phase)
+{
+    switch (phase)
+    {
+        case TickPhase::INPUT: return "input";
+        case TickPhase::SIMULATE: return "simulate";
+        case TickPhase::REPLICATE: return "replicate";
+        case TickPhase::FLUSH: return "flush";
+        default: return "unknown";
+    }
+}
+
+void Zone::forEachIndex(uint32_t count, const std::function<void(uint32_t)>& function)
+{
+    if (count <= const_chunkSize || sWorkerPool == nullptr)
+    {
+        for (uint32_t index = 0; index < count; index++)
+            function(index);
+
+        return;
+    }
+
+    uint32_t chunkCount = (count + const_chunkSize - 1) / const_chunkSize;
+
+    sWorkerPool->parallelFor(chunkCount, [count, &function](uint32_t chunk) {
+        uint32_t end = std::min(count, (chunk + 1) * const_chunkSize);
+
+        for (uint32_t index = chunk * const_chunkSize; index < end; index++)
+            function(index);
+    });
+}
+
+void Zone::processInput(TimePoint difference)
+{
+    mSessions.assign(mSessionList.begin(), mSessionList.end());
+
+    // a session only touches itself while processing it's packets
+    forEachIndex((uint32_t)mSessions.size(), [this, difference](uint32_t index) {
+        mSessions[index]->update(difference);
+    });
+}
+
+void Zone::simulate(TimePoint difference)
+{
+    mPathfinding.update();
+    processTimers();
+
+    applyPlayerMovement();
+    mNpcs.update(mEntities, difference);
+    mEntities.integrateMovement(difference / 1000.f);
+    mBroadphase.update(mEntities);
+    mNpcs.separate(mEntities, mBroadphase.getPairs());
+    mPositionHistory.record(mTickNumber, mEntities);
+
+    updatePartition(mSessionCount, difference);
+    assignRegions();
+}
+
+void Zone::applyPlayerMovement()
+{
+    for (auto& session : mSessions)
+    {
+        if (!session->hasMoved())
+            continue;
+
+        uint32_t index = mEntities.getIndex(session->getEntityId());
+        mEntities.setPosition(index, session->getPositionX(), session->getPositionY(), session->getPositionZ());
+    }
+}
+
+EntityId Zone::spawnEntity(EntityRegistry::Type type, float x, float y, float z)
+{
+    EntityId id = mEntities.create(type, nullptr);
+    mEntities.setPosition(mEntities.getIndex(id), x, y, z);
+    return id;
+}
+
+void Zone::despawnEntity(EntityId id)
+{
+    mEntities.destroy(id);
+}
+
+void Zone::addPlayerEntity(PlayerSession* playerSession)
+{
+    EntityId id = mEntities.create(EntityRegistry::Type::PLAYER, playerSession);
+    uint32_t index = mEntities.getIndex(id);
+    mEntities.setPosition(index, playerSession->getPositionX(), playerSession->getPositionY(), playerSession->getPositionZ());
+
+    mEntities.setProperty<ReplicatedProperties::MAX_HEALTH>(index, const_playerHealth);
+    mEntities.setProperty<ReplicatedProperties::HEALTH>(index, const_playerHealth);
+    mEntities.setProperty<ReplicatedProperties::MANA>(index, const_playerMana);
+
+    playerSession->setEntityId(id);
+}
+
+void Zone::removePlayerEntity(PlayerSession* playerSession)
+{
+    mEntities.destroy(playerSession->getEntityId());
+
+    playerSession->setEntityId(INVALID_ENTITY);
+}
+
+void Zone::replicate()
+{
+    mSpawnPackets.resize(mEntities.getSlotCount());
+
+    // the cached spawns of new or changed entities are outdated
+    const uint32_t* dirty = mEntities.getDirty();
+    for (uint32_t index = 0; index < mEntities.size(); index++)
+    {
+        if ((dirty[index] & (EntityRegistry::DIRTY_CREATED | EntityRegistry::DIRTY_APPEARANCE)) != 0)
+            mSpawnPackets[EntityRegistry::getSlot(mEntities.getIds()[index])].reset();
+    }
+
+    mReplicationChunks.clear();
+
+    for (uint32_t regionIndex = 0; regionIndex < mRegions.size(); regionIndex++)
+    {
+        uint32_t memberCount = (uint32_t)mRegions[regionIndex].members.size();
+
+        for (uint32_t begin = 0; begin < memberCount; begin += const_chunkSize)
+            mReplicationChunks.push_back({regionIndex, begin, std::min(memberCount, begin + const_chunkSize)});
+    }
+
+    buildCellFrames();
+
+    // every chunk only changes the schedulers of it's own recipients
+    forEachReplicationChunk([this](uint32_t chunkIndex) {
+        const ReplicationChunk& chunk = mReplicationChunks[chunkIndex];
+        const Region& region = mRegions[chunk.region];
+
+        std::vector<uint32_t> candidates;
+
+        for (uint32_t index = chunk.begin; index < chunk.end; index++)
+            replicateTo(region, region.members[index], candidates);
+    });
+
+    mScheduledEntities.assign(mEntities.size(), 0);
+    const ReplicatedProperties::Mask* propertyDirty = mEntities.getPropertyDirty();
+    ReplicatedProperties::Mask publicProperties = ReplicatedProperties::getMask(ReplicatedProperties::Audience::EVERYONE);
+    uint32_t lodSkippedCount = 0;
+    uint32_t extrapolatedCount = 0;
+    uint32_t spawnCount = 0;
+    uint32_t despawnCount = 0;
+
+    for (auto& region : mRegions)
+    {
+        for (auto& member : region.members)
+        {
+            ReplicationScheduler& scheduler = member.session->getReplicationScheduler();
+
+            for (uint32_t entity : scheduler.getSelection())
+                mScheduledEntities[entity] |= const_scheduledMove;
+
+            // most players receive just the changes of the tick, the others get their own packet
+            for (auto& update : scheduler.getPropertyUpdates())
+            {
+                if (update.mask == (propertyDirty[update.index] & publicProperties))
+                    mScheduledEntities[update.index] |= const_scheduledProperties;
+            }
+
+            for (uint32_t entity : scheduler.getSpawns())
+                buildSpawnPacket(entity);
+
+            lodSkippedCount += scheduler.getLodSkippedCount();
+            extrapolatedCount += scheduler.getExtrapolatedCount();
+            spawnCount += (uint32_t)scheduler.getSpawns().size();
+            despawnCount += (uint32_t)scheduler.getDespawns().size();
+        }
+    }
+
+    *mLodSkippedMetric += lodSkippedCount;
+    *mExtrapolatedMetric += extrapolatedCount;
+    *mSavedBytesMetric += (int64_t)(lodSkippedCount + extrapolatedCount) * const_updateSize;
+    *mSpawnMetric += spawnCount;
+    *mDespawnMetric += despawnCount;
+
+    mEntityPackets.resize(mEntities.size());
+    mPropertyPackets.resize(mEntities.size());
+
+    // one packet per scheduled entity, shared by all recipients
+    forEachIndex(mEntities.size(), [this, propertyDirty, publicProperties](uint32_t index) {
+        if ((mScheduledEntities[index] & const_scheduledProperties) != 0)
+            mPropertyPackets[index] = buildPropertiesPacket(index, propertyDirty[index] & publicProperties);
+
+        if ((mScheduledEntities[index] & const_scheduledMove) == 0)
+            return;
+
+        std::shared_ptr<Packet> packet = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_MOVEPACKET);
+        packet->setTick(mTickNumber);
+        *packet << mEntities.getIds()[index];
+        *packet << mEntities.getPositionX()[index];
+        *packet << mEntities.getPositionY()[index];
+        *packet << mEntities.getPositionZ()[index];
+        *packet << mEntities.getVelocityX()[index];
+        *packet << mEntities.getVelocityY()[index];
+        *packet << mEntities.getVelocityZ()[index];
+
+        mEntityPackets[index] = std::move(packet);
+    });
+
+    // every chunk only writes to the outgoing packets of it's own recipients
+    ReplicatedProperties::Mask allProperties = publicProperties | ReplicatedProperties::getMask(ReplicatedProperties::Audience::PARTY);
+
+    forEachReplicationChunk([this, dirty, propertyDirty, publicProperties, allProperties](uint32_t chunkIndex) {
+        const ReplicationChunk& chunk = mReplicationChunks[chunkIndex];
+        const Region& region = mRegions[chunk.region];
+
+        for (uint32_t index = chunk.begin; index < chunk.end; index++)
+        {
+            const RegionMember& member = region.members[index];
+            PlayerSession* session = member.session;
+            ReplicationScheduler& scheduler = session->getReplicationScheduler();
+
+            for (EntityId id : scheduler.getDespawns())
+            {
+                std::shared_ptr<Packet> packet = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_DESPAWN);
+                packet->setTick(mTickNumber);
+                *packet << id;
+                session->queueOutgoingPacket(packet);
+            }
+
+            // the entities appear before their first update
+            for (uint32_t entity : scheduler.getSpawns())
+                session->queueOutgoingPacket(mSpawnPackets[EntityRegistry::getSlot(mEntities.getIds()[entity])]);
+
+            if (scheduler.isFramed())
+                queueCellFrames(session, member.x, member.z);
+
+            for (uint32_t entity : scheduler.getSelection())
+                session->queueOutgoingPacket(mEntityPackets[entity]);
+
+            for (auto& update : scheduler.getPropertyUpdates())
+            {
+                if (update.mask == (propertyDirty[update.index] & publicProperties))
+                    session->queueOutgoingPacket(mPropertyPackets[update.index]);
+                else
+                    session->queueOutgoingPacket(buildPropertiesPacket(update.index, update.mask));
+            }
+
+            // the player sees all properties of it's own entity, every one of them when it enters the Zone
+            ReplicatedProperties::Mask ownProperties = propertyDirty[member.entity];
+            if ((dirty[member.entity] & EntityRegistry::DIRTY_CREATED) != 0)
+                ownProperties = allProperties;
+
+            if (ownProperties != 0)
+                session->queueOutgoingPacket(buildPropertiesPacket(member.entity, ownProperties));
+        }
+    });
+
+    // one stream per observed target, no matter how many observers it has
+    std::lock_guard<std::mutex> lock(mObserverMutex);
+    bool sweep = mTickNumber % const_aoiSweepInterval == 0;
+    for (auto& stream : mObserverStreams)
+        stream.record(mTickNumber, mTime, mEntities, mReplicationSettings, getAoiRadius(), const_messageSizes, sweep);
+}
+
+void Zone::buildSpawnPacket(uint32_t index)
+{
+    EntityId id = mEntities.getIds()[index];
+    std::shared_ptr<Packet>& packet = mSpawnPackets[EntityRegistry::getSlot(id)];
+
+    if (packet)
+        return;
+
+    packet = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_SPAWN);
+    packet->setTick(mTickNumber);
+    *packet << id;
+    *packet << (uint8_t)mEntities.getTypes()[index];
+    *packet << mEntities.getExtents()[index];
+}
+
+std::shared_ptr<Packet> Zone::buildPropertiesPacket(uint32_t index, ReplicatedProperties::Mask mask)
+{
+    std::shared_ptr<Packet> packet = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_PROPERTIES);
+    packet->setTick(mTickNumber);
+    *packet << mEntities.getIds()[index];
+    *packet << mask;
+    ReplicatedProperties::write(*packet, mEntities, index, mask);
+
+    return packet;
+}
+
+uint64_t Zone::getCellKey(int32_t cellX, int32_t cellZ)
+{
+    return ((uint64_t)(uint32_t)cellX << 32) | (uint32_t)cellZ;
+}
+
+int32_t Zone::getCellCoordinate(float position)
+{
+    float coordinate = std::floor(position / mReplicationCellSize);
+
+    // the cast is undefined for values out of the range of int32_t, NaN ends up in the first cell
+    if (!(coordinate >= -const_maxCellCoordinate))
+        coordinate = -const_maxCellCoordinate;
+    else if (coordinate > const_maxCellCoordinate)
+        coordinate = const_maxCellCoordinate;
+
+    return (int32_t)coordinate;
+}
+
+void Zone::buildCellFrames()
+{
+    // the cells around a player contain everything within it's leave radius
+    mReplicationCellSize = getAoiRadius() * mReplicationSettings.leaveRadiusFactor;
+
+    uint32_t memberCount = 0;
+    for (auto& region : mRegions)
+        memberCount += (uint32_t)region.members.size();
+
+    if (memberCount < const_crowdedCellPlayers)
+        return;
+
+    for (auto& region : mRegions)
+    {
+        for (auto& member : region.members)
+            mReplicationCells[getCellKey(getCellCoordinate(member.x), getCellCoordinate(member.z))].playerCount++;
+    }
+
+    std::vector<uint64_t> crowdedCells;
+    for (auto& cell : mReplicationCells)
+    {
+        if (cell.second.playerCount >= const_crowdedCellPlayers)
+        {
+            cell.second.crowded = true;
+            crowdedCells.push_back(cell.first);
+        }
+    }
+
+    if (crowdedCells.empty())
+        return;
+
+    for (uint64_t key : crowdedCells)
+    {
+        int32_t cellX = (int32_t)(key >> 32);
+        int32_t cellZ = (int32_t)(uint32_t)key;
+
+        for (int32_t z = cellZ - 1; z <= cellZ + 1; z++)
+        {
+            for (int32_t x = cellX - 1; x <= cellX + 1; x++)
+            {
+                ReplicationCell& cell = mReplicationCells[getCellKey(x, z)];
+                if (!cell.framed)
+                {
+                    cell.framed = true;
+                    mFramedCells.push_back(&cell);
+                }
+            }
+        }
+    }
+
+    for (auto& region : mRegions)
+    {
+        for (auto& member : region.members)
+            member.framed = mReplicationCells[getCellKey(getCellCoordinate(member.x), getCellCoordinate(member.z))].crowded;
+    }
+
+    const uint32_t* dirty = mEntities.getDirty();
+    const float* positionX = mEntities.getPositionX();
+    const float* positionZ = mEntities.getPositionZ();
+
+    for (uint32_t index = 0; index < mEntities.size(); index++)
+    {
+        if ((dirty[index] & EntityRegistry::DIRTY_POSITION) == 0)
+            continue;
+
+        auto cell = mReplicationCells.find(getCellKey(getCellCoordinate(positionX[index]), getCellCoordinate(positionZ[index])));
+        if (cell != mReplicationCells.end() && cell->second.framed)
+            cell->second.entities.push_back(index);
+    }
+
+    // the same moves as in the position updates, many per packet
+    auto buildFrames = [this](uint32_t cellIndex) {
+        ReplicationCell& cell = *mFramedCells[cellIndex];
+        uint32_t entityCount = (uint32_t)cell.entities.size();
+
+        for (uint32_t begin = 0; begin < entityCount; begin += const_maxFrameMoves)
+        {
+            uint32_t end = std::min(entityCount, begin + const_maxFrameMoves);
+
+            std::shared_ptr<Packet> packet = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_CELL_FRAME);
+            packet->setTick(mTickNumber);
+            *packet << (uint16_t)(end - begin);
+
+            for (uint32_t entity = begin; entity < end; entity++)
+            {
+                uint32_t index = cell.entities[entity];
+                *packet << mEntities.getIds()[index];
+                *packet << mEntities.getPositionX()[index];
+                *packet << mEntities.getPositionY()[index];
+                *packet << mEntities.getPositionZ()[index];
+                *packet << mEntities.getVelocityX()[index];
+                *packet << mEntities.getVelocityY()[index];
+                *packet << mEntities.getVelocityZ()[index];
+            }
+
+            cell.frames.push_back(std::move(packet));
+            cell.frameSize += const_frameHeaderSize + (end - begin) * const_frameMoveSize;
+        }
+    };
+
+    if (mFramedCells.size() <= 1 || sWorkerPool == nullptr)
+    {
+        for (uint32_t cellIndex = 0; cellIndex < mFramedCells.size(); cellIndex++)
+            buildFrames(cellIndex);
+    }
+    else
+    {
+        sWorkerPool->parallelFor((uint32_t)mFramedCells.size(), buildFrames);
+    }
+
+    uint32_t frameCount = 0;
+    for (auto cell : mFramedCells)
+        frameCount += (uint32_t)cell->frames.size();
+
+    *mCellFrameMetric += frameCount;
+}
+
+void Zone::queueCellFrames(PlayerSession* session, float x, float z)
+{
+    int32_t cellX = getCellCoordinate(x);
+    int32_t cellZ = getCellCoordinate(z);
+
+    for (int32_t neighbourZ = cellZ - 1; neighbourZ <= cellZ + 1; neighbourZ++)
+    {
+        for (int32_t neighbourX = cellX - 1; neighbourX <= cellX + 1; neighbourX++)
+        {
+            auto cell = mReplicationCells.find(getCellKey(neighbourX, neighbourZ));
+            if (cell == mReplicationCells.end())
+                continue;
+
+            for (auto& frame : cell->second.frames)
+                session->queueOutgoingPacket(frame);
+        }
+    }
+}
+
+void Zone::forEachReplicationChunk(const std::function<void(uint32_t)>& function)
+{
+    if (mReplicationChunks.size() <= 1 || sWorkerPool == nullptr)
+    {
+        for (uint32_t chunkIndex = 0; chunkIndex < mReplicationChunks.size(); chunkIndex++)
+            function(chunkIndex);
+    }
+    else
+    {
+        sWorkerPool->parallelFor((uint32_t)mReplicationChunks.size(), function);
+    }
+}
+
+void Zone::flush()
+{
+    for (auto& session : mSessions)
+        session->flushOutgoingPackets();
+
+    for (auto& packet : mEntityPackets)
+        packet.reset();
+
+    for (auto& packet : mPropertyPackets)
+        packet.reset();
+
+    mReplicationCells.clear();
+    mFramedCells.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(mObserverMutex);
+
+        uint32_t observerPacketCount = 0;
+        for (auto& stream : mObserverStreams)
+            observerPacketCount += stream.send(mTime);
+
+        *mObserverPacketMetric += observerPacketCount;
+
+        mObserverStreams.erase(std::remove_if(mObserverStreams.begin(), mObserverStreams.end(),
+                                              [](ObserverStream& stream) { return !stream.hasViewers(); }),
+                               mObserverStreams.end());
+    }
+
+    mEntities.clearDirty();
+
+    processHandoffs();
+}
+
+void Zone::addSession(PlayerSession* playerSession)
+{
+    mSessionCount++;
+
     {
         std::lock_guard<std::mutex> lock(mSessionListMutex);
+        mSessionList.push_front(playerSession);
+        addPlayerEntity(playerSession);
+        playerSession->setZone(this);
+    }
 
-        for (auto& session : mSessionList)
+    wake();
+}
+
+bool Zone::tryAddSession(PlayerSession* playerSession)
+{
+    // reserve a place first, so parallel assignments can't exceed the capacity
+    uint32_t sessionCount = mSessionCount;
+    do
+    {
+        if (mCapacity != 0 && sessionCount >= mCapacity)
+            return false;
+    }
+    while (!mSessionCount.compare_exchange_weak(sessionCount, sessionCount + 1));
+
+    {
+        std::lock_guard<std::mutex> lock(mSessionListMutex);
+        mSessionList.push_front(playerSession);
+        addPlayerEntity(playerSession);
+        playerSession->setZone(this);
+    }
+
+    wake();
+
+    return true;
+}
+
+void Zone::scheduleTimer(TimePoint delay, std::function<void()> callback, bool deferrable)
+{
+    mNewTimers.enqueue({getTimeMicroseconds() + (uint64_t)delay * 1000, std::move(callback), deferrable});
+    wake();
+}
+
+void Zone::processTimers()
+{
+    Timer timer;
+
+    while (mNewTimers.try_dequeue(timer))
+    {
+        mTimers.push_back(std::move(timer));
+        std::push_heap(mTimers.begin(), mTimers.end());
+    }
+
+    uint64_t currentTime = getTimeMicroseconds();
+    bool defer = mDegradation.getQuality().deferNonCritical;
+    std::vector<Timer> deferredTimers;
+
+    while (!mTimers.empty() && mTimers.front().time <= currentTime)
+    {
+        std::pop_heap(mTimers.begin(), mTimers.end());
+        timer = std::move(mTimers.back());
+        mTimers.pop_back();
+
+        if (defer && timer.deferrable)
         {
-            session->update(difference);
+            timer.time = currentTime + const_deferDelay * 1000;
+            deferredTimers.push_back(std::move(timer));
+            continue;
         }
+
+        timer.callback();
+    }
+
+    for (auto& deferredTimer : deferredTimers)
+    {
+        mTimers.push_back(std::move(deferredTimer));
+        std::push_heap(mTimers.begin(), mTimers.end());
     }
+
+    mNextTimerTime = mTimers.empty() ? UINT64_MAX : mTimers.front().time;
 }
 
-void Zone::sendPositionUpdate(PlayerSession* session, float x, float y, float z)
+void Zone::wake()
 {
-    for (auto& sessionIterator : mSessionList)
+    mWoken = true;
+
+    ZonePool* zonePool = mZonePool;
+
+    if (zonePool != nullptr)
+        zonePool->wake();
+}
+
+void Zone::removeSession(PlayerSession* playerSession)
+{
+    std::lock_guard<std::mutex> lock(mSessionListMutex);
+
+    auto previous = mSessionList.before_begin();
+    for (auto iterator = mSessionList.begin(); iterator != mSessionList.end(); previous = iterator++)
     {
-        if (sessionIterator == session)
+        if (*iterator == playerSession)
+        {
+            mSessionList.erase_after(previous);
+            removePlayerEntity(playerSession);
+            mSessionCount--;
+            return;
+        }
+    }
+
+    // not adopted yet, so it's still in the handoff queue
+    mDepartedSessions.push_back(playerSession);
+}
+
+void Zone::addObserver(PlayerSession* playerSession, EntityId target, uint64_t delay)
+{
+    {
+        std::lock_guard<std::mutex> lock(mObserverMutex);
+
+        // observers of the same target with the same delay share the stream
+        auto stream = std::find_if(mObserverStreams.begin(), mObserverStreams.end(), [target, delay](ObserverStream& stream) {
+            return stream.getTarget() == target && stream.getDelay() == delay;
+        });
+
+        if (stream == mObserverStreams.end())
+        {
+            mObserverStreams.emplace_back(target, delay);
+            stream = mObserverStreams.end() - 1;
+        }
+
+        stream->addViewer(playerSession);
+        mObserverCount++;
+    }
+
+    wake();
+}
+
+void Zone::removeObserver(PlayerSession* playerSession)
+{
+    std::lock_guard<std::mutex> lock(mObserverMutex);
+
+    for (auto& stream : mObserverStreams)
+    {
+        if (stream.removeViewer(playerSession))
+        {
+            mObserverCount--;
+            return;
+        }
+    }
+}
+
+void Zone::adoptHandoffs()
+{
+    Handoff handoff;
+
+    while (mIncomingHandoffs.try_dequeue(handoff))
+    {
+        auto departed = std::find(mDepartedSessions.begin(), mDepartedSessions.end(), handoff.session);
+        if (departed != mDepartedSessions.end())
+        {
+            // disconnected during the handoff
+            mDepartedSessions.erase(departed);
+            continue;
+        }
+
+        handoff.session->readZoneState(handoff.state, mTickNumber);
+        mSessionList.push_front(handoff.session);
+        addPlayerEntity(handoff.session);
+        mSessionCount++;
+    }
+}
+
+void Zone::processHandoffs()
+{
+    auto previous = mSessionList.before_begin();
+    auto iterator = mSessionList.begin();
+
+    while (iterator != mSessionList.end())
+    {
+        PlayerSession* session = *iterator;
+        Zone* destination = session->takeHandoffTarget();
+
+        // a session being deleted stays until it's removed
+        if (destination == nullptr || destination == this || !session->beginHandoff())
+        {
+            previous = iterator++;
             continue;
+        }
 
-        std::shared_ptr<Packet> packet = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::SC_MOVEPACKET);
-        Packet& packetp = *packet.get();
-        packetp << x;
-        packetp << y;
-        packetp << z;
+        ByteBuffer state;
+        session->writeZoneState(state);
+
+        iterator = mSessionList.erase_after(previous);
+        removePlayerEntity(session);
+        mSessionCount--;
 
-        sessionIterator->sendPacket(packet);
+        // the session must be queued before it points to the destination, see removeSession
+        destination->receiveHandoff(session, std::move(state));
+        session->finishHandoff(destination);
+
+        mHandoffCount++;
     }
-}
\ No newline at end of file
+}
+
+void Zone::tick(uint64_t currentTime)
+{
+    if (mHibernating)
+    {
+        // the time spent hibernating isn't simulated
+        mHibernating = false;
+        mTickScheduler.reset(currentTime);
+        mDifferenceRemainder = 0;
+        resetDegradation();
+    }
+
+    uint32_t tickRate = mSessionCount == 0 ? mIdleTickRate : mTickRate;
+    if (tickRate != mScheduledTickRate)
+    {
+        mTickScheduler.setTickRate(tickRate);
+        mScheduledTickRate = tickRate;
+    }
+
+    // update() works with milliseconds, the rest is passed on with the next tick
+    uint64_t difference = mTickScheduler.beginTick(currentTime) + mDifferenceRemainder;
+    mDifferenceRemainder = difference % 1000000;
+
+    update((TimePoint)(difference / 1000000));
+
+    uint64_t endTime = getTimeNanoseconds();
+    mTickScheduler.endTick(endTime);
+
+    recordTickCost((uint32_t)((endTime - currentTime) / 1000));
+
+    updateDegradation(endTime - currentTime);
+}
+
+void Zone::updateDegradation(uint64_t tickDuration)
+{
+    // the tick itself must fit into it's period, and all Zones of the pool must fit onto one core
+    float load = (float)tickDuration / mTickScheduler.getPeriod();
+
+    ZonePool* zonePool = mZonePool;
+    if (zonePool != nullptr)
+        load = std::max(load, (float)zonePool->getLoad() / ZonePool::getLoadBudget());
+
+    uint32_t previousLevel = mDegradation.getLevel();
+
+    if (!mDegradation.update(load))
+        return;
+
+    uint32_t level = mDegradation.getLevel();
+    const DegradationController::Quality& quality = mDegradation.getQuality();
+
+    if (previousLevel == 0)
+        mDegradedZoneCount++;
+    else if (level == 0)
+        mDegradedZoneCount--;
+
+    mDegradationChangeCount++;
+
+    log->info("Zone {}: load at {}% of the budget, quality level {} -> {} "
+              "(distant updates every {}, AOI radius {}, non-critical work {})",
+              mId, (uint32_t)(load * 100), previousLevel, level,
+              quality.distantUpdateInterval, getAoiRadius(), quality.deferNonCritical ? "deferred" : "running");
+}
+
+void Zone::resetDegradation()
+{
+    if (mDegradation.getLevel() == 0)
+        return;
+
+    log->info("Zone {}: quality level {} -> 0", mId, mDegradation.getLevel());
+
+    mDegradation.reset();
+    mDegradedZoneCount--;
+    mDegradationChangeCount++;
+}
+
+bool Zone::isDue(uint64_t currentTime)
+{
+    uint64_t nextTimerTime = getNextTimerTime();
+    bool timerDue = nextTimerTime != UINT64_MAX && nextTimerTime * 1000 <= currentTime;
+
+    // players arriving in an idle Zone switch it to the full tick rate
+    bool activated = mWoken.exchange(false) && mSessionCount != 0 && mScheduledTickRate != mTickRate;
+
+    // leaving hibernation, a timer due before the next regular tick or new players don't wait for it,
+    // other wake ups keep the phase, so the Zone doesn't tick faster than it's rate
+    if (mHibernating || timerDue || activated)
+        mTickScheduler.rescheduleNow(currentTime);
+
+    return currentTime >= mTickScheduler.getNextTick();
+}
+
+uint64_t Zone::getNextUpdateTime()
+{
+    uint64_t nextTimerTime = getNextTimerTime();
+    uint64_t nextUpdateTime = nextTimerTime == UINT64_MAX ? UINT64_MAX : nextTimerTime * 1000;
+
+    if (mHibernating)
+        return nextUpdateTime;
+
+    return std::min(nextUpdateTime, mTickScheduler.getNextTick());
+}
+
+void Zone::updatePartition(uint32_t sessionCount, TimePoint difference)
+{
+    mPartitionAge += difference;
+
+    bool isSplit = mPartition.getRegionCount() > 1;
+
+    if (isSplit && sessionCount < const_mergeThreshold)
+    {
+        log->info("Zone {}: merging {} regions, {} players left", mId, mPartition.getRegionCount(), sessionCount);
+
+        mPartition.reset();
+        return;
+    }
+
+    // rebalancing the regions is non-critical, a split is not
+    TimePoint rebuildInterval = const_partitionRebuildInterval;
+    if (mDegradation.getQuality().deferNonCritical)
+        rebuildInterval *= const_deferredRebuildFactor;
+
+    if ((!isSplit && sessionCount > const_regionCapacity) || (isSplit && mPartitionAge >= rebuildInterval))
+    {
+        std::vector<ZonePartition::Point> points;
+        points.reserve(sessionCount);
+
+        PlayerSession* const* owners = mEntities.getOwners();
+
+        // the regions are sized for the players, they do most of the work
+        for (uint32_t index = 0; index < mEntities.size(); index++)
+        {
+            if (owners[index] != nullptr)
+                points.push_back({mEntities.getPositionX()[index], mEntities.getPositionZ()[index]});
+        }
+
+        uint32_t maxRegions = const_maxRegions;
+        if (sWorkerPool != nullptr)
+            maxRegions = std::min(maxRegions, sWorkerPool->getThreadCount() + 1);
+
+        uint32_t previousRegionCount = mPartition.getRegionCount();
+
+        mPartition.build(points, const_regionCapacity, maxRegions);
+        mPartitionAge = 0;
+
+        if (mPartition.getRegionCount() != previousRegionCount)
+            log->info("Zone {}: now {} regions for {} players", mId, mPartition.getRegionCount(), sessionCount);
+    }
+}
+
+void Zone::assignRegions()
+{
+    uint32_t regionCount = mPartition.getRegionCount();
+
+    mRegions.resize(regionCount);
+    for (auto& region : mRegions)
+        region.clear();
+
+    uint32_t entityCount = mEntities.size();
+    PlayerSession* const* owners = mEntities.getOwners();
+    const uint32_t* dirty = mEntities.getDirty();
+    const float* positionX = mEntities.getPositionX();
+    const float* positionY = mEntities.getPositionY();
+    const float* positionZ = mEntities.getPositionZ();
+
+    // a sweep adds every entity to the area of interest of the players around it, also those which never move,
+    // or stood still beyond the leave radius while the player was away
+    bool sweep = mTickNumber % const_aoiSweepInterval == 0;
+
+    for (uint32_t index = 0; index < entityCount; index++)
+    {
+        bool changed = sweep || (dirty[index] & (EntityRegistry::DIRTY_POSITION | EntityRegistry::DIRTY_PROPERTIES)) != 0;
+
+        // entities without a player only matter when they moved or their properties changed
+        if (owners[index] == nullptr && !changed)
+            continue;
+
+        Region& region = mRegions[mPartition.findRegion(positionX[index], positionZ[index])];
+
+        if (owners[index] != nullptr)
+            region.members.push_back({owners[index], index, positionX[index], positionY[index], positionZ[index], false});
+
+        if (changed)
+            region.addSender(index, positionX[index], positionZ[index]);
+    }
+
+    if (regionCount == 1)
+        return;
+
+    float aoiRadius = getAoiRadius();
+    float squaredAoiRadius = aoiRadius * aoiRadius;
+
+    // the senders of the region itself, the mirrored ones are appended behind them
+    std::vector<uint32_t> ownSenderCounts(regionCount);
+    for (uint32_t regionIndex = 0; regionIndex < regionCount; regionIndex++)
+        ownSenderCounts[regionIndex] = (uint32_t)mRegions[regionIndex].senderEntities.size();
+
+    std::vector<uint32_t> candidates;
+
+    // mirror every changed entity into the neighbouring regions it can be seen from
+    for (uint32_t regionIndex = 0; regionIndex < regionCount; regionIndex++)
+    {
+        Region& region = mRegions[regionIndex];
+        candidates.resize(ownSenderCounts[regionIndex]);
+
+        for (uint32_t neighbourIndex = 0; neighbourIndex < regionCount; neighbourIndex++)
+        {
+            if (neighbourIndex == regionIndex)
+                continue;
+
+            const ZonePartition::Bounds& bounds = mPartition.getRegionBounds(neighbourIndex);
+
+            // the bounds grown by the radius contain everything near enough, the corners are checked exactly
+            uint32_t candidateCount = SimdKernels::filterInBounds(ownSenderCounts[regionIndex], region.senderX.data(), region.senderZ.data(),
+                                                                  bounds.minX - aoiRadius, bounds.minZ - aoiRadius,
+                                                                  bounds.maxX + aoiRadius, bounds.maxZ + aoiRadius, candidates.data());
+
+            for (uint32_t candidate = 0; candidate < candidateCount; candidate++)
+            {
+                uint32_t senderIndex = candidates[candidate];
+                float x = region.senderX[senderIndex];
+                float z = region.senderZ[senderIndex];
+
+                if (bounds.squaredDistance(x, z) <= squaredAoiRadius)
+                    mRegions[neighbourIndex].addSender(region.senderEntities[senderIndex], x, z);
+            }
+        }
+    }
+}
+
+void Zone::replicateTo(const Region& region, const RegionMember& recipient, std::vector<uint32_t>& candidates)
+{
+    ReplicationScheduler& scheduler = recipient.session->getReplicationScheduler();
+
+    Connection* connection = recipient.session->getConnection();
+    if (connection != nullptr)
+        scheduler.updateBudget(connection->getSendQueueSize());
+
+    float aoiRadius = getAoiRadius();
+    float squaredAoiRadius = aoiRadius * aoiRadius;
+    const EntityId* ids = mEntities.getIds();
+
+    uint32_t senderCount = (uint32_t)region.senderEntities.size();
+    candidates.resize(senderCount);
+
+    uint32_t candidateCount = SimdKernels::filterWithinRadius(senderCount, region.senderX.data(), region.senderZ.data(),
+                                                              recipient.x, recipient.z, squaredAoiRadius, candidates.data());
+
+    // the cells around a crowded player, the frames are only sent if the player can take them
+    const ReplicationCell* framedCells[9];
+    uint32_t framedCellCount = 0;
+    uint32_t frameEntityCount = 0;
+    uint32_t frameSize = 0;
+
+    if (recipient.framed)
+    {
+        int32_t cellX = getCellCoordinate(recipient.x);
+        int32_t cellZ = getCellCoordinate(recipient.z);
+
+        for (int32_t neighbourZ = cellZ - 1; neighbourZ <= cellZ + 1; neighbourZ++)
+        {
+            for (int32_t neighbourX = cellX - 1; neighbourX <= cellX + 1; neighbourX++)
+            {
+                auto cell = mReplicationCells.find(getCellKey(neighbourX, neighbourZ));
+                if (cell == mReplicationCells.end())
+                    continue;
+
+                framedCells[framedCellCount++] = &cell->second;
+                frameEntityCount += (uint32_t)cell->second.entities.size();
+                frameSize += cell->second.frameSize;
+            }
+        }
+    }
+
+    scheduler.begin(mTickNumber, mTime, candidateCount + frameEntityCount);
+
+    for (uint32_t candidate = 0; candidate < candidateCount; candidate++)
+    {
+        uint32_t senderIndex = candidates[candidate];
+        uint32_t entity = region.senderEntities[senderIndex];
+
+        if (entity == recipient.entity)
+            continue;
+
+        scheduler.addUpdate(ids[entity]);
+    }
+
+    // the moves in the frames, of entities the player may not know yet too
+    for (uint32_t cellIndex = 0; cellIndex < framedCellCount; cellIndex++)
+    {
+        for (uint32_t entity : framedCells[cellIndex]->entities)
+        {
+            if (entity != recipient.entity)
+                scheduler.addUpdate(ids[entity], true);
+        }
+    }
+
+    // distant entities are updated even less often while the Zone sheds load
+    scheduler.schedule(mEntities, mReplicationSettings, recipient.x, recipient.z, aoiRadius, recipient.session->getPartyId(),
+                       mDegradation.getQuality().distantUpdateInterval, const_messageSizes, frameSize);
+}
@@ -1,60 +1,915 @@
 #pragma once
 
+#include <atomic>
 #include <forward_list>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
+#include "concurrentqueue/concurrentqueue.h"
+
+#include "Broadphase.h"
+#include "DegradationController.h"
+#include "EntityRegistry.h"
+#include "MovementValidator.h"
+#include "NpcSystem.h"
+#include "ObserverStream.h"
+#include "PathfindingService.h"
+#include "PositionHistory.h"
+#include "ReplicationScheduler.h"
+#include "ZonePartition.h"
+#include "Network/ByteBuffer.h"
+#include "utility/TickScheduler.h"
 #include "utility/utility.h"
 
+class Packet;
 class PlayerSession;
+class ZonePool;
 
 /**
  * @brief Represents a Zone containg multiple objects which need periodical updates
  *
  * A Zone can hold multiple objects like Players, Monsters etc.
+ * All of them are entities in the EntityRegistry of the Zone, every
+ * PlayerSession controls the entity of it's player.
  *
  * All objects will be periodically updated. Also the Zone (and the accociated PlayerSessions)
  * take care of processing packets.
  *
  * A Zone belongs to a ZonePool, which will update the Zone
+ *
+ * A tick runs in phases (see TickPhase): first the packets of all players are
+ * processed, then the world is simulated, then the updates for every player are
+ * collected and finally all of them are sent at once. Input and replication
+ * are spread over the WorkerPool, replication only reads the Zone.
+ *
+ * Every Zone has it's own tick rate, e.g. 60 Hz for arenas and 10 Hz for towns.
+ * The ZonePool interleaves the ticks of all it's Zones on one timeline.
+ *
+ * When a Zone gets crowded, it splits it's space into regions (see ZonePartition),
+ * which are replicated in parallel by the WorkerPool. Moving PlayerSessions near the
+ * border of a region are mirrored into the neighbouring regions, so the players
+ * there still receive everything within their area of interest. When the crowd leaves,
+ * the regions are merged again.
+ *
+ * PlayerSessions can be handed off to another Zone (see PlayerSession::requestHandoff).
+ * The source Zone serializes the state of the session at the end of it's tick and
+ * stops updating it, the destination Zone adopts it at the start of it's next tick.
+ * Packets arriving in between stay queued in the PlayerSession and are processed
+ * by the destination Zone.
+ *
+ * The NPCs of a Zone are simulated by it's NpcSystem, their movement is replicated
+ * like the movement of players.
+ *
+ * After moving the entities, the Broadphase finds the pairs of entities whose
+ * collision boxes overlap, for the collision checks of the game logic. The
+ * NpcSystem uses them to push overlapping NPCs apart.
+ *
+ * Paths on the NavigationGrid of the Zone are searched by the WorkerPool in the
+ * background, the results are delivered at the start of the simulation of a later tick.
+ *
+ * A Zone without players, incoming handoffs and due timers hibernates:
+ * it's not updated by the ZonePool until a player arrives or a timer is due.
+ * Zones which must not hibernate tick with their idle tick rate without players.
+ *
+ * When a Zone can't keep up with it's tick rate, or it's ZonePool is overloaded,
+ * the DegradationController lowers the quality of the Zone until the load drops:
+ * distant players receive less position updates, the area of interest shrinks
+ * and deferrable timers are postponed.
+ *
+ * Where hundreds of players crowd together, they would all be sent the same
+ * updates one by one. Instead the moves inside every cell of a coarse grid around
+ * such crowds are written once per tick into shared cell frames, and the players
+ * there receive the frames of the cells around them, as long as the frames fit
+ * into their budget. Only the spawns and despawns are still sent to every
+ * player by itself, the spawns of the entities in the frames before them.
+ *
+ * Sessions can observe the Zone or an entity in it without an entity of their
+ * own, e.g. spectators and game masters (see PlayerSession::observe). All
+ * observers of the same target share one ObserverStream, which is built once
+ * per tick no matter how many observers it has.
  */
 class Zone
 {
+public:
+    /**
+     * The phases of a tick, in order
+     */
+    enum class TickPhase
+    {
+        /// processing the packets of all players
+        INPUT,
+        /// timers, regions and everything else changing the world
+        SIMULATE,
+        /// collecting the updates for every player, read-only
+        REPLICATE,
+        /// sending the collected packets and handing off players
+        FLUSH,
+        COUNT,
+    };
+
+private:
+    /**
+     * An entity inside a region with it's position in the current tick
+     */
+    struct RegionMember
+    {
+        /// the controlling player, nullptr if none
+        PlayerSession* session;
+
+        /// dense index in the EntityRegistry
+        uint32_t entity;
+
+        float x, y, z;
+
+        /// true if the player may receive the frames of the cells around it, if they fit into it's budget, see ReplicationCell
+        bool framed;
+    };
+
+    /**
+     * A part of the Zone, replicated in parallel to the other regions
+     */
+    struct Region
+    {
+        /// Players inside the region, receiving updates from the region
+        std::vector<RegionMember> members;
+
+        /// Entities which moved or changed their properties in this tick, all entities in a sweep, inside the region or near
+        /// it's border in a neighbouring region. Dense indices and positions as separate arrays, for the SimdKernels
+        std::vector<uint32_t> senderEntities;
+        std::vector<float> senderX;
+        std::vector<float> senderZ;
+
+        void clear()
+        {
+            members.clear();
+            senderEntities.clear();
+            senderX.clear();
+            senderZ.clear();
+        }
+
+        void addSender(uint32_t entity, float x, float z)
+        {
+            senderEntities.push_back(entity);
+            senderX.push_back(x);
+            senderZ.push_back(z);
+        }
+    };
+
+    /**
+     * A PlayerSession on the way to this Zone with it's serialized state
+     */
+    struct Handoff
+    {
+        PlayerSession* session;
+        ByteBuffer state;
+    };
+
+    /**
+     * A function to be called by the Zone thread at a specific time
+     */
+    struct Timer
+    {
+        /// time in microseconds when the timer is due
+        uint64_t time;
+
+        std::function<void()> callback;
+
+        /// true if the timer is postponed while the Zone sheds load
+        bool deferrable;
+
+        /// for ordering a heap by the earliest time
+        bool operator<(const Timer& other) const { return time > other.time; }
+    };
+
+    /// Unique id of the Zone
+    uint32_t mId;
+
+    /// true for Zones created on demand, e.g. dungeons
+    bool mInstance = false;
+
+    /// The ZonePool updating this Zone
+    std::atomic<ZonePool*> mZonePool{nullptr};
+
+    /// Maximum number of PlayerSessions for assignments, 0 for no limit
+    std::atomic<uint32_t> mCapacity{0};
+
+    /// Number of PlayerSessions in this Zone
+    std::atomic<uint32_t> mSessionCount{0};
+
     /// For protecting the list of PlayerSessions
     std::mutex mSessionListMutex;
 
     /// List of PlayerSessions accociated with this Zone
     std::forward_list<PlayerSession*> mSessionList;
 
+    /// PlayerSessions handed off to this Zone, adopted on the next tick
+    moodycamel::ConcurrentQueue<Handoff> mIncomingHandoffs;
+
+    /// PlayerSessions removed while they were still in mIncomingHandoffs, protected by mSessionListMutex
+    std::vector<PlayerSession*> mDepartedSessions;
+
+    /// For protecting mObserverStreams, only held while recording and sending, so sessions of any Zone can observe any Zone
+    std::mutex mObserverMutex;
+
+    /// One stream per observed target and delay, protected by mObserverMutex
+    std::vector<ObserverStream> mObserverStreams;
+
+    /// Number of sessions observing this Zone
+    std::atomic<uint32_t> mObserverCount{0};
+
+    /// Timers added by scheduleTimer(), moved into mTimers on the next update
+    moodycamel::ConcurrentQueue<Timer> mNewTimers;
+
+    /// Heap of all pending timers, earliest first
+    std::vector<Timer> mTimers;
+
+    /// Time in microseconds of the earliest pending timer, UINT64_MAX if none
+    std::atomic<uint64_t> mNextTimerTime{UINT64_MAX};
+
+    /// Number of PlayerSessions handed off to other Zones
+    std::atomic<int64_t>& mHandoffCount;
+
+    /// Number of Zones with lowered quality, shared by all Zones
+    std::atomic<int64_t>& mDegradedZoneCount;
+
+    /// Number of quality changes of all Zones
+    std::atomic<int64_t>& mDegradationChangeCount;
+
+    /// Number of positions of players rejected by the MovementValidators of all Zones
+    std::atomic<int64_t>& mRejectedMovementCount;
+
+    /// Updates of this Zone not sent because of the LOD bands or because the clients extrapolate them,
+    /// and the bytes saved by that. Pointers, the names depend on the id, see registerMetrics()
+    std::atomic<int64_t>* mLodSkippedMetric;
+    std::atomic<int64_t>* mExtrapolatedMetric;
+    std::atomic<int64_t>* mSavedBytesMetric;
+
+    /// Entities appearing and disappearing for players of this Zone
+    std::atomic<int64_t>* mSpawnMetric;
+    std::atomic<int64_t>* mDespawnMetric;
+
+    /// Frames written for the cells around crowds
+    std::atomic<int64_t>* mCellFrameMetric;
+
+    /// Packets sent to the observers of this Zone
+    std::atomic<int64_t>* mObserverPacketMetric;
+
+    /// Ticks per second while the Zone has players
+    std::atomic<uint32_t> mTickRate;
+
+    /// Ticks per second while the Zone has no players
+    std::atomic<uint32_t> mIdleTickRate;
+
+    /// false if the Zone keeps ticking without players
+    std::atomic<bool> mHibernationAllowed{true};
+
+    /// Schedule of the ticks on the timeline of the ZonePool, only used by the ZonePool thread
+    TickScheduler mTickScheduler;
+
+    /// Tick rate mTickScheduler currently uses
+    std::atomic<uint32_t> mScheduledTickRate;
+
+    /// Nanoseconds of the tick differences which were not passed to update() yet (below a millisecond)
+    uint64_t mDifferenceRemainder = 0;
+
+    /// true while the ZonePool skips the Zone, only used by the ZonePool thread
+    bool mHibernating = false;
+
+    /// Set by wake(), a Zone at it's idle tick rate with new players is updated as soon as possible
+    std::atomic<bool> mWoken{false};
+
+    /// Smoothed duration of update() in microseconds
+    std::atomic<uint32_t> mTickCost{0};
+
+    /// Time of the last move to another ZonePool in milliseconds, 0 if never moved
+    TimePoint mLastMigrationTime = 0;
+
+    /// All entities of the Zone, only changed by the Zone thread or with mSessionListMutex locked
+    EntityRegistry mEntities;
+
+    /// Behaviour of the NPC entities, only used by the Zone thread
+    NpcSystem mNpcs;
+
+    /// Checks the positions sent by the players, read by the packet handlers
+    MovementValidator mMovementValidator;
+
+    /// Finds overlapping entities, only used by the Zone thread
+    Broadphase mBroadphase;
+
+    /// Number of the current tick, increased at the start of every update
+    uint32_t mTickNumber = 0;
+
+    /// Milliseconds simulated since the reset
+    uint64_t mTime = 0;
+
+    /// LOD bands and extrapolation error for replicating to the players
+    ReplicationScheduler::Settings mReplicationSettings;
+
+    /// Positions of the entities during the last ticks, only used by the Zone thread
+    PositionHistory mPositionHistory;
+
+    /// Searches paths on the NavigationGrid, only used by the Zone thread
+    PathfindingService mPathfinding;
+
+    /// Position update of every scheduled entity in the current tick, by dense index
+    std::vector<std::shared_ptr<Packet>> mEntityPackets;
+
+    /// Public properties which changed in the current tick, for every entity sending them by dense index
+    std::vector<std::shared_ptr<Packet>> mPropertyPackets;
+
+    /// What is sent of every entity to any player in the current tick, by dense index
+    std::vector<uint8_t> mScheduledEntities;
+
+    /// Cached spawn of every entity by slot, built when a player first needs it, reset when the entity changes
+    std::vector<std::shared_ptr<Packet>> mSpawnPackets;
+
+    /// Radius around a player in which it receives updates of others, at full quality
+    float mAoiRadius;
+
+    /// Lowers the quality while the Zone is overloaded, only used by the ZonePool thread
+    DegradationController mDegradation;
+
+    /// Split of the space into regions
+    ZonePartition mPartition;
+
+    /// Milliseconds since the partition was built
+    TimePoint mPartitionAge = 0;
+
+    /// The regions of the current tick, same order as in mPartition
+    std::vector<Region> mRegions;
+
+    /**
+     * A range of the members of a region, replicated by one worker
+     */
+    struct ReplicationChunk
+    {
+        uint32_t region;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    /**
+     * A square of the grid for replicating to crowded areas, as wide as the leave radius,
+     * so the cells around a player contain every entity it knows
+     */
+    struct ReplicationCell
+    {
+        /// players inside the cell
+        uint32_t playerCount = 0;
+
+        /// true if the cell holds enough players for receiving the frames of the cells around
+        bool crowded = false;
+
+        /// true if the cell is next to a crowded one and it's moves are written into frames
+        bool framed = false;
+
+        /// dense indices of the entities which moved inside the cell, only collected when framed
+        std::vector<uint32_t> entities;
+
+        /// the moves of the entities, shared by all players around, split when too large for one packet
+        std::vector<std::shared_ptr<Packet>> frames;
+
+        /// bytes of the frames on the wire, for the budgets of the players
+        uint32_t frameSize = 0;
+    };
+
+    /// The cells with players or frames in the current tick, by getCellKey()
+    std::unordered_map<uint64_t, ReplicationCell> mReplicationCells;
+
+    /// The framed cells of mReplicationCells, for writing their frames in parallel
+    std::vector<ReplicationCell*> mFramedCells;
+
+    /// Width of the cells in the current tick
+    float mReplicationCellSize = 0.f;
+
+    /// All PlayerSessions of the current tick, for spreading them over the workers
+    std::vector<PlayerSession*> mSessions;
+
+    /// The work of the replication phase of the current tick
+    std::vector<ReplicationChunk> mReplicationChunks;
+
+    /// Nanoseconds every phase took in the last tick
+    uint64_t mPhaseDurations[(size_t)TickPhase::COUNT] = {};
+
+    /**
+     * Gets the metrics of the Zone, which are named after it's id. All instances share
+     * theirs, so the short lived and recycled instances don't add new names to the Metrics forever.
+     */
+    void registerMetrics();
+
+    /**
+     * Splits, rebuilds or merges the partition depending on the number of players
+     * @param sessionCount current number of PlayerSessions
+     * @param difference milliseconds since the last update
+     */
+    void updatePartition(uint32_t sessionCount, TimePoint difference);
+
+    /**
+     * Sorts all PlayerSessions into the regions and mirrors the ones near a border
+     */
+    void assignRegions();
+
+    /**
+     * Processes the packets of all PlayerSessions in parallel
+     */
+    void processInput(TimePoint difference);
+
+    /**
+     * Runs the timers and sorts the players into the regions
+     */
+    void simulate(TimePoint difference);
+
+    /**
+     * Collects the updates for every PlayerSession, only reads the Zone
+     */
+    void replicate();
+
+    /**
+     * Builds the spawn of an entity unless it's cached
+     * @param index dense index of the entity
+     */
+    void buildSpawnPacket(uint32_t index);
+
+    /**
+     * Builds an update of properties of an entity
+     * @param index dense index of the entity
+     * @param mask the properties
+     */
+    std::shared_ptr<Packet> buildPropertiesPacket(uint32_t index, ReplicatedProperties::Mask mask);
+
+    /**
+     * @return key of a cell in mReplicationCells
+     */
+    static uint64_t getCellKey(int32_t cellX, int32_t cellZ);
+
+    /**
+     * @return cell coordinate of a position on one axis
+     */
+    int32_t getCellCoordinate(float position);
+
+    /**
+     * Finds the crowded cells and writes the frames of the cells around them
+     */
+    void buildCellFrames();
+
+    /**
+     * Sends the frames of the cells around a position to a player
+     * @remark only to be used by the Zone thread replicating to this player
+     */
+    void queueCellFrames(PlayerSession* session, float x, float z);
+
+    /**
+     * Runs a function for every chunk of mReplicationChunks, in parallel if there are several
+     * @param function called with the index of the chunk
+     */
+    void forEachReplicationChunk(const std::function<void(uint32_t)>& function);
+
+    /**
+     * Schedules the position and property updates of the entities within the area of interest of a player,
+     * see ReplicationScheduler
+     * @param region the region of the recipient
+     * @param recipient the receiving player
+     * @param candidates buffer for the SimdKernels, reused for all recipients of a job
+     */
+    void replicateTo(const Region& region, const RegionMember& recipient, std::vector<uint32_t>& candidates);
+
+    /**
+     * Sends the collected packets of every PlayerSession and hands off players
+     */
+    void flush();
+
+    /**
+     * Runs a function for every index in [0, count), in chunks on the WorkerPool
+     */
+    void forEachIndex(uint32_t count, const std::function<void(uint32_t)>& function);
+
+    /**
+     * Creates the entity of a player, with full health and mana
+     * @remark mSessionListMutex must be locked
+     */
+    void addPlayerEntity(PlayerSession* playerSession);
+
+    /**
+     * Destroys the entity of a player
+     * @remark mSessionListMutex must be locked
+     */
+    void removePlayerEntity(PlayerSession* playerSession);
+
+    /**
+     * Moves the entities of all players which sent a new position
+     */
+    void applyPlayerMovement();
+
+    /**
+     * Stores the duration of a phase
+     * @param phase the finished phase
+     * @param startTime time in nanoseconds the phase started
+     * @return current time in nanoseconds, the start of the next phase
+     */
+    uint64_t finishPhase(TickPhase phase, uint64_t startTime);
+
+    /**
+     * Adds all PlayerSessions which were handed off to this Zone
+     */
+    void adoptHandoffs();
+
+    /**
+     * Hands off all PlayerSessions which requested it to their destination Zone
+     */
+    void processHandoffs();
+
+    /**
+     * Calls the callbacks of all due timers
+     */
+    void processTimers();
+
+    /**
+     * Tells the ZonePool that the next update time of this Zone may have changed,
+     * e.g. it leaves hibernation or has a new timer
+     */
+    void wake();
+
+    /**
+     * Feeds the load of the last tick into the DegradationController
+     * @param tickDuration duration of the tick in nanoseconds
+     */
+    void updateDegradation(uint64_t tickDuration);
+
+    /**
+     * Goes back to the full quality
+     */
+    void resetDegradation();
+
+    /**
+     * @return radius of the area of interest at the current quality
+     */
+    float getAoiRadius() { return mAoiRadius * mDegradation.getQuality().aoiScale; }
+
 public:
-    Zone() {}
+    /**
+     * @param id unique id
+     * @param instance true if the Zone is an instance
+     */
+    Zone(uint32_t id, bool instance = false);
     ~Zone() {}
 
     /**
-     * The ZonePool will call this function for updating the whole Zone
+     * Prepares an unused Zone for being used again, see ZoneManager::createInstance
+     * @param id new unique id
+     * @param instance true if the Zone is an instance
+     * @remark the Zone must not have any PlayerSessions and must not be in a ZonePool
+     */
+    void reset(uint32_t id, bool instance);
+
+    /**
+     * @return unique id of the Zone
+     */
+    uint32_t getId() { return mId; }
+
+    /**
+     * @return true if the Zone was created on demand
+     */
+    bool isInstance() { return mInstance; }
+
+    /**
+     * @return the ZonePool updating this Zone
+     * @remark Thread-Safe
+     */
+    ZonePool* getZonePool() { return mZonePool; }
+
+    /**
+     * Sets the ZonePool, only to be called by the ZonePool
+     */
+    void setZonePool(ZonePool* zonePool) { mZonePool = zonePool; }
+
+    /**
+     * @return number of PlayerSessions in this Zone
+     * @remark Thread-Safe
+     */
+    uint32_t getSessionCount() { return mSessionCount; }
+
+    /**
+     * @return maximum number of PlayerSessions, 0 for no limit
+     * @remark Thread-Safe
+     */
+    uint32_t getCapacity() { return mCapacity; }
+
+    /**
+     * Sets the maximum number of PlayerSessions assigned by tryAddSession()
+     * @param capacity maximum number, 0 for no limit
+     */
+    void setCapacity(uint32_t capacity) { mCapacity = capacity; }
+
+    /**
+     * Updates the whole Zone
+     * @param difference milliseconds since the last update
      */
     void update(TimePoint difference);
 
+    /**
+     * The ZonePool calls this function when the Zone is due, see isDue()
+     * Updates the Zone and schedules the next tick
+     * @param currentTime time in nanoseconds
+     */
+    void tick(uint64_t currentTime);
+
+    /**
+     * @param currentTime time in nanoseconds
+     * @return true if the next tick of the Zone is due
+     * @remark only to be called by the ZonePool
+     */
+    bool isDue(uint64_t currentTime);
+
+    /**
+     * Tells the Zone it's skipped by the ZonePool, see canHibernate()
+     * @remark only to be called by the ZonePool
+     */
+    void hibernate()
+    {
+        mHibernating = true;
+        mTickCost = 0;
+    }
+
+    /**
+     * @return time in nanoseconds the Zone needs to be updated next, UINT64_MAX if never
+     * @remark only to be called by the ZonePool
+     */
+    uint64_t getNextUpdateTime();
+
+    /**
+     * @return the tick schedule of the Zone
+     * @remark only to be used by the ZonePool thread
+     */
+    TickScheduler& getTickScheduler() { return mTickScheduler; }
+
+    /**
+     * Sets the ticks per second while the Zone has players
+     * @remark Thread-Safe, used from the next tick on
+     */
+    void setTickRate(uint32_t tickRate) { mTickRate = tickRate; }
+
+    /**
+     * @return ticks per second while the Zone has players
+     */
+    uint32_t getTickRate() { return mTickRate; }
+
+    /**
+     * Sets the ticks per second while the Zone has no players but doesn't hibernate
+     * @remark Thread-Safe, used from the next tick on
+     */
+    void setIdleTickRate(uint32_t tickRate) { mIdleTickRate = tickRate; }
+
+    /**
+     * Allows or forbids hibernating without players
+     * @remark Thread-Safe
+     */
+    void setHibernationAllowed(bool allowed) { mHibernationAllowed = allowed; }
+
+    /**
+     * Sets when the quality of the Zone is lowered and restored
+     * @remark not Thread-Safe, to be called before the Zone is added to a ZonePool
+     */
+    void setDegradationSettings(const DegradationController::Settings& settings) { mDegradation.setSettings(settings); }
+
+    /**
+     * @return current quality level, 0 is the full quality
+     * @remark only to be used by the ZonePool thread
+     */
+    uint32_t getDegradationLevel() { return mDegradation.getLevel(); }
+
     /**
      * Adds a Session to this Zone and starts updating it
      * @param playerSession
      * @remark Thread-Safe
      */
-    void addSession(PlayerSession* playerSession)
+    void addSession(PlayerSession* playerSession);
+
+    /**
+     * Adds a Session to this Zone if it's capacity isn't reached yet
+     * @param playerSession
+     * @return true if the session was added
+     * @remark Thread-Safe
+     */
+    bool tryAddSession(PlayerSession* playerSession);
+
+    /**
+     * Removes a Session from this Zone and stops updating it, the session
+     * must not be handed off anymore (see PlayerSession::beginHandoff())
+     * @param playerSession
+     * @remark Thread-Safe
+     */
+    void removeSession(PlayerSession* playerSession);
+
+    /**
+     * Adds an observer, see ObserverStream
+     * @param playerSession the observing session, it has no entity in this Zone
+     * @param target the observed entity, INVALID_ENTITY for the whole Zone
+     * @param delay milliseconds the observer sees the Zone late
+     * @remark Thread-Safe
+     */
+    void addObserver(PlayerSession* playerSession, EntityId target, uint64_t delay);
+
+    /**
+     * Removes an observer, it's not sent anything afterwards
+     * @param playerSession the observing session
+     * @remark Thread-Safe
+     */
+    void removeObserver(PlayerSession* playerSession);
+
+    /**
+     * @return number of sessions observing this Zone
+     * @remark Thread-Safe
+     */
+    uint32_t getObserverCount() { return mObserverCount; }
+
+    /**
+     * @return true if sessions handed off to this Zone wait for being adopted
+     * @remark Thread-Safe
+     */
+    bool hasIncomingHandoffs() { return mIncomingHandoffs.size_approx() != 0; }
+
+    /**
+     * Queues a PlayerSession handed off by another Zone, it's adopted on the next tick
+     * @param playerSession the session, no longer updated by the source Zone
+     * @param state serialized state of the session
+     * @remark Thread-Safe, lock-free
+     */
+    void receiveHandoff(PlayerSession* playerSession, ByteBuffer state)
     {
-        std::lock_guard<std::mutex> lock(mSessionListMutex);
-        mSessionList.push_front(playerSession);
+        mIncomingHandoffs.enqueue({playerSession, std::move(state)});
+        wake();
     }
 
     /**
-     * Removes a Session from this Zone and stops updating it
-     * @param playerSession
+     * Calls a function from the Zone thread after a delay, wakes up the Zone when due
+     * @param delay delay in milliseconds
+     * @param callback function to call
+     * @param deferrable true for non-critical work, which may be postponed while the Zone sheds load
+     * @remark Thread-Safe
+     */
+    void scheduleTimer(TimePoint delay, std::function<void()> callback, bool deferrable = false);
+
+    /**
+     * @return time in microseconds of the earliest pending timer, UINT64_MAX if none
      * @remark Thread-Safe
      */
-    void removeSession(PlayerSession* playerSession)
+    uint64_t getNextTimerTime() { return mNewTimers.size_approx() > 0 ? 0 : mNextTimerTime.load(); }
+
+    /**
+     * Checks if there is nothing to do for the Zone
+     * @param currentTime current time in microseconds
+     * @return true if the Zone has no players, no observers, no incoming handoffs, no due timers and no path requests
+     * @remark only to be used by the ZonePool thread
+     */
+    bool canHibernate(uint64_t currentTime)
+    {
+        return mHibernationAllowed && mSessionCount == 0 && mObserverCount == 0 && mIncomingHandoffs.size_approx() == 0 && getNextTimerTime() > currentTime &&
+               !mPathfinding.hasRequests();
+    }
+
+    /**
+     * Adds a measured update() duration to the smoothed tick cost
+     * @param cost duration of the last update in microseconds
+     */
+    void recordTickCost(uint32_t cost)
+    {
+        // exponential moving average with a weight of 1/8 for the new sample
+        uint32_t previousCost = mTickCost;
+        mTickCost = previousCost - previousCost/8 + cost/8;
+    }
+
+    /**
+     * @return smoothed duration of update() in microseconds
+     * @remark Thread-Safe
+     */
+    uint32_t getTickCost() { return mTickCost; }
+
+    /**
+     * @return microseconds of work per second, the tick cost multiplied by the tick rate
+     * @remark Thread-Safe
+     */
+    uint32_t getLoad() { return mTickCost * mScheduledTickRate; }
+
+    /**
+     * @return time of the last move to another ZonePool in milliseconds, 0 if never moved
+     */
+    TimePoint getLastMigrationTime() { return mLastMigrationTime; }
+
+    /**
+     * Remembers when the Zone was moved to another ZonePool
+     * @param time current time in milliseconds
+     */
+    void setLastMigrationTime(TimePoint time) { mLastMigrationTime = time; }
+
+    /**
+     * Creates an entity without a player, e.g. a NPC or a projectile
+     * @param type kind of the entity
+     * @param x, y, z position
+     * @return the new EntityId
+     * @remark only to be used from the Zone thread, e.g. in timers
+     */
+    EntityId spawnEntity(EntityRegistry::Type type, float x, float y, float z);
+
+    /**
+     * Destroys an entity created with spawnEntity()
+     * @remark only to be used from the Zone thread
+     */
+    void despawnEntity(EntityId id);
+
+    /**
+     * Creates a NPC, which idles and patrols around it's home and chases players
+     * @param x, y, z home position
+     * @return the new EntityId, destroy it with despawnEntity()
+     * @remark only to be used from the Zone thread, e.g. in timers, or before the Zone is added to a ZonePool
+     */
+    EntityId spawnNpc(float x, float y, float z) { return mNpcs.spawn(mEntities, x, y, z); }
+
+    /**
+     * @return the NPCs of the Zone
+     * @remark only to be used from the Zone thread
+     */
+    NpcSystem& getNpcs() { return mNpcs; }
+
+    /**
+     * Sets the walkable area for findPath(), grids can be shared between Zones
+     * @param grid the grid, nullptr for none
+     * @remark only to be used from the Zone thread, or before the Zone is added to a ZonePool
+     */
+    void setNavigationGrid(std::shared_ptr<const NavigationGrid> grid) { mPathfinding.setGrid(std::move(grid)); }
+
+    /**
+     * Searches a path in the background
+     * @param startX, startZ start position
+     * @param endX, endZ destination
+     * @param callback receives the path in the Zone thread on a later tick, nullptr if there's none
+     * @remark only to be used from the Zone thread
+     */
+    void findPath(float startX, float startZ, float endX, float endZ, PathfindingService::Callback callback)
     {
-        std::lock_guard<std::mutex> lock(mSessionListMutex);
-        mSessionList.remove(playerSession);
+        mPathfinding.findPath(startX, startZ, endX, endZ, std::move(callback));
     }
 
-    void sendPositionUpdate(PlayerSession* session, float x, float y, float z);
+    /**
+     * @return the PathfindingService of the Zone
+     * @remark only to be used from the Zone thread
+     */
+    PathfindingService& getPathfinding() { return mPathfinding; }
+
+    /**
+     * @return the checks of the positions sent by the players
+     * @remark only to be changed from the Zone thread outside of the input phase, or before
+     * the Zone is added to a ZonePool
+     */
+    MovementValidator& getMovementValidator() { return mMovementValidator; }
+
+    /**
+     * Counts a position of a player rejected by the MovementValidator
+     * @remark Thread-Safe
+     */
+    void countRejectedMovement() { mRejectedMovementCount++; }
+
+    /**
+     * @return the entities with overlapping collision boxes after the movement of the current tick
+     * @remark only to be used from the Zone thread
+     */
+    const std::vector<Broadphase::Pair>& getCollisionPairs() { return mBroadphase.getPairs(); }
+
+    /**
+     * @return LOD bands and extrapolation error for replicating to the players
+     * @remark only to be changed from the Zone thread outside of the replication phase, or before
+     * the Zone is added to a ZonePool
+     */
+    ReplicationScheduler::Settings& getReplicationSettings() { return mReplicationSettings; }
+
+    /**
+     * @return number of the current tick, increasing by one every update
+     * @remark only to be used from the Zone thread
+     */
+    uint32_t getTickNumber() { return mTickNumber; }
+
+    /**
+     * @return the positions of the entities at the end of the last ticks, for lag compensation
+     * @remark only to be used from the Zone thread
+     */
+    PositionHistory& getPositionHistory() { return mPositionHistory; }
+
+    /**
+     * @return all entities of the Zone
+     * @remark only to be used from the Zone thread
+     */
+    EntityRegistry& getEntities() { return mEntities; }
+
+    /**
+     * @return nanoseconds the phase took in the last tick
+     * @remark only to be used by the ZonePool thread
+     */
+    uint64_t getPhaseDuration(TickPhase phase) { return mPhaseDurations[(size_t)phase]; }
+
+    /**
+     * @return name of a phase for logs and metrics
+     */
+    static const char* getPhaseName(TickPhase phase);
 };
@@ -1,23 +1,456 @@
 #include "ZoneManager.h"
 
+#include <algorithm>
+#include <cmath>
+
+#include "Heightmap.h"
+#include "NavigationGrid.h"
 #include "Zone.h"
+#include "Network/PlayerSession.h"
+#include "Metrics/Metrics.h"
+#include "Log/Logger.h"
 
 ZoneManager* ZoneManager::instance = nullptr;
 
+/// A ZonePool is overloaded when it's tick cost is above this part of the tick budget
+static const float const_overloadThreshold = 0.9f;
+/// A Zone is only moved to a ZonePool which stays below this part of the budget afterwards
+static const float const_targetThreshold = 0.7f;
+/// Number of consecutive rebalance() calls a ZonePool must be overloaded before moving a Zone
+static const uint32_t const_overrunStreak = 3;
+/// Milliseconds a Zone stays in it's ZonePool after it has been moved
+static const TimePoint const_migrationCooldown = 30000;
+/// Default maximum number of players of a Zone
+static const uint32_t const_zoneCapacity = 5000;
+/// Ticks per second of instances, their fights are smaller and faster than in the open world
+static const uint32_t const_instanceTickRate = 30;
+
+/**
+ * A group of NPCs standing in a circle around a point
+ */
+struct NpcCamp
+{
+    float x;
+    float z;
+    uint32_t npcCount;
+};
+
+/// The NPC camps of every Zone
+static const NpcCamp const_npcCamps[] = {
+    {-200.f, -200.f, 8},
+    {200.f, -200.f, 8},
+    {-200.f, 200.f, 8},
+    {200.f, 200.f, 8},
+    {0.f, 400.f, 16},
+};
+/// Radius of the circle of the NPCs of a camp
+static const float const_npcCampRadius = 6.f;
+/// Half of the side length of the square ground of every Zone, centered at the origin
+static const float const_zoneExtent = 2048.f;
+/// Walkability of the ground of all Zones
+static const char* const_navigationGridFile = "data/navigation.grid";
+/// Terrain of all Zones, without it the ground is flat and only the bounds are checked
+static const char* const_heightmapFile = "data/terrain.height";
+/// Side length of the cells of the navigation grid used without a file, all of them walkable
+static const float const_navigationCellSize = 4.f;
+
+ZoneManager::ZoneManager() :
+        mZones(std::make_shared<const std::vector<Zone*>>()),
+        mZoneCapacity(const_zoneCapacity),
+        mMigrationCount(sMetrics->get("zonemanager.migrations")),
+        mInstanceCount(sMetrics->get("zonemanager.instances"))
+{
+    if (ZoneManager::instance != nullptr)
+        assert(false);
+
+    ZoneManager::instance = this;
+
+    mNavigationGrid = NavigationGrid::load(const_navigationGridFile);
+    if (!mNavigationGrid)
+    {
+        int32_t cellCount = (int32_t)(2.f * const_zoneExtent / const_navigationCellSize);
+        mNavigationGrid = std::make_shared<NavigationGrid>(cellCount, cellCount, const_navigationCellSize, -const_zoneExtent, -const_zoneExtent);
+
+        log->info("ZoneManager: No navigation grid, the whole ground of the Zones is walkable");
+    }
+
+    mHeightmap = Heightmap::load(const_heightmapFile);
+    if (!mHeightmap)
+        log->info("ZoneManager: No heightmap, players can move anywhere within {} units of the origin", const_zoneExtent);
+}
+
+ZoneManager::~ZoneManager()
+{
+    for (auto& zone : *mZones)
+        delete zone;
+
+    for (auto& zone : mInstances)
+        delete zone;
+
+    Zone* zone;
+    while (mFreeInstances.try_dequeue(zone))
+        delete zone;
+
+    for (auto& zonePool : zonePools)
+        delete zonePool;
+
+    ZoneManager::instance = nullptr;
+}
+
 Zone* ZoneManager::assignZone(PlayerSession* session)
 {
-    for(auto& zonePool : zonePools)
+    if (zonePools.empty())
+    {
+        log->error("ZoneManager: no ZonePool for assigning a player");
+        return nullptr;
+    }
+
+    Zone* zone = nullptr;
+
+    switch (mAssignmentPolicy)
+    {
+        case AssignmentPolicy::LEAST_LOADED:
+            zone = assignLeastLoaded(session, false);
+            break;
+        case AssignmentPolicy::PARTY:
+            zone = assignParty(session);
+            if (zone == nullptr)
+                zone = assignLeastLoaded(session, true);
+            break;
+        case AssignmentPolicy::CAPACITY_CAPPED:
+            zone = assignLeastLoaded(session, true);
+            break;
+    }
+
+    // all Zones are full, open another one
+    while (zone == nullptr)
+    {
+        Zone* newZone = createZone();
+
+        log->info("ZoneManager: all Zones are full, created Zone {}", newZone->getId());
+
+        if (newZone->tryAddSession(session))
+            zone = newZone;
+    }
+
+    if (mAssignmentPolicy == AssignmentPolicy::PARTY && session->getPartyId() != 0)
+    {
+        PartyShard& shard = mPartyShards[session->getPartyId() % const_partyShardCount];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.zones[session->getPartyId()] = zone;
+    }
+
+    return zone;
+}
+
+Zone* ZoneManager::assignLeastLoaded(PlayerSession* session, bool capped)
+{
+    std::shared_ptr<const std::vector<Zone*>> zones = std::atomic_load(&mZones);
+
+    // another assignment may fill the chosen Zone meanwhile, so try again
+    while (true)
+    {
+        Zone* leastLoaded = nullptr;
+
+        for (auto& zone : *zones)
+        {
+            if (capped && zone->getCapacity() != 0 && zone->getSessionCount() >= zone->getCapacity())
+                continue;
+
+            if (leastLoaded == nullptr || zone->getSessionCount() < leastLoaded->getSessionCount())
+                leastLoaded = zone;
+        }
+
+        if (leastLoaded == nullptr)
+            return nullptr;
+
+        if (!capped)
+        {
+            leastLoaded->addSession(session);
+            return leastLoaded;
+        }
+
+        if (leastLoaded->tryAddSession(session))
+            return leastLoaded;
+    }
+}
+
+Zone* ZoneManager::assignParty(PlayerSession* session)
+{
+    if (session->getPartyId() == 0)
+        return nullptr;
+
+    Zone* zone;
+
+    {
+        PartyShard& shard = mPartyShards[session->getPartyId() % const_partyShardCount];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto iterator = shard.zones.find(session->getPartyId());
+        if (iterator == shard.zones.end())
+            return nullptr;
+
+        zone = iterator->second;
+    }
+
+    if (!zone->tryAddSession(session))
+        return nullptr;
+
+    return zone;
+}
+
+ZonePool* ZoneManager::findLeastLoadedZonePool()
+{
+    ZonePool* leastLoaded = nullptr;
+
+    for (auto& zonePool : zonePools)
     {
-        for (auto& zone : *zonePool->getZoneList())
+        if (leastLoaded == nullptr
+            || zonePool->getLoad() < leastLoaded->getLoad()
+            || (zonePool->getLoad() == leastLoaded->getLoad() && zonePool->getZoneCount() < leastLoaded->getZoneCount()))
         {
-            // return the first one found for now
+            leastLoaded = zonePool;
+        }
+    }
 
-            zone->addSession(session);
+    return leastLoaded;
+}
 
-            return zone;
+Zone* ZoneManager::createZone()
+{
+    Zone* zone = new Zone(mNextZoneId++);
+    zone->setCapacity(mZoneCapacity);
+    setupZone(zone);
+
+    {
+        std::lock_guard<std::mutex> lock(mZonesMutex);
+
+        std::shared_ptr<std::vector<Zone*>> zones = std::make_shared<std::vector<Zone*>>(*mZones);
+        zones->push_back(zone);
+
+        std::atomic_store(&mZones, std::shared_ptr<const std::vector<Zone*>>(zones));
+    }
+
+    findLeastLoadedZonePool()->addZone(zone);
+
+    return zone;
+}
+
+Zone* ZoneManager::createInstance()
+{
+    Zone* zone;
+
+    if (mFreeInstances.try_dequeue(zone))
+        zone->reset(mNextZoneId++, true);
+    else
+        zone = new Zone(mNextZoneId++, true);
+
+    zone->setTickRate(const_instanceTickRate);
+    setupZone(zone);
+
+    {
+        std::lock_guard<std::mutex> lock(mZonesMutex);
+        mInstances.push_back(zone);
+    }
+
+    findLeastLoadedZonePool()->addZone(zone);
+
+    mInstanceCount++;
+
+    return zone;
+}
+
+void ZoneManager::setupZone(Zone* zone)
+{
+    zone->setNavigationGrid(mNavigationGrid);
+
+    // the heightmap limits the bounds further to it's area, if it's smaller than the Zone
+    MovementValidator& movementValidator = zone->getMovementValidator();
+    movementValidator.setBounds(-const_zoneExtent, -const_zoneExtent, const_zoneExtent, const_zoneExtent);
+    movementValidator.setHeightmap(mHeightmap);
+
+    for (auto& camp : const_npcCamps)
+    {
+        for (uint32_t npc = 0; npc < camp.npcCount; npc++)
+        {
+            float angle = 6.2831853f * npc / camp.npcCount;
+            float x = camp.x + const_npcCampRadius * std::cos(angle);
+            float z = camp.z + const_npcCampRadius * std::sin(angle);
+
+            zone->spawnNpc(x, mHeightmap ? mHeightmap->getHeight(x, z) : 0.f, z);
+        }
+    }
+}
+
+void ZoneManager::forgetParties(Zone* zone)
+{
+    for (auto& shard : mPartyShards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        for (auto iterator = shard.zones.begin(); iterator != shard.zones.end();)
+        {
+            if (iterator->second == zone || iterator->second->getSessionCount() == 0)
+                iterator = shard.zones.erase(iterator);
+            else
+                ++iterator;
         }
     }
+}
+
+Zone* ZoneManager::findZone(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(mZonesMutex);
+
+    for (Zone* zone : *mZones)
+    {
+        if (zone->getId() == id)
+            return zone;
+    }
+
+    for (Zone* zone : mInstances)
+    {
+        if (zone->getId() == id)
+            return zone;
+    }
 
-    assert(false);
     return nullptr;
-}
\ No newline at end of file
+}
+
+bool ZoneManager::destroyInstance(Zone* zone)
+{
+    // the Zone can't move to another ZonePool meanwhile, and is only destroyed once
+    std::lock_guard<std::mutex> migrationLock(mMigrationMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mZonesMutex);
+
+        if (std::find(mInstances.begin(), mInstances.end(), zone) == mInstances.end())
+            return false;
+    }
+
+    if (zone->getSessionCount() != 0 || zone->getObserverCount() != 0 || zone->hasIncomingHandoffs())
+        return false;
+
+    ZonePool* zonePool = zone->getZonePool();
+    if (!zonePool->removeZone(zone))
+        return false;
+
+    // a player or observer may have arrived during the last tick
+    if (zone->getSessionCount() != 0 || zone->getObserverCount() != 0 || zone->hasIncomingHandoffs())
+    {
+        zonePool->addZone(zone);
+        return false;
+    }
+
+    forgetParties(zone);
+
+    {
+        std::lock_guard<std::mutex> lock(mZonesMutex);
+        mInstances.erase(std::find(mInstances.begin(), mInstances.end(), zone));
+    }
+
+    mFreeInstances.enqueue(zone);
+
+    mInstanceCount--;
+
+    return true;
+}
+
+void ZoneManager::transferSession(PlayerSession* session, Zone* zone)
+{
+    session->requestHandoff(zone);
+}
+
+void ZoneManager::rebalance()
+{
+    uint32_t budget = ZonePool::getLoadBudget();
+
+    // parties whose Zone became empty start over in any Zone
+    forgetParties(nullptr);
+
+    // no instance is destroyed while it's moved
+    std::lock_guard<std::mutex> migrationLock(mMigrationMutex);
+
+    ZonePool* source = nullptr;
+    ZonePool* target = nullptr;
+
+    for (auto& zonePool : zonePools)
+    {
+        uint32_t load = zonePool->getLoad();
+        sMetrics->get(fmt::format("zonepool.{}.load_us_per_s", zonePool->getId())) = load;
+        sMetrics->get(fmt::format("zonepool.{}.hibernating_zones", zonePool->getId())) = zonePool->getHibernatingZoneCount();
+
+        if (load > budget * const_overloadThreshold)
+            zonePool->setOverrunStreak(zonePool->getOverrunStreak() + 1);
+        else
+            zonePool->setOverrunStreak(0);
+
+        if (source == nullptr || load > source->getLoad())
+            source = zonePool;
+
+        if (target == nullptr || load < target->getLoad())
+            target = zonePool;
+    }
+
+    if (source == nullptr || source == target || source->getOverrunStreak() < const_overrunStreak)
+        return;
+
+    TimePoint currentTime = getTimeMilliseconds();
+
+    Zone* zone = findMigrationCandidate(source, target, currentTime);
+
+    if (zone == nullptr)
+    {
+        log->info("ZoneManager: ZonePool {} is overloaded ({}us/s of {}us/s), but no Zone can be moved",
+                  source->getId(), source->getLoad(), budget);
+        return;
+    }
+
+    log->info("ZoneManager: moving Zone {} ({}us/s) from ZonePool {} ({}us/s) to ZonePool {} ({}us/s)",
+              zone->getId(), zone->getLoad(),
+              source->getId(), source->getLoad(),
+              target->getId(), target->getLoad());
+
+    // removing waits for the current tick of the source, the target only starts with it's next tick,
+    // so the Zone is never updated twice in parallel
+    if (!source->removeZone(zone))
+        return;
+
+    target->addZone(zone);
+
+    zone->setLastMigrationTime(currentTime);
+    source->setOverrunStreak(0);
+
+    mMigrationCount++;
+}
+
+Zone* ZoneManager::findMigrationCandidate(ZonePool* source, ZonePool* target, TimePoint currentTime)
+{
+    uint32_t sourceCost = source->getLoad();
+    uint32_t targetCost = target->getLoad();
+    uint32_t targetLimit = (uint32_t)(ZonePool::getLoadBudget() * const_targetThreshold);
+
+    Zone* candidate = nullptr;
+
+    for (auto& zone : source->getZones())
+    {
+        uint32_t zoneCost = zone->getLoad();
+
+        // recently moved Zones stay where they are
+        if (zone->getLastMigrationTime() != 0 && currentTime - zone->getLastMigrationTime() < const_migrationCooldown)
+            continue;
+
+        // the target must not end up more loaded than the source, otherwise the Zone would be moved back
+        if (targetCost + 2*zoneCost >= sourceCost || targetCost + zoneCost > targetLimit)
+            continue;
+
+        // prefer the most expensive Zone, it reduces the load the most
+        if (candidate == nullptr || zoneCost > candidate->getLoad())
+            candidate = zone;
+    }
+
+    return candidate;
+}
@@ -2,8 +2,17 @@
 
 #include "ZonePool.h"
 
+#include <atomic>
 #include <cassert>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
+#include "concurrentqueue/concurrentqueue.h"
+
+class Heightmap;
+class NavigationGrid;
 class PlayerSession;
 class Zone;
 
@@ -14,24 +23,141 @@ class Zone;
  *
  * Creates all ZonePools.
  * Assigns Players to the correct Zone.
+ * Moves Zones from overloaded ZonePools to less loaded ones.
+ * Creates and destroys instanced Zones on demand.
+ *
+ * The assignment of players doesn't take a global lock, it works
+ * on a copy of the list of Zones which is replaced when Zones are created.
  *
  * @remark Singleton
  */
 class ZoneManager
 {
+public:
+    /**
+     * How assignZone() chooses a Zone
+     */
+    enum class AssignmentPolicy
+    {
+        /// the Zone with the fewest players
+        LEAST_LOADED,
+        /// the Zone with the fewest players, which is below it's capacity, creates a new Zone if all are full
+        CAPACITY_CAPPED,
+        /// the Zone of the other members of the party, otherwise like CAPACITY_CAPPED
+        PARTY,
+    };
+
+private:
+    /**
+     * Part of the mapping of parties to their Zone, one lock per shard
+     */
+    struct PartyShard
+    {
+        std::mutex mutex;
+        std::unordered_map<uint32_t, Zone*> zones;
+    };
+
+    /// Number of shards for the party mapping
+    static const uint32_t const_partyShardCount = 16;
+
     /// The Singleton instnace
     static ZoneManager* instance;
 
     /// List of all ZonePools
     std::forward_list<ZonePool*> zonePools;
+
+    /// Id for the next created ZonePool
+    uint32_t mNextZonePoolId = 1;
+
+    /// Id for the next created Zone
+    std::atomic<uint32_t> mNextZoneId{1};
+
+    /// For protecting changes of mZones and mInstances
+    std::mutex mZonesMutex;
+
+    /// Serializes moving Zones between ZonePools and destroying instances, held while waiting for ticks
+    std::mutex mMigrationMutex;
+
+    /// All Zones players can be assigned to, replaced as a whole on change (read with std::atomic_load)
+    std::shared_ptr<const std::vector<Zone*>> mZones;
+
+    /// All currently used instances
+    std::vector<Zone*> mInstances;
+
+    /// Unused instances, for reusing them without allocating
+    moodycamel::ConcurrentQueue<Zone*> mFreeInstances;
+
+    /// Current policy of assignZone()
+    std::atomic<AssignmentPolicy> mAssignmentPolicy{AssignmentPolicy::CAPACITY_CAPPED};
+
+    /// Player capacity of Zones created by createZone()
+    uint32_t mZoneCapacity;
+
+    /// Walkable area of all Zones, for the paths of the NPCs
+    std::shared_ptr<const NavigationGrid> mNavigationGrid;
+
+    /// Terrain of all Zones, for checking the movement of the players, nullptr for flat ground
+    std::shared_ptr<const Heightmap> mHeightmap;
+
+    /// Zone of every party with players in the world, sharded by party id
+    PartyShard mPartyShards[const_partyShardCount];
+
+    /// Number of Zones moved by rebalance()
+    std::atomic<int64_t>& mMigrationCount;
+
+    /// Number of instances created by createInstance()
+    std::atomic<int64_t>& mInstanceCount;
+
+    /**
+     * Chooses a Zone of the source pool which can be moved to the target pool
+     * without overloading the target pool or moving back and forth
+     * @param source the overloaded ZonePool
+     * @param target the least loaded ZonePool
+     * @param currentTime current time in milliseconds
+     * @return Zone to move or nullptr if there is none
+     */
+    Zone* findMigrationCandidate(ZonePool* source, ZonePool* target, TimePoint currentTime);
+
+    /**
+     * @return the ZonePool with the lowest tick cost, ties are decided by the number of Zones
+     */
+    ZonePool* findLeastLoadedZonePool();
+
+    /**
+     * Adds the session to the Zone with the fewest players
+     * @param session the PlayerSession
+     * @param capped true to skip Zones at their capacity
+     * @return the Zone, or nullptr if all Zones are full
+     */
+    Zone* assignLeastLoaded(PlayerSession* session, bool capped);
+
+    /**
+     * Adds the session to the Zone of it's party
+     * @param session the PlayerSession
+     * @return the Zone, or nullptr if the party has no Zone or it's full
+     */
+    Zone* assignParty(PlayerSession* session);
+
+    /**
+     * Removes the parties whose Zone is gone or empty from mPartyShards
+     * @param zone the removed Zone, nullptr for only removing the parties of empty Zones
+     */
+    void forgetParties(Zone* zone);
+
+    /**
+     * Fills a new or reset Zone with it's content: the bounds and terrain, the NavigationGrid and the NPCs
+     * @param zone the Zone, not yet added to a ZonePool
+     */
+    void setupZone(Zone* zone);
+
 public:
-    ZoneManager()
-    {
-        if (ZoneManager::instance != nullptr)
-            assert(false);
+    ZoneManager();
 
-        ZoneManager::instance = this;
-    }
+    /**
+     * Deletes all Zones and ZonePools
+     * @remark the ZonePools must not be running anymore
+     */
+    ~ZoneManager();
 
     /**
      * Returns the ZoneManager
@@ -39,29 +165,88 @@ public:
     static ZoneManager* getInstance() { return instance; }
 
     /**
-     * Assigns a PlayerSession to a Zone
+     * Assigns a PlayerSession to a Zone, chosen by the current AssignmentPolicy
      * @param session the PlayerSession which is not yet assigned
-     * @return the assigned Zone Pointer
+     * @return the assigned Zone Pointer, nullptr if there is no ZonePool
+     * @remark Thread-Safe
      */
     Zone* assignZone(PlayerSession* session);
 
+    /**
+     * Sets how assignZone() chooses Zones
+     * @remark Thread-Safe
+     */
+    void setAssignmentPolicy(AssignmentPolicy policy) { mAssignmentPolicy = policy; }
+
+    /**
+     * Moves a PlayerSession to another Zone, asynchronously
+     * The session is handed off at the end of the current tick of it's Zone
+     * and adopted by the destination Zone on it's next tick.
+     * @param session the PlayerSession
+     * @param zone destination Zone
+     * @remark Thread-Safe
+     */
+    void transferSession(PlayerSession* session, Zone* zone);
+
+    /**
+     * Creates a Zone players can be assigned to, on the least loaded ZonePool
+     * @return the new Zone
+     * @remark Thread-Safe
+     */
+    Zone* createZone();
+
+    /**
+     * Creates an instanced Zone (e.g. a dungeon) on the least loaded ZonePool,
+     * ticking faster than the open world. Players aren't assigned to instances, they have to be moved
+     * with transferSession(). Instances are reused after destroyInstance().
+     * @return the instance
+     * @remark Thread-Safe
+     */
+    Zone* createInstance();
+
+    /**
+     * Finds a Zone or an instance in use by it's id, e.g. for observing it
+     * @param id id of the Zone
+     * @return the Zone, nullptr if there is none with this id
+     * @remark Thread-Safe
+     */
+    Zone* findZone(uint32_t id);
+
+    /**
+     * Stops updating an instance and keeps it for reuse
+     * @param zone the instance, must not have players anymore
+     * @return false if the Zone isn't an instance in use, or still has players, observers or incoming handoffs
+     * @remark Thread-Safe, waits until the current tick of the instance is finished
+     */
+    bool destroyInstance(Zone* zone);
+
+    /**
+     * Checks the tick cost of all ZonePools and moves one Zone from
+     * the most loaded ZonePool to the least loaded one, if the
+     * most loaded one is over it's budget for a while.
+     *
+     * The move happens between two ticks of both ZonePools,
+     * queued packets stay in the PlayerSessions and are processed
+     * by the new ZonePool.
+     *
+     * @remark to be called periodically from a single thread
+     */
+    void rebalance();
+
     /**
      * Creates a new ZonePool
      * @return Pointer to the just created ZonePool
+     * @remark all ZonePools have to be created before running the server
      */
     ZonePool* createZonePool()
     {
-        ZonePool* zonePool = new ZonePool();
+        ZonePool* zonePool = new ZonePool(mNextZonePoolId++);
         zonePools.push_front(zonePool);
         return zonePool;
     }
 
     /**
-     * Deletes a ZonePool
+     * @return all ZonePools
      */
-    void deleteZonePool(ZonePool* zonePool)
-    {
-        zonePools.remove(zonePool);
-        delete zonePool;
-    }
+    const std::forward_list<ZonePool*>& getZonePools() { return zonePools; }
 };
@@ -0,0 +1,89 @@
+#include "ZonePartition.h"
+
+#include <algorithm>
+#include <limits>
+
+void ZonePartition::reset()
+{
+    float infinity = std::numeric_limits<float>::infinity();
+
+    mNodes.clear();
+    mRegions.clear();
+
+    mRegions.push_back({-infinity, -infinity, infinity, infinity});
+    mNodes.push_back({0, 0.f, 0, 0, 0});
+}
+
+void ZonePartition::build(std::vector<Point>& points, uint32_t capacity, uint32_t maxRegions)
+{
+    float infinity = std::numeric_limits<float>::infinity();
+
+    mNodes.clear();
+    mRegions.clear();
+
+    Bounds bounds = {-infinity, -infinity, infinity, infinity};
+
+    build(points.data(), points.data() + points.size(), bounds, 0, std::max<uint32_t>(capacity, 1), std::max<uint32_t>(maxRegions, 1));
+}
+
+uint32_t ZonePartition::build(Point* begin, Point* end, const Bounds& bounds, uint8_t axis, uint32_t capacity, uint32_t maxRegions)
+{
+    uint32_t nodeIndex = (uint32_t)mNodes.size();
+    mNodes.push_back({axis, 0.f, 0, 0, 0});
+
+    size_t count = end - begin;
+
+    if (count <= capacity || maxRegions < 2)
+    {
+        mNodes[nodeIndex].region = (uint32_t)mRegions.size();
+        mRegions.push_back(bounds);
+        return nodeIndex;
+    }
+
+    Point* median = begin + count/2;
+    std::nth_element(begin, median, end, [axis](const Point& a, const Point& b) {
+        return axis == 0 ? a.x < b.x : a.z < b.z;
+    });
+
+    float split = axis == 0 ? median->x : median->z;
+
+    Bounds lowerBounds = bounds;
+    Bounds upperBounds = bounds;
+    if (axis == 0)
+    {
+        lowerBounds.maxX = split;
+        upperBounds.minX = split;
+    }
+    else
+    {
+        lowerBounds.maxZ = split;
+        upperBounds.minZ = split;
+    }
+
+    uint8_t nextAxis = axis == 0 ? 1 : 0;
+
+    // the allowed number of regions is shared between both halves
+    uint32_t lower = build(begin, median, lowerBounds, nextAxis, capacity, maxRegions/2);
+    uint32_t upper = build(median, end, upperBounds, nextAxis, capacity, maxRegions - maxRegions/2);
+
+    mNodes[nodeIndex].split = split;
+    mNodes[nodeIndex].lower = lower;
+    mNodes[nodeIndex].upper = upper;
+
+    return nodeIndex;
+}
+
+uint32_t ZonePartition::findRegion(float x, float z) const
+{
+    uint32_t nodeIndex = 0;
+
+    while (mNodes[nodeIndex].lower != 0)
+    {
+        const Node& node = mNodes[nodeIndex];
+        float value = node.axis == 0 ? x : z;
+
+        nodeIndex = value < node.split ? node.lower : node.upper;
+    }
+
+    return mNodes[nodeIndex].region;
+}
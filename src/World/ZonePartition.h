@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Splits the ground plane of a Zone into rectangular regions
+ *
+ * The regions are created by a k-d split on the positions of the
+ * players: the space is cut at the median along x and z alternately,
+ * until every region holds at most the given number of players.
+ * So crowded areas get small regions and empty areas big ones.
+ *
+ * Positions use x and z as ground plane, y is the height.
+ */
+class ZonePartition
+{
+public:
+    /**
+     * Axis aligned bounds of a region on the ground plane
+     */
+    struct Bounds
+    {
+        float minX, minZ;
+        float maxX, maxZ;
+
+        /**
+         * @return squared distance from a point to the bounds, 0 if inside
+         */
+        float squaredDistance(float x, float z) const
+        {
+            float dx = x < minX ? minX - x : (x > maxX ? x - maxX : 0.f);
+            float dz = z < minZ ? minZ - z : (z > maxZ ? z - maxZ : 0.f);
+            return dx*dx + dz*dz;
+        }
+    };
+
+    /**
+     * A point on the ground plane used for building the partition
+     */
+    struct Point
+    {
+        float x, z;
+    };
+
+private:
+    /**
+     * Node of the k-d tree, either a split or a region (leaf)
+     */
+    struct Node
+    {
+        /// 0 for x, 1 for z
+        uint8_t axis;
+
+        /// position of the split on the axis
+        float split;
+
+        /// index of the child nodes for values below/above the split, 0 for a leaf
+        uint32_t lower, upper;
+
+        /// index of the region, only for leafs
+        uint32_t region;
+    };
+
+    /// nodes of the k-d tree, the first one is the root
+    std::vector<Node> mNodes;
+
+    /// bounds of all regions
+    std::vector<Bounds> mRegions;
+
+    /**
+     * Builds the subtree for the points
+     * @param maxRegions number of regions this subtree may have
+     * @return index of the created node
+     */
+    uint32_t build(Point* begin, Point* end, const Bounds& bounds, uint8_t axis, uint32_t capacity, uint32_t maxRegions);
+
+public:
+    /**
+     * Creates a partition consisting of a single region covering everything
+     */
+    ZonePartition() { reset(); }
+
+    /**
+     * Removes all splits, so everything belongs to one region
+     */
+    void reset();
+
+    /**
+     * Splits the space by the points
+     * @param points positions of the players, will be reordered
+     * @param capacity maximum number of points for a region
+     * @param maxRegions the split stops when this number of regions is reached
+     */
+    void build(std::vector<Point>& points, uint32_t capacity, uint32_t maxRegions);
+
+    /**
+     * @return index of the region containing the position
+     */
+    uint32_t findRegion(float x, float z) const;
+
+    /**
+     * @return number of regions
+     */
+    uint32_t getRegionCount() const { return (uint32_t)mRegions.size(); }
+
+    /**
+     * @return bounds of a region
+     */
+    const Bounds& getRegionBounds(uint32_t region) const { return mRegions[region]; }
+};
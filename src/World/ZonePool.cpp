@@ -1,60 +1,231 @@
 #include "ZonePool.h"
 
-#include "Zone.h"
+#include <algorithm>
+
+#include "Metrics/Metrics.h"
 #include "Server/Server.h"
+#include "Log/Logger.h"
 
-static const TimePoint const_tickrate = 20;
-static const TimePoint const_sleeptime = 1000/const_tickrate;
+/// Nanoseconds spent spinning before a Zone is due
+static const uint64_t const_spinTime = 100000;
+/// Nanoseconds of a window for measuring the load
+static const uint64_t const_loadWindow = 100000000;
+/// Nanoseconds between exporting the metrics
+static const uint64_t const_metricsInterval = 1000000000;
 
+ZonePool::ZonePool(uint32_t id) :
+        mId(id),
+        mLoadWindowStart(getTimeNanoseconds()),
+        mMetricsTime(getTimeNanoseconds()),
+        mTickDurationMetric(sMetrics->get(fmt::format("zonepool.{}.tick_duration_p99_us", id))),
+        mTickLatenessMetric(sMetrics->get(fmt::format("zonepool.{}.tick_lateness_p99_us", id))),
+        mTickLatenessMaxMetric(sMetrics->get(fmt::format("zonepool.{}.tick_lateness_max_us", id))),
+        mOverrunMetric(sMetrics->get(fmt::format("zonepool.{}.tick_overruns", id))),
+        mSkippedTickMetric(sMetrics->get(fmt::format("zonepool.{}.ticks_skipped", id))),
+        mPathLatencyMetric(sMetrics->get(fmt::format("zonepool.{}.path_latency_p99_us", id)))
+{
+    for (size_t phase = 0; phase < (size_t)Zone::TickPhase::COUNT; phase++)
+    {
+        const char* name = Zone::getPhaseName((Zone::TickPhase)phase);
+        mPhaseMetrics[phase] = &sMetrics->get(fmt::format("zonepool.{}.phase_{}_p99_us", id, name));
+    }
+}
 
-void ZonePool::update(TimePoint difference)
+uint64_t ZonePool::update(uint64_t currentTime)
 {
     std::lock_guard<std::mutex> lock(mZoneListMutex);
 
+    addPendingZones();
+
+    uint64_t nextUpdateTime = UINT64_MAX;
+    uint64_t busyTime = 0;
+    uint32_t hibernatingZoneCount = 0;
+
     for(auto& zone: mZones)
     {
-        zone->update(difference);
+        uint64_t zoneStartTime = getTimeNanoseconds();
+
+        if (zone->canHibernate(zoneStartTime / 1000))
+        {
+            hibernatingZoneCount++;
+            zone->hibernate();
+        }
+        else if (zone->isDue(zoneStartTime))
+        {
+            zone->tick(zoneStartTime);
+
+            busyTime += getTimeNanoseconds() - zoneStartTime;
+
+            for (size_t phase = 0; phase < (size_t)Zone::TickPhase::COUNT; phase++)
+                mPhaseDurations[phase].record(zone->getPhaseDuration((Zone::TickPhase)phase));
+        }
+
+        nextUpdateTime = std::min(nextUpdateTime, zone->getNextUpdateTime());
+    }
+
+    mHibernatingZoneCount = hibernatingZoneCount;
+
+    updateLoad(currentTime, busyTime);
+
+    if (currentTime - mMetricsTime >= const_metricsInterval)
+    {
+        mMetricsTime = currentTime;
+        exportTickMetrics();
     }
+
+    return nextUpdateTime;
 }
 
-void ZonePool::addZone(Zone* zone)
+void ZonePool::updateLoad(uint64_t currentTime, uint64_t busyTime)
 {
-    std::lock_guard<std::mutex> lock(mZoneListMutex);
-    mZones.push_front(zone);
+    mBusyTime += busyTime;
+
+    uint64_t windowTime = currentTime - mLoadWindowStart;
+    if (windowTime < const_loadWindow)
+        return;
+
+    // microseconds of work per second in this window
+    uint32_t load = (uint32_t)(mBusyTime * 1000000 / windowTime);
+
+    // same moving average as Zone::recordTickCost
+    uint32_t previousLoad = mLoad;
+    mLoad = previousLoad - previousLoad/8 + load/8;
+
+    mLoadWindowStart = currentTime;
+    mBusyTime = 0;
 }
 
-void ZonePool::removeZone(Zone* zone)
+void ZonePool::addPendingZones()
+{
+    Zone* zone;
+
+    while (mPendingZones.try_dequeue(zone))
+    {
+        mZones.push_front(zone);
+    }
+}
+
+std::vector<Zone*> ZonePool::getZones()
 {
     std::lock_guard<std::mutex> lock(mZoneListMutex);
-    mZones.remove(zone);
+    addPendingZones();
+    return std::vector<Zone*>(mZones.begin(), mZones.end());
 }
 
-void ZonePool::run()
+void ZonePool::addZone(Zone* zone)
 {
-    TimePoint currentTime = 0;
-    TimePoint previousTime = getTimeMilliseconds();
+    zone->setZonePool(this);
+    mZoneCount++;
 
-    TimePoint previousSleepTime = 0;
+    mPendingZones.enqueue(zone);
+    wake();
+}
 
-    while (!Server::isStopping())
+void ZonePool::wake()
+{
     {
-        currentTime = getTimeMilliseconds();
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mWakeRequested = true;
+    }
+    mWakeCondition.notify_one();
+}
 
-        TimePoint timeDifference = currentTime-previousTime;
+void ZonePool::waitUntil(uint64_t deadline)
+{
+    {
+        std::unique_lock<std::mutex> lock(mWakeMutex);
 
-        previousTime = currentTime;
+        auto isWoken = [this]() { return mWakeRequested || Server::isStopping(); };
 
-        update(timeDifference);
+        if (deadline == UINT64_MAX)
+        {
+            mWakeCondition.wait(lock, isWoken);
+            return;
+        }
 
-        if (timeDifference <= const_sleeptime + previousSleepTime)
+        if (deadline > getTimeNanoseconds() + const_spinTime)
         {
-            previousSleepTime = const_sleeptime + previousSleepTime - timeDifference;
+            std::chrono::steady_clock::time_point wakeUpTime{std::chrono::nanoseconds(deadline - const_spinTime)};
 
-            sleepMilliseconds(previousSleepTime);
+            if (mWakeCondition.wait_until(lock, wakeUpTime, isWoken))
+                return;
         }
-        else
+    }
+
+    // waking up from a wait is not precise, so spin for the rest
+    while (getTimeNanoseconds() < deadline);
+}
+
+bool ZonePool::removeZone(Zone* zone)
+{
+    std::lock_guard<std::mutex> lock(mZoneListMutex);
+
+    // the Zone may still be pending
+    addPendingZones();
+
+    auto previous = mZones.before_begin();
+    for (auto iterator = mZones.begin(); iterator != mZones.end(); previous = iterator++)
+    {
+        if (*iterator == zone)
         {
-            previousSleepTime = 0;
+            mZones.erase_after(previous);
+            mZoneCount--;
+            return true;
         }
     }
+
+    return false;
+}
+
+void ZonePool::exportTickMetrics()
+{
+    Histogram tickDuration;
+    Histogram lateness;
+    uint64_t overrunCount = 0;
+    uint64_t skippedTickCount = 0;
+    Histogram pathLatency;
+
+    for (auto& zone : mZones)
+    {
+        TickScheduler& tickScheduler = zone->getTickScheduler();
+
+        tickDuration.merge(tickScheduler.getTickDuration());
+        lateness.merge(tickScheduler.getLateness());
+        overrunCount += tickScheduler.getOverrunCount();
+        skippedTickCount += tickScheduler.getSkippedTickCount();
+
+        tickScheduler.resetHistograms();
+
+        pathLatency.merge(zone->getPathfinding().getLatency());
+        zone->getPathfinding().getLatency().reset();
+    }
+
+    mTickDurationMetric = tickDuration.getPercentile(99) / 1000;
+    mTickLatenessMetric = lateness.getPercentile(99) / 1000;
+    mTickLatenessMaxMetric = lateness.getMax() / 1000;
+    mOverrunMetric = overrunCount;
+    mSkippedTickMetric = skippedTickCount;
+    mPathLatencyMetric = pathLatency.getPercentile(99);
+
+    for (size_t phase = 0; phase < (size_t)Zone::TickPhase::COUNT; phase++)
+    {
+        *mPhaseMetrics[phase] = mPhaseDurations[phase].getPercentile(99) / 1000;
+        mPhaseDurations[phase].reset();
+    }
+}
+
+void ZonePool::run()
+{
+    while (!Server::isStopping())
+    {
+        // wake ups from now on are noticed by waitUntil
+        {
+            std::lock_guard<std::mutex> lock(mWakeMutex);
+            mWakeRequested = false;
+        }
+
+        uint64_t nextUpdateTime = update(getTimeNanoseconds());
+
+        waitUntil(nextUpdateTime);
+    }
 }
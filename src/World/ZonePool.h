@@ -1,48 +1,190 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <forward_list>
 #include <mutex>
+#include <vector>
 
-#include "utility/utility.h"
+#include "concurrentqueue/concurrentqueue.h"
 
-class Zone;
+#include "Zone.h"
+#include "utility/Histogram.h"
+#include "utility/utility.h"
 
 /**
  * @brief A ZonePool represents a thread which can hold multiple Zones.
  *
  * Zones can be dynamically added or removed to/from the ZonePool.
  * The ZonePool will update all Zones accociated with it.
+ *
+ * Every Zone has it's own tick rate and TickScheduler. The ZonePool
+ * interleaves them on one timeline: it updates all Zones which are due
+ * and waits until the next Zone is due. The tick duration, lateness,
+ * overruns and the duration of every tick phase of all Zones are exported
+ * as metrics.
+ *
+ * The ZonePool measures how much work it's Zones are, so the
+ * ZoneManager can move Zones between ZonePools when one is overloaded.
+ *
+ * Hibernating Zones (see Zone::canHibernate) are skipped. When all
+ * Zones hibernate, the thread blocks until a Zone is woken up or
+ * the earliest timer of it's Zones is due.
  */
 class ZonePool
 {
+    /// Unique id of the ZonePool
+    uint32_t mId;
+
     /// For protecting the list of all current Zones
     std::mutex mZoneListMutex;
 
     /// List of all current accociated Zones
     std::forward_list<Zone*> mZones;
 
+    /// Zones added by addZone(), moved into mZones on the next tick
+    moodycamel::ConcurrentQueue<Zone*> mPendingZones;
+
+    /// Number of Zones, including pending ones
+    std::atomic<uint32_t> mZoneCount{0};
+
+    /// Smoothed microseconds of work per second
+    std::atomic<uint32_t> mLoad{0};
+
+    /// Start of the current window for measuring the load, in nanoseconds
+    uint64_t mLoadWindowStart;
+
+    /// Nanoseconds spent updating Zones in the current window
+    uint64_t mBusyTime = 0;
+
+    /// Number of Zones skipped in the last update, because they hibernate
+    std::atomic<uint32_t> mHibernatingZoneCount{0};
+
+    /// For protecting mWakeRequested
+    std::mutex mWakeMutex;
+
+    /// Notifies the waiting thread about a woken Zone
+    std::condition_variable mWakeCondition;
+
+    /// true if a Zone was woken up since the last update
+    bool mWakeRequested = false;
+
+    /// Time in nanoseconds the metrics were exported
+    uint64_t mMetricsTime;
+
+    /// Exported metrics of the TickSchedulers of all Zones
+    std::atomic<int64_t>& mTickDurationMetric;
+    std::atomic<int64_t>& mTickLatenessMetric;
+    std::atomic<int64_t>& mTickLatenessMaxMetric;
+    std::atomic<int64_t>& mOverrunMetric;
+    std::atomic<int64_t>& mSkippedTickMetric;
+    std::atomic<int64_t>& mPathLatencyMetric;
+
+    /// Duration of every tick phase of all Zones since the last export
+    Histogram mPhaseDurations[(size_t)Zone::TickPhase::COUNT];
+
+    /// Exported metrics of the tick phases
+    std::atomic<int64_t>* mPhaseMetrics[(size_t)Zone::TickPhase::COUNT];
+
+    /// Number of consecutive rebalance checks this pool was over it's budget, used by the ZoneManager
+    uint32_t mOverrunStreak = 0;
+
+    /**
+     * Updates all due Zones, called from it's thread
+     * @param currentTime time in nanoseconds
+     * @return time in nanoseconds the next Zone is due, UINT64_MAX if all hibernate without timers
+     */
+    uint64_t update(uint64_t currentTime);
+
+    /**
+     * Moves the pending Zones into the list of Zones
+     * @remark mZoneListMutex must be locked
+     */
+    void addPendingZones();
+
+    /**
+     * Adds the time spent updating Zones to the smoothed load
+     * @param currentTime time in nanoseconds
+     * @param busyTime nanoseconds spent updating Zones
+     */
+    void updateLoad(uint64_t currentTime, uint64_t busyTime);
+
     /**
-     * Updates the Pool, called from it's thread
+     * Blocks until the deadline, a Zone is woken up or the server is stopping
+     * @param deadline time in nanoseconds, UINT64_MAX for no deadline
      */
-    void update(TimePoint difference);
+    void waitUntil(uint64_t deadline);
+
+    /**
+     * Writes the statistics of the TickSchedulers of all Zones to the metrics
+     * @remark mZoneListMutex must be locked
+     */
+    void exportTickMetrics();
 public:
-    ZonePool() {}
+    ZonePool(uint32_t id);
     ~ZonePool() {}
 
     /**
      * Adds a Zone to the ZonePool.
-     * The ZonePool will then call zone->update() from it's thread
+     * The ZonePool will then call zone->tick() from it's thread,
+     * beginning with the next tick
      * @param zone pointer to a Zone
+     * @remark Thread-Safe, lock-free
      */
     void addZone(Zone* zone);
 
     /**
      * Removes a Zone from the ZonePool and stops updating it
      * @param zone pointer to a Zone
+     * @return false if the Zone isn't updated by this ZonePool
+     * @remark Thread-Safe, waits until the current tick is finished
      */
-    void removeZone(Zone* zone);
+    bool removeZone(Zone* zone);
 
     void run();
 
+    /**
+     * Wakes up the thread if it's waiting, so woken Zones are updated right away
+     * @remark Thread-Safe
+     */
+    void wake();
+
     const std::forward_list<Zone*>* getZoneList() { return &mZones; }
+
+    /**
+     * @return copy of the list of all current Zones
+     * @remark Thread-Safe
+     */
+    std::vector<Zone*> getZones();
+
+    /**
+     * @return unique id of the ZonePool
+     */
+    uint32_t getId() { return mId; }
+
+    /**
+     * @return number of Zones in this ZonePool
+     * @remark Thread-Safe
+     */
+    uint32_t getZoneCount() { return mZoneCount; }
+
+    /**
+     * @return number of hibernating Zones in the last update
+     * @remark Thread-Safe
+     */
+    uint32_t getHibernatingZoneCount() { return mHibernatingZoneCount; }
+
+    /**
+     * @return smoothed microseconds of work per second
+     * @remark Thread-Safe
+     */
+    uint32_t getLoad() { return mLoad; }
+
+    /**
+     * @return the microseconds of work per second a ZonePool can do, one core
+     */
+    static uint32_t getLoadBudget() { return 1000000; }
+
+    uint32_t getOverrunStreak() { return mOverrunStreak; }
+    void setOverrunStreak(uint32_t overrunStreak) { mOverrunStreak = overrunStreak; }
 };
@@ -1,7 +1,8 @@
 #include <signal.h>
 
-#include "Log/Logger.h"
+#include "Metrics/Metrics.h"
 #include "Server/Server.h"
+#include "Log/Logger.h"
 
 Server* server;
 
@@ -38,6 +39,8 @@ int main() {
 
     log->info("Starting Server");
 
+    Metrics* metrics = new Metrics();
+
     initializeSignalHandler();
 
     server = new Server();
@@ -46,6 +49,9 @@ int main() {
 
     delete server;
 
+    metrics->logMetrics();
+    delete metrics;
+
     log->flush();
     delete logger;
 
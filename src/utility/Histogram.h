@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @brief Counts values in logarithmic buckets for percentiles
+ *
+ * Every power of two is divided into four buckets, so a percentile
+ * is at most 25% above the real value. Recording is constant time
+ * and doesn't allocate.
+ *
+ * @remark not thread-safe
+ */
+class Histogram
+{
+    /// Buckets for each power of two
+    static const uint32_t const_subBuckets = 4;
+
+    /// Number of all buckets, covering every uint64_t value
+    static const uint32_t const_bucketCount = 64 * const_subBuckets;
+
+    /// Number of values in each bucket
+    uint64_t mBuckets[const_bucketCount];
+
+    /// Number of all values
+    uint64_t mCount;
+
+    /// Biggest value
+    uint64_t mMax;
+
+    /**
+     * @return index of the bucket of a value
+     */
+    static uint32_t getBucket(uint64_t value)
+    {
+        if (value < const_subBuckets)
+            return (uint32_t)value;
+
+        uint32_t exponent = 63 - __builtin_clzll(value);
+        uint32_t subBucket = (uint32_t)(value >> (exponent - 2)) & (const_subBuckets - 1);
+
+        return (exponent - 1) * const_subBuckets + subBucket;
+    }
+
+    /**
+     * @return biggest value of a bucket
+     */
+    static uint64_t getBucketLimit(uint32_t bucket)
+    {
+        if (bucket < const_subBuckets)
+            return bucket;
+
+        uint32_t exponent = bucket / const_subBuckets + 1;
+        uint64_t subBucket = bucket % const_subBuckets;
+
+        return ((const_subBuckets + subBucket + 1) << (exponent - 2)) - 1;
+    }
+
+public:
+    Histogram() { reset(); }
+
+    /**
+     * Removes all values
+     */
+    void reset()
+    {
+        memset(mBuckets, 0, sizeof(mBuckets));
+        mCount = 0;
+        mMax = 0;
+    }
+
+    /**
+     * Adds a value
+     */
+    void record(uint64_t value)
+    {
+        mBuckets[getBucket(value)]++;
+        mCount++;
+
+        if (value > mMax)
+            mMax = value;
+    }
+
+    /**
+     * Adds all values of another histogram
+     */
+    void merge(const Histogram& other)
+    {
+        for (uint32_t bucket = 0; bucket < const_bucketCount; bucket++)
+            mBuckets[bucket] += other.mBuckets[bucket];
+
+        mCount += other.mCount;
+
+        if (other.mMax > mMax)
+            mMax = other.mMax;
+    }
+
+    /**
+     * @return number of recorded values
+     */
+    uint64_t getCount() const { return mCount; }
+
+    /**
+     * @return biggest recorded value
+     */
+    uint64_t getMax() const { return mMax; }
+
+    /**
+     * @param percentile between 0 and 100
+     * @return value below which the percentage of recorded values fall
+     */
+    uint64_t getPercentile(double percentile) const
+    {
+        uint64_t threshold = (uint64_t)(mCount * percentile / 100.0);
+        uint64_t count = 0;
+
+        for (uint32_t bucket = 0; bucket < const_bucketCount; bucket++)
+        {
+            count += mBuckets[bucket];
+
+            if (count > threshold)
+                return getBucketLimit(bucket) < mMax ? getBucketLimit(bucket) : mMax;
+        }
+
+        return mMax;
+    }
+};
@@ -0,0 +1,358 @@
+#include "SimdKernels.h"
+
+#include <cassert>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * One version of all kernels
+ */
+struct Kernels
+{
+    void (*integrate)(uint32_t, float, float*, float*, float*, const float*, const float*, const float*,
+                      uint32_t*, uint32_t);
+    uint32_t (*filterWithinRadius)(uint32_t, const float*, const float*, float, float, float, uint32_t*);
+    uint32_t (*filterInBounds)(uint32_t, const float*, const float*, float, float, float, float, uint32_t*);
+};
+
+// The arrays of the kernels never overlap, __restrict allows the compiler to vectorize the scalar loops as well
+
+static void integrateScalar(uint32_t count, float seconds,
+                            float* __restrict positionX, float* __restrict positionY, float* __restrict positionZ,
+                            const float* __restrict velocityX, const float* __restrict velocityY, const float* __restrict velocityZ,
+                            uint32_t* __restrict flags, uint32_t movedFlag)
+{
+    for (uint32_t index = 0; index < count; index++)
+    {
+        positionX[index] += velocityX[index] * seconds;
+        positionY[index] += velocityY[index] * seconds;
+        positionZ[index] += velocityZ[index] * seconds;
+
+        uint32_t moving = (velocityX[index] != 0.f) | (velocityY[index] != 0.f) | (velocityZ[index] != 0.f);
+        flags[index] |= moving * movedFlag;
+    }
+}
+
+static uint32_t filterWithinRadiusScalar(uint32_t count, const float* __restrict x, const float* __restrict z,
+                                         float centerX, float centerZ, float squaredRadius, uint32_t* __restrict result)
+{
+    uint32_t resultCount = 0;
+
+    for (uint32_t index = 0; index < count; index++)
+    {
+        float dx = x[index] - centerX;
+        float dz = z[index] - centerZ;
+
+        // always written, only kept when inside
+        result[resultCount] = index;
+        resultCount += dx*dx + dz*dz <= squaredRadius;
+    }
+
+    return resultCount;
+}
+
+static uint32_t filterInBoundsScalar(uint32_t count, const float* __restrict x, const float* __restrict z,
+                                     float minX, float minZ, float maxX, float maxZ, uint32_t* __restrict result)
+{
+    uint32_t resultCount = 0;
+
+    for (uint32_t index = 0; index < count; index++)
+    {
+        result[resultCount] = index;
+        resultCount += (x[index] >= minX) & (x[index] <= maxX) & (z[index] >= minZ) & (z[index] <= maxZ);
+    }
+
+    return resultCount;
+}
+
+static const Kernels const_scalarKernels = {integrateScalar, filterWithinRadiusScalar, filterInBoundsScalar};
+
+#ifdef SIMD_KERNELS_X86
+
+/**
+ * Appends base + the index of every set bit of mask to result
+ */
+static inline uint32_t appendIndices(uint32_t mask, uint32_t base, uint32_t* result, uint32_t resultCount)
+{
+    while (mask != 0)
+    {
+        result[resultCount++] = base + (uint32_t)__builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+
+    return resultCount;
+}
+
+__attribute__((target("sse4.1")))
+static void integrateSse41(uint32_t count, float seconds,
+                           float* positionX, float* positionY, float* positionZ,
+                           const float* velocityX, const float* velocityY, const float* velocityZ,
+                           uint32_t* flags, uint32_t movedFlag)
+{
+    __m128 time = _mm_set1_ps(seconds);
+    __m128 zero = _mm_setzero_ps();
+    __m128i moved = _mm_set1_epi32((int)movedFlag);
+
+    uint32_t index = 0;
+    for (; index + 4 <= count; index += 4)
+    {
+        __m128 vx = _mm_loadu_ps(velocityX + index);
+        __m128 vy = _mm_loadu_ps(velocityY + index);
+        __m128 vz = _mm_loadu_ps(velocityZ + index);
+
+        _mm_storeu_ps(positionX + index, _mm_add_ps(_mm_loadu_ps(positionX + index), _mm_mul_ps(vx, time)));
+        _mm_storeu_ps(positionY + index, _mm_add_ps(_mm_loadu_ps(positionY + index), _mm_mul_ps(vy, time)));
+        _mm_storeu_ps(positionZ + index, _mm_add_ps(_mm_loadu_ps(positionZ + index), _mm_mul_ps(vz, time)));
+
+        // all bits set in the lanes with a velocity
+        __m128i moving = _mm_castps_si128(_mm_or_ps(_mm_or_ps(_mm_cmpneq_ps(vx, zero), _mm_cmpneq_ps(vy, zero)), _mm_cmpneq_ps(vz, zero)));
+
+        __m128i* flagsPointer = (__m128i*)(flags + index);
+        _mm_storeu_si128(flagsPointer, _mm_or_si128(_mm_loadu_si128(flagsPointer), _mm_and_si128(moving, moved)));
+    }
+
+    integrateScalar(count - index, seconds, positionX + index, positionY + index, positionZ + index,
+                    velocityX + index, velocityY + index, velocityZ + index, flags + index, movedFlag);
+}
+
+__attribute__((target("sse4.1")))
+static uint32_t filterWithinRadiusSse41(uint32_t count, const float* x, const float* z,
+                                        float centerX, float centerZ, float squaredRadius, uint32_t* result)
+{
+    __m128 cx = _mm_set1_ps(centerX);
+    __m128 cz = _mm_set1_ps(centerZ);
+    __m128 radius = _mm_set1_ps(squaredRadius);
+
+    uint32_t resultCount = 0;
+    uint32_t index = 0;
+    for (; index + 4 <= count; index += 4)
+    {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + index), cx);
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + index), cz);
+        __m128 distance = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz));
+
+        resultCount = appendIndices((uint32_t)_mm_movemask_ps(_mm_cmple_ps(distance, radius)), index, result, resultCount);
+    }
+
+    for (; index < count; index++)
+    {
+        float dx = x[index] - centerX;
+        float dz = z[index] - centerZ;
+
+        if (dx*dx + dz*dz <= squaredRadius)
+            result[resultCount++] = index;
+    }
+
+    return resultCount;
+}
+
+__attribute__((target("sse4.1")))
+static uint32_t filterInBoundsSse41(uint32_t count, const float* x, const float* z,
+                                    float minX, float minZ, float maxX, float maxZ, uint32_t* result)
+{
+    __m128 lowX = _mm_set1_ps(minX);
+    __m128 lowZ = _mm_set1_ps(minZ);
+    __m128 highX = _mm_set1_ps(maxX);
+    __m128 highZ = _mm_set1_ps(maxZ);
+
+    uint32_t resultCount = 0;
+    uint32_t index = 0;
+    for (; index + 4 <= count; index += 4)
+    {
+        __m128 px = _mm_loadu_ps(x + index);
+        __m128 pz = _mm_loadu_ps(z + index);
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(px, lowX), _mm_cmple_ps(px, highX)),
+                                   _mm_and_ps(_mm_cmpge_ps(pz, lowZ), _mm_cmple_ps(pz, highZ)));
+
+        resultCount = appendIndices((uint32_t)_mm_movemask_ps(inside), index, result, resultCount);
+    }
+
+    for (; index < count; index++)
+    {
+        if (x[index] >= minX && x[index] <= maxX && z[index] >= minZ && z[index] <= maxZ)
+            result[resultCount++] = index;
+    }
+
+    return resultCount;
+}
+
+static const Kernels const_sse41Kernels = {integrateSse41, filterWithinRadiusSse41, filterInBoundsSse41};
+
+__attribute__((target("avx2")))
+static void integrateAvx2(uint32_t count, float seconds,
+                          float* positionX, float* positionY, float* positionZ,
+                          const float* velocityX, const float* velocityY, const float* velocityZ,
+                          uint32_t* flags, uint32_t movedFlag)
+{
+    __m256 time = _mm256_set1_ps(seconds);
+    __m256 zero = _mm256_setzero_ps();
+    __m256i moved = _mm256_set1_epi32((int)movedFlag);
+
+    uint32_t index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m256 vx = _mm256_loadu_ps(velocityX + index);
+        __m256 vy = _mm256_loadu_ps(velocityY + index);
+        __m256 vz = _mm256_loadu_ps(velocityZ + index);
+
+        _mm256_storeu_ps(positionX + index, _mm256_add_ps(_mm256_loadu_ps(positionX + index), _mm256_mul_ps(vx, time)));
+        _mm256_storeu_ps(positionY + index, _mm256_add_ps(_mm256_loadu_ps(positionY + index), _mm256_mul_ps(vy, time)));
+        _mm256_storeu_ps(positionZ + index, _mm256_add_ps(_mm256_loadu_ps(positionZ + index), _mm256_mul_ps(vz, time)));
+
+        __m256i moving = _mm256_castps_si256(_mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(vx, zero, _CMP_NEQ_UQ),
+                                                                       _mm256_cmp_ps(vy, zero, _CMP_NEQ_UQ)),
+                                                          _mm256_cmp_ps(vz, zero, _CMP_NEQ_UQ)));
+
+        __m256i* flagsPointer = (__m256i*)(flags + index);
+        _mm256_storeu_si256(flagsPointer, _mm256_or_si256(_mm256_loadu_si256(flagsPointer), _mm256_and_si256(moving, moved)));
+    }
+
+    integrateSse41(count - index, seconds, positionX + index, positionY + index, positionZ + index,
+                   velocityX + index, velocityY + index, velocityZ + index, flags + index, movedFlag);
+}
+
+__attribute__((target("avx2")))
+static uint32_t filterWithinRadiusAvx2(uint32_t count, const float* x, const float* z,
+                                       float centerX, float centerZ, float squaredRadius, uint32_t* result)
+{
+    __m256 cx = _mm256_set1_ps(centerX);
+    __m256 cz = _mm256_set1_ps(centerZ);
+    __m256 radius = _mm256_set1_ps(squaredRadius);
+
+    uint32_t resultCount = 0;
+    uint32_t index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + index), cx);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z + index), cz);
+        __m256 distance = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dz, dz));
+
+        uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(distance, radius, _CMP_LE_OQ));
+        resultCount = appendIndices(mask, index, result, resultCount);
+    }
+
+    for (; index < count; index++)
+    {
+        float dx = x[index] - centerX;
+        float dz = z[index] - centerZ;
+
+        if (dx*dx + dz*dz <= squaredRadius)
+            result[resultCount++] = index;
+    }
+
+    return resultCount;
+}
+
+__attribute__((target("avx2")))
+static uint32_t filterInBoundsAvx2(uint32_t count, const float* x, const float* z,
+                                   float minX, float minZ, float maxX, float maxZ, uint32_t* result)
+{
+    __m256 lowX = _mm256_set1_ps(minX);
+    __m256 lowZ = _mm256_set1_ps(minZ);
+    __m256 highX = _mm256_set1_ps(maxX);
+    __m256 highZ = _mm256_set1_ps(maxZ);
+
+    uint32_t resultCount = 0;
+    uint32_t index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m256 px = _mm256_loadu_ps(x + index);
+        __m256 pz = _mm256_loadu_ps(z + index);
+        __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(px, lowX, _CMP_GE_OQ), _mm256_cmp_ps(px, highX, _CMP_LE_OQ)),
+                                      _mm256_and_ps(_mm256_cmp_ps(pz, lowZ, _CMP_GE_OQ), _mm256_cmp_ps(pz, highZ, _CMP_LE_OQ)));
+
+        resultCount = appendIndices((uint32_t)_mm256_movemask_ps(inside), index, result, resultCount);
+    }
+
+    for (; index < count; index++)
+    {
+        if (x[index] >= minX && x[index] <= maxX && z[index] >= minZ && z[index] <= maxZ)
+            result[resultCount++] = index;
+    }
+
+    return resultCount;
+}
+
+static const Kernels const_avx2Kernels = {integrateAvx2, filterWithinRadiusAvx2, filterInBoundsAvx2};
+
+#endif
+
+SimdKernels::Level SimdKernels::getSupportedLevel()
+{
+#ifdef SIMD_KERNELS_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return Level::AVX2;
+
+    if (__builtin_cpu_supports("sse4.1"))
+        return Level::SSE41;
+#endif
+
+    return Level::SCALAR;
+}
+
+/**
+ * @return the kernels of a Level
+ */
+static const Kernels* getKernels(SimdKernels::Level level)
+{
+    switch (level)
+    {
+#ifdef SIMD_KERNELS_X86
+        case SimdKernels::Level::AVX2: return &const_avx2Kernels;
+        case SimdKernels::Level::SSE41: return &const_sse41Kernels;
+#endif
+        default: return &const_scalarKernels;
+    }
+}
+
+static SimdKernels::Level sLevel = SimdKernels::getSupportedLevel();
+static const Kernels* sKernels = getKernels(sLevel);
+
+SimdKernels::Level SimdKernels::getLevel()
+{
+    return sLevel;
+}
+
+void SimdKernels::setLevel(Level level)
+{
+    assert(level <= getSupportedLevel());
+
+    sLevel = level;
+    sKernels = getKernels(level);
+}
+
+const char* SimdKernels::getLevelName(Level level)
+{
+    switch (level)
+    {
+        case Level::AVX2: return "AVX2";
+        case Level::SSE41: return "SSE4.1";
+        default: return "scalar";
+    }
+}
+
+void SimdKernels::integrate(uint32_t count, float seconds,
+                            float* positionX, float* positionY, float* positionZ,
+                            const float* velocityX, const float* velocityY, const float* velocityZ,
+                            uint32_t* flags, uint32_t movedFlag)
+{
+    sKernels->integrate(count, seconds, positionX, positionY, positionZ, velocityX, velocityY, velocityZ,
+                        flags, movedFlag);
+}
+
+uint32_t SimdKernels::filterWithinRadius(uint32_t count, const float* x, const float* z,
+                                         float centerX, float centerZ, float squaredRadius, uint32_t* result)
+{
+    return sKernels->filterWithinRadius(count, x, z, centerX, centerZ, squaredRadius, result);
+}
+
+uint32_t SimdKernels::filterInBounds(uint32_t count, const float* x, const float* z,
+                                     float minX, float minZ, float maxX, float maxZ, uint32_t* result)
+{
+    return sKernels->filterInBounds(count, x, z, minX, minZ, maxX, maxZ, result);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Vectorized loops over structure of arrays data, e.g. the EntityRegistry
+ *
+ * Every kernel has a scalar, a SSE4.1 and an AVX2 version. The best version
+ * supported by the CPU is selected at startup, so the server runs on any
+ * x86 CPU without compiling it for a specific one. Other platforms and
+ * compilers use the scalar versions.
+ *
+ * All versions calculate in the same order without fused multiply-add,
+ * so they return exactly the same results.
+ */
+class SimdKernels
+{
+public:
+    /**
+     * Instruction set used by the kernels
+     */
+    enum class Level
+    {
+        SCALAR,
+        SSE41,
+        AVX2,
+    };
+
+    /**
+     * @return best Level supported by the CPU
+     */
+    static Level getSupportedLevel();
+
+    /**
+     * @return Level currently used
+     */
+    static Level getLevel();
+
+    /**
+     * Selects the instruction set, e.g. for comparing them
+     * @param level must not be above getSupportedLevel()
+     * @remark not thread-safe, no kernel must run at the same time
+     */
+    static void setLevel(Level level);
+
+    /**
+     * @return name of a Level for logs
+     */
+    static const char* getLevelName(Level level);
+
+    /**
+     * Moves count positions by their velocity. Every moving position
+     * gets movedFlag set in it's flags.
+     * @param seconds time since the last integration
+     */
+    static void integrate(uint32_t count, float seconds,
+                          float* positionX, float* positionY, float* positionZ,
+                          const float* velocityX, const float* velocityY, const float* velocityZ,
+                          uint32_t* flags, uint32_t movedFlag);
+
+    /**
+     * Collects the indices of all points within a radius around a center on the ground plane
+     * @param count number of points
+     * @param x, z coordinates of the points
+     * @param centerX, centerZ center of the circle
+     * @param squaredRadius radius of the circle, squared
+     * @param result receives the indices in ascending order, must hold count indices
+     * @return number of indices written to result
+     */
+    static uint32_t filterWithinRadius(uint32_t count, const float* x, const float* z,
+                                       float centerX, float centerZ, float squaredRadius, uint32_t* result);
+
+    /**
+     * Collects the indices of all points inside a rectangle on the ground plane, including the borders
+     * @param count number of points
+     * @param x, z coordinates of the points
+     * @param result receives the indices in ascending order, must hold count indices
+     * @return number of indices written to result
+     */
+    static uint32_t filterInBounds(uint32_t count, const float* x, const float* z,
+                                   float minX, float minZ, float maxX, float maxZ, uint32_t* result);
+};
@@ -0,0 +1,62 @@
+#include "TickScheduler.h"
+
+TickScheduler::TickScheduler(uint32_t tickRate)
+{
+    setTickRate(tickRate);
+}
+
+void TickScheduler::setTickRate(uint32_t tickRate)
+{
+    mPeriod = 1000000000ull / (tickRate > 0 ? tickRate : 1);
+}
+
+void TickScheduler::setCatchUpPolicy(CatchUpPolicy policy, uint32_t maxBurst)
+{
+    mCatchUpPolicy = policy;
+    mMaxBurst = maxBurst;
+}
+
+void TickScheduler::reset(uint64_t currentTime)
+{
+    mNextTick = currentTime;
+    mPreviousTickStart = currentTime;
+    mTickStart = currentTime;
+}
+
+uint64_t TickScheduler::beginTick(uint64_t currentTime)
+{
+    mLateness.record(currentTime > mNextTick ? currentTime - mNextTick : 0);
+
+    mPreviousTickStart = mTickStart;
+    mTickStart = currentTime;
+
+    return mTickStart - mPreviousTickStart;
+}
+
+void TickScheduler::endTick(uint64_t currentTime)
+{
+    uint64_t duration = currentTime - mTickStart;
+
+    mTickDuration.record(duration);
+
+    if (duration > mPeriod)
+        mOverrunCount++;
+
+    mNextTick += mPeriod;
+
+    if (currentTime < mNextTick)
+        return;
+
+    // behind schedule, the next tick is already due
+    uint64_t missedTicks = (currentTime - mNextTick) / mPeriod + 1;
+    uint64_t allowedTicks = mCatchUpPolicy == CatchUpPolicy::BURST ? mMaxBurst : 0;
+
+    if (missedTicks > allowedTicks)
+    {
+        // keep the phase, so ticks stay at multiples of the period
+        uint64_t skippedTicks = missedTicks - allowedTicks;
+
+        mNextTick += skippedTicks * mPeriod;
+        mSkippedTickCount += skippedTicks;
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Histogram.h"
+
+/**
+ * @brief Paces a fixed timestep loop on the monotonic nanosecond clock
+ *
+ * Ticks are due at fixed multiples of the period, independent of how
+ * long a tick takes. The scheduler only decides when the next tick is due,
+ * the ZonePool waits for it (see ZonePool::waitUntil()), so it can be woken
+ * up early, and spins for the last part of the wait to keep the jitter low.
+ *
+ * When a tick takes longer than the period (an overrun), the following
+ * ticks are late. The CatchUpPolicy decides what happens then.
+ *
+ * Usage per tick: beginTick(), the work, endTick(), then wait until getNextTick().
+ *
+ * @remark not thread-safe, to be used by a single thread
+ */
+class TickScheduler
+{
+public:
+    /**
+     * What happens with ticks which are already due when the previous one ends
+     */
+    enum class CatchUpPolicy
+    {
+        /// drop all missed ticks and continue with the next one in the future
+        SKIP,
+        /// run up to maxBurst missed ticks back-to-back, drop the rest
+        BURST,
+    };
+
+private:
+    /// Time between two ticks in nanoseconds
+    uint64_t mPeriod;
+
+    /// Time the next tick is due
+    uint64_t mNextTick = 0;
+
+    /// Start of the previous tick
+    uint64_t mPreviousTickStart = 0;
+
+    /// Start of the current tick
+    uint64_t mTickStart = 0;
+
+    CatchUpPolicy mCatchUpPolicy = CatchUpPolicy::BURST;
+
+    /// Maximum number of ticks run back-to-back with CatchUpPolicy::BURST
+    uint32_t mMaxBurst = 2;
+
+    /// Duration of the work of every tick
+    Histogram mTickDuration;
+
+    /// How much later than it's deadline every tick started
+    Histogram mLateness;
+
+    /// Number of ticks taking longer than the period
+    uint64_t mOverrunCount = 0;
+
+    /// Number of ticks dropped by the CatchUpPolicy
+    uint64_t mSkippedTickCount = 0;
+
+public:
+    /**
+     * @param tickRate ticks per second
+     */
+    TickScheduler(uint32_t tickRate);
+
+    /**
+     * Sets the number of ticks per second
+     */
+    void setTickRate(uint32_t tickRate);
+
+    /**
+     * Sets how missed ticks are handled
+     * @param policy SKIP or BURST
+     * @param maxBurst maximum number of ticks run back-to-back, only for BURST
+     */
+    void setCatchUpPolicy(CatchUpPolicy policy, uint32_t maxBurst);
+
+    /**
+     * Starts the schedule from now, without catching up the time since the last tick
+     * @param currentTime time in nanoseconds
+     */
+    void reset(uint64_t currentTime);
+
+    /**
+     * Makes the next tick due now, if it's due later
+     * @param currentTime time in nanoseconds
+     */
+    void rescheduleNow(uint64_t currentTime)
+    {
+        if (currentTime < mNextTick)
+            mNextTick = currentTime;
+    }
+
+    /**
+     * To be called when a tick begins
+     * @param currentTime time in nanoseconds
+     * @return nanoseconds since the begin of the previous tick
+     */
+    uint64_t beginTick(uint64_t currentTime);
+
+    /**
+     * To be called when the work of a tick is done
+     * Decides when the next tick is due
+     * @param currentTime time in nanoseconds
+     */
+    void endTick(uint64_t currentTime);
+
+    /**
+     * @return time between two ticks in nanoseconds
+     */
+    uint64_t getPeriod() const { return mPeriod; }
+
+    /**
+     * @return time in nanoseconds the next tick is due
+     */
+    uint64_t getNextTick() const { return mNextTick; }
+
+    /**
+     * @return ticks per second
+     */
+    uint32_t getTickRate() const { return (uint32_t)(1000000000ull / mPeriod); }
+
+    const Histogram& getTickDuration() const { return mTickDuration; }
+    const Histogram& getLateness() const { return mLateness; }
+    uint64_t getOverrunCount() const { return mOverrunCount; }
+    uint64_t getSkippedTickCount() const { return mSkippedTickCount; }
+
+    /**
+     * Clears both histograms, the counters stay
+     */
+    void resetHistograms()
+    {
+        mTickDuration.reset();
+        mLateness.reset();
+    }
+};
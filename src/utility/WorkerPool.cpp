@@ -0,0 +1,180 @@
+#include "WorkerPool.h"
+
+WorkerPool* WorkerPool::instance = nullptr;
+
+thread_local uint32_t WorkerPool::tQueueIndex = UINT32_MAX;
+
+WorkerPool::WorkerPool(uint32_t threadCount)
+{
+    if (WorkerPool::instance != nullptr)
+        assert(false);
+
+    WorkerPool::instance = this;
+
+    // one more for the threads which are no worker
+    for (uint32_t i = 0; i <= threadCount; i++)
+        mQueues.emplace_back(new JobQueue());
+
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        mThreads.emplace_back([this, i]() {
+            run(i);
+        });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mStopping = true;
+    }
+    mSleepCondition.notify_all();
+
+    for (auto& thread : mThreads)
+        thread.join();
+
+    WorkerPool::instance = nullptr;
+}
+
+void WorkerPool::run(uint32_t index)
+{
+    tQueueIndex = index;
+
+    while (!mStopping)
+    {
+        Job job;
+
+        if (findJob(job))
+        {
+            execute(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+
+        // spawn() only notifies when it sees a sleeping worker, so count first and check afterwards
+        mSleepingCount++;
+        mSleepCondition.wait(lock, [this]() { return mStopping || mQueuedJobCount > 0; });
+        mSleepingCount--;
+    }
+}
+
+bool WorkerPool::findJob(Job& job)
+{
+    if (mQueuedJobCount == 0)
+        return false;
+
+    uint32_t queueCount = (uint32_t)mQueues.size();
+    uint32_t ownIndex = tQueueIndex < queueCount ? tQueueIndex : queueCount - 1;
+
+    // the newest job of the own queue, it's data is most likely still in the cache
+    {
+        JobQueue& queue = *mQueues[ownIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (!queue.jobs.empty())
+        {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+            mQueuedJobCount--;
+            return true;
+        }
+    }
+
+    // otherwise the oldest job of another queue, it's most likely the largest
+    for (uint32_t offset = 1; offset < queueCount; offset++)
+    {
+        JobQueue& queue = *mQueues[(ownIndex + offset) % queueCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (!queue.jobs.empty())
+        {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            mQueuedJobCount--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkerPool::execute(Job& job)
+{
+    job.function();
+
+    // the group may be gone right after this, so it's the last access
+    if (--job.group->mPendingJobs != 0)
+        return;
+
+    // wakes up the thread waiting for the group, taking the lock makes sure it's either checking or already waiting
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+    }
+    mSleepCondition.notify_all();
+}
+
+void WorkerPool::spawn(JobGroup& group, std::function<void()> job)
+{
+    group.mPendingJobs++;
+
+    uint32_t queueCount = (uint32_t)mQueues.size();
+    JobQueue& queue = *mQueues[tQueueIndex < queueCount ? tQueueIndex : queueCount - 1];
+
+    {
+        // counted with the lock held, like when it's taken, so a thief can't count it down first
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        mQueuedJobCount++;
+        queue.jobs.push_back({std::move(job), &group});
+    }
+
+    if (mSleepingCount > 0)
+    {
+        // taking the lock makes sure the worker either sees the job or is already waiting
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+        }
+        mSleepCondition.notify_one();
+    }
+}
+
+void WorkerPool::wait(JobGroup& group)
+{
+    while (group.mPendingJobs > 0)
+    {
+        Job job;
+
+        if (findJob(job))
+        {
+            execute(job);
+            continue;
+        }
+
+        // the remaining jobs are running on other threads, sleep until they are done or there is a job to help with
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+
+        mSleepingCount++;
+        mSleepCondition.wait(lock, [this, &group]() { return group.mPendingJobs == 0 || mQueuedJobCount > 0; });
+        mSleepingCount--;
+    }
+}
+
+void WorkerPool::parallelFor(uint32_t count, const std::function<void(uint32_t)>& job)
+{
+    if (count == 0)
+        return;
+
+    JobGroup group;
+
+    for (uint32_t index = 1; index < count; index++)
+    {
+        spawn(group, [&job, index]() {
+            job(index);
+        });
+    }
+
+    job(0);
+
+    wait(group);
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define sWorkerPool WorkerPool::getInstance()
+
+/**
+ * @brief A fork-join job system for running work of other threads in parallel
+ *
+ * Used by Zones to spread the work of a single tick over multiple cores.
+ *
+ * Every worker has it's own deque of jobs. A worker takes the newest job of
+ * it's own deque first and steals the oldest jobs of the others when it's empty.
+ * Threads which are no worker (e.g. the ZonePool threads) put their jobs into
+ * a shared deque.
+ *
+ * Jobs are spawned into a JobGroup. Waiting for a JobGroup helps: the waiting
+ * thread runs queued jobs until all jobs of the group are done, so jobs may
+ * spawn and wait for jobs themselves. When the remaining jobs run on other
+ * threads, it sleeps until the last one is done or a new job is queued.
+ *
+ * @remark Singleton
+ */
+class WorkerPool
+{
+public:
+    /**
+     * A set of jobs which can be waited for
+     */
+    class JobGroup
+    {
+        friend class WorkerPool;
+
+        /// Number of spawned jobs which are not done yet
+        std::atomic<uint32_t> mPendingJobs{0};
+    };
+
+private:
+    /**
+     * A function to run with the JobGroup it belongs to
+     */
+    struct Job
+    {
+        std::function<void()> function;
+        JobGroup* group;
+    };
+
+    /**
+     * The jobs of one thread
+     */
+    struct JobQueue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    /// The Singleton instance
+    static WorkerPool* instance;
+
+    /// Index of the JobQueue of the current worker thread, the shared one for other threads
+    static thread_local uint32_t tQueueIndex;
+
+    /// All worker threads
+    std::vector<std::thread> mThreads;
+
+    /// One JobQueue per worker, the last one is shared by all other threads
+    std::vector<std::unique_ptr<JobQueue>> mQueues;
+
+    /// Number of jobs in all queues
+    std::atomic<uint32_t> mQueuedJobCount{0};
+
+    /// Number of threads waiting for jobs, workers or threads in wait()
+    std::atomic<uint32_t> mSleepingCount{0};
+
+    /// For waiting for jobs
+    std::mutex mSleepMutex;
+
+    /// Notifies sleeping threads about new jobs, finished JobGroups or stopping
+    std::condition_variable mSleepCondition;
+
+    /// true when the workers should exit
+    std::atomic<bool> mStopping{false};
+
+    /**
+     * Main loop of a worker thread
+     * @param index index of the worker
+     */
+    void run(uint32_t index);
+
+    /**
+     * Takes a job of the own queue, or steals one of another queue
+     * @param job the job found
+     * @return false if all queues are empty
+     */
+    bool findJob(Job& job);
+
+    /**
+     * Runs a job and marks it as done in it's JobGroup
+     */
+    void execute(Job& job);
+
+public:
+    /**
+     * Starts the worker threads
+     * @param threadCount number of threads
+     */
+    WorkerPool(uint32_t threadCount);
+
+    /**
+     * Stops and joins all worker threads
+     */
+    ~WorkerPool();
+
+    /**
+     * Returns the WorkerPool
+     */
+    static WorkerPool* getInstance() { return instance; }
+
+    /**
+     * @return number of worker threads
+     */
+    uint32_t getThreadCount() { return (uint32_t)mThreads.size(); }
+
+    /**
+     * Queues a job, it runs on any thread working for the pool
+     * @param group the JobGroup to wait for the job with
+     * @param job function to call
+     * @remark Thread-Safe
+     */
+    void spawn(JobGroup& group, std::function<void()> job);
+
+    /**
+     * Runs queued jobs until all jobs of the group are done, sleeps while
+     * the remaining ones run on other threads
+     * @param group JobGroup to wait for
+     * @remark Thread-Safe
+     */
+    void wait(JobGroup& group);
+
+    /**
+     * Calls job(index) for every index in [0, count), spread over the
+     * worker threads and the calling thread.
+     * @param count number of indices
+     * @param job function to call for each index
+     * @remark blocks until all indices are processed
+     * @remark Thread-Safe
+     */
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& job);
+};
@@ -17,6 +17,28 @@ inline TimePoint getTimeMilliseconds()
     return (TimePoint)std::chrono::duration_cast<std::chrono::milliseconds>(time_since_epoch).count();
 }
 
+/**
+ *
+ * @return current time in Microseconds
+ */
+inline uint64_t getTimeMicroseconds()
+{
+    auto time_since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(time_since_epoch).count();
+}
+
+/**
+ * Monotonic clock, doesn't wrap around
+ * @return current time in Nanoseconds
+ */
+inline uint64_t getTimeNanoseconds()
+{
+    auto time_since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(time_since_epoch).count();
+}
+
 /**
  * Sleeps the calling thread for the amount
  * @param milliseconds amount in milliseconds
@@ -0,0 +1,141 @@
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Metrics/Metrics.h"
+#include "Network/OpcodeHandler.h"
+#include "Network/Packet.h"
+#include "Network/PlayerSession.h"
+#include "World/Zone.h"
+#include "Log/Logger.h"
+
+/// Players handed off between the Zones
+static const uint32_t const_playerCount = 1000;
+/// Rounds of random handoff requests
+static const uint32_t const_roundCount = 2000;
+/// A player disconnects every this many rounds
+static const uint32_t const_disconnectInterval = 10;
+/// Players starting to observe a Zone per round
+static const uint32_t const_observersPerRound = 4;
+
+/**
+ * Hands off 1000 players between two Zones ticking on their own threads, while
+ * players observe the Zones and disconnect in between. Every remaining player
+ * must end up in exactly one Zone with exactly one entity, and only the
+ * remaining observers may be left in the Zones.
+ */
+int main()
+{
+    Logger* logger = new Logger();
+    Metrics* metrics = new Metrics();
+
+    Zone first(1);
+    Zone second(2);
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-1000.f, 1000.f);
+
+    std::vector<PlayerSession*> sessions;
+    std::vector<bool> observing(const_playerCount, false);
+    for (uint32_t i = 0; i < const_playerCount; i++)
+    {
+        PlayerSession* session = new PlayerSession(nullptr);
+        first.addSession(session);
+
+        // spread out, so the Zones don't replicate everyone to everyone
+        std::shared_ptr<Packet> movement = std::make_shared<Packet>((int)OpcodeHandler::Opcodes::CS_MOVEPACKET);
+        *movement << position(random);
+        *movement << 0.f;
+        *movement << position(random);
+        session->queuePacket(&PlayerSession::handleMovementPacket, movement);
+
+        sessions.push_back(session);
+    }
+
+    std::atomic<bool> stopping{false};
+    std::thread firstThread([&]() { while (!stopping) first.update(50); });
+    std::thread secondThread([&]() { while (!stopping) second.update(50); });
+
+    for (uint32_t round = 0; round < const_roundCount; round++)
+    {
+        for (auto session : sessions)
+        {
+            if (session != nullptr)
+                session->requestHandoff(random() % 2 == 0 ? &first : &second);
+        }
+
+        // the Zones send their frames to the observers meanwhile
+        for (uint32_t i = 0; i < const_observersPerRound; i++)
+        {
+            uint32_t index = random() % const_playerCount;
+            if (sessions[index] == nullptr)
+                continue;
+
+            if (random() % 4 == 0)
+            {
+                sessions[index]->stopObserving();
+                observing[index] = false;
+            }
+            else
+            {
+                sessions[index]->observe(random() % 2 == 0 ? &first : &second, INVALID_ENTITY, random() % 2 * 100);
+                observing[index] = true;
+            }
+        }
+
+        if (round % const_disconnectInterval == 0)
+        {
+            PlayerSession*& session = sessions[random() % const_playerCount];
+            delete session;
+            session = nullptr;
+        }
+
+        std::this_thread::yield();
+    }
+
+    stopping = true;
+    firstThread.join();
+    secondThread.join();
+
+    // adopts the sessions still on their way
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        first.update(50);
+        second.update(50);
+    }
+
+    uint32_t remaining = 0;
+    uint32_t observers = 0;
+    bool misplaced = false;
+    for (uint32_t i = 0; i < const_playerCount; i++)
+    {
+        if (sessions[i] == nullptr)
+            continue;
+
+        remaining++;
+        observers += observing[i];
+        misplaced |= sessions[i]->getZone() != &first && sessions[i]->getZone() != &second;
+    }
+
+    uint32_t sessionCount = first.getSessionCount() + second.getSessionCount();
+    uint32_t entityCount = first.getEntities().size() + second.getEntities().size();
+    uint32_t observerCount = first.getObserverCount() + second.getObserverCount();
+    int64_t handoffCount = metrics->get("zone.handoffs");
+
+    printf("players %u, sessions %u, entities %u, observers %u of %u, handoffs %ld\n",
+           remaining, sessionCount, entityCount, observerCount, observers, (long)handoffCount);
+
+    bool passed = !misplaced && sessionCount == remaining && entityCount == remaining && observerCount == observers &&
+                  handoffCount > 0;
+
+    for (auto session : sessions)
+        delete session;
+
+    delete metrics;
+    delete logger;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "utility/SimdKernels.h"
+
+/// Numbers of points, around the vector widths for the scalar tails
+static const uint32_t const_counts[] = {0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 33, 1000, 100003};
+
+/**
+ * Points and velocities, with the values the comparisons of the kernels have to agree on:
+ * points exactly on the borders, negative zeros and NaNs
+ */
+struct Points
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> velocityX;
+    std::vector<float> velocityY;
+    std::vector<float> velocityZ;
+
+    Points(uint32_t count, std::mt19937& random)
+        : x(count), y(count), z(count), velocityX(count), velocityY(count), velocityZ(count)
+    {
+        std::uniform_real_distribution<float> position(-500.f, 500.f);
+        std::uniform_real_distribution<float> velocity(-10.f, 10.f);
+        float specials[] = {0.f, -0.f, 100.f, -100.f, 60.f, std::numeric_limits<float>::quiet_NaN()};
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            x[i] = random() % 8 == 0 ? specials[random() % 6] : position(random);
+            y[i] = position(random);
+            z[i] = random() % 8 == 0 ? specials[random() % 6] : position(random);
+
+            // many entities stand still
+            velocityX[i] = random() % 3 == 0 ? specials[random() % 6] : velocity(random);
+            velocityY[i] = random() % 2 == 0 ? 0.f : velocity(random);
+            velocityZ[i] = random() % 3 == 0 ? specials[random() % 6] : velocity(random);
+        }
+    }
+};
+
+/**
+ * Results of all kernels for one Level
+ */
+struct Results
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<uint32_t> flags;
+    std::vector<uint32_t> withinRadius;
+    std::vector<uint32_t> inBounds;
+
+    bool operator==(const Results& other) const
+    {
+        // bit-identical, so NaN positions compare as well
+        return x.size() == other.x.size() &&
+               memcmp(x.data(), other.x.data(), x.size() * sizeof(float)) == 0 &&
+               memcmp(y.data(), other.y.data(), y.size() * sizeof(float)) == 0 &&
+               memcmp(z.data(), other.z.data(), z.size() * sizeof(float)) == 0 &&
+               flags == other.flags && withinRadius == other.withinRadius && inBounds == other.inBounds;
+    }
+};
+
+static Results run(const Points& points)
+{
+    uint32_t count = (uint32_t)points.x.size();
+
+    Results results;
+    results.x = points.x;
+    results.y = points.y;
+    results.z = points.z;
+
+    // the other bits of the flags stay as they are
+    results.flags.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+        results.flags[i] = i & 6;
+
+    SimdKernels::integrate(count, 0.05f, results.x.data(), results.y.data(), results.z.data(),
+                           points.velocityX.data(), points.velocityY.data(), points.velocityZ.data(),
+                           results.flags.data(), 1);
+
+    results.withinRadius.resize(count);
+    results.withinRadius.resize(SimdKernels::filterWithinRadius(count, points.x.data(), points.z.data(),
+                                                                0.f, 0.f, 100.f * 100.f, results.withinRadius.data()));
+
+    results.inBounds.resize(count);
+    results.inBounds.resize(SimdKernels::filterInBounds(count, points.x.data(), points.z.data(),
+                                                        -100.f, -100.f, 100.f, 60.f, results.inBounds.data()));
+
+    return results;
+}
+
+/**
+ * Runs all kernels at every Level the CPU supports, the results must be
+ * bit-identical to the ones of the scalar versions.
+ */
+int main()
+{
+    std::mt19937 random(1);
+
+    SimdKernels::Level supportedLevel = SimdKernels::getSupportedLevel();
+    printf("supported %s\n", SimdKernels::getLevelName(supportedLevel));
+
+    bool passed = true;
+    for (uint32_t count : const_counts)
+    {
+        Points points(count, random);
+
+        SimdKernels::setLevel(SimdKernels::Level::SCALAR);
+        Results expected = run(points);
+
+        for (int level = (int)SimdKernels::Level::SCALAR + 1; level <= (int)supportedLevel; level++)
+        {
+            SimdKernels::setLevel((SimdKernels::Level)level);
+            bool equal = run(points) == expected;
+
+            printf("%u points, %s: %s\n", count, SimdKernels::getLevelName((SimdKernels::Level)level),
+                   equal ? "identical" : "DIFFERENT");
+            passed &= equal;
+        }
+    }
+
+    SimdKernels::setLevel(supportedLevel);
+
+    return passed ? 0 : 1;
+}